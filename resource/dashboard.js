@@ -0,0 +1,30 @@
+// Build status changes are pushed over the "builds" channel
+(function() {
+  const body = document.querySelector('#builds tbody');
+  const rows = {};
+
+  function update(build) {
+    let row = rows[build.id];
+    if (!row) {
+      row = rows[build.id] = body.insertRow(0);
+      row.insertCell();
+      row.insertCell();
+      row.insertCell();
+    }
+    row.cells[0].textContent = build.id;
+    row.cells[1].textContent = build.project_id;
+    row.cells[2].textContent = build.status;
+  }
+
+  function connect() {
+    const socket = new WebSocket('ws://' + location.host + '/ws/builds');
+    socket.onmessage = function(event) {
+      update(JSON.parse(event.data));
+    };
+    socket.onclose = function() {
+      setTimeout(connect, 1000);
+    };
+  }
+
+  connect();
+})();
@@ -0,0 +1,228 @@
+#include <algorithm> // std::sort, std::max
+#include <iostream> // std::cout, std::cerr
+#include <optional> // std::optional
+#include <string_view> // std::string_view
+#include <random> // std::mt19937_64
+#include <thread> // std::thread
+#include <vector> // std::vector
+
+#include <cstdio> // std::remove, std::printf
+
+#include <ftw.h> // nftw, FTW_DEPTH, FTW_PHYS
+
+#include "benchmark.h"
+#include "database.h"
+#include "buildlog.h"
+
+// A less durable profile has to be this much faster than a more durable
+// one to be recommended over it
+static constexpr double k_margin = 1.10;
+
+// Share of operations of each kind, in percent, roughly what a dashboard
+// and a few builds streaming logs do
+static constexpr unsigned k_page_builds = 35;
+static constexpr unsigned k_page_logs = 15;
+static constexpr unsigned k_find_build = 15;
+static constexpr unsigned k_insert_build = 10;
+static constexpr unsigned k_update_build = 10;
+static constexpr unsigned k_log_request = 10;
+static_assert(k_page_builds + k_page_logs + k_find_build + k_insert_build + k_update_build + k_log_request < 100,
+              "The rest are build log appends");
+
+struct Result
+{
+  uint64_t operations = 0;
+  uint64_t failures = 0;
+  uint64_t p50 = 0; // Microseconds
+  uint64_t p99 = 0;
+};
+
+// The copy, its journal files and its segment directory with a directory
+// per table
+static void remove_scratch(const std::string& path) {
+  for (const char *suffix : { "", "-wal", "-shm", "-journal" }) {
+    std::remove((path + suffix).c_str());
+  }
+  // Depth first, so directories are empty by the time they're removed
+  nftw((path + ".logs").c_str(), [](const char *name, const struct stat *, int, FTW *) {
+    return std::remove(name) == 0 ? 0 : -1;
+  }, 8, FTW_DEPTH | FTW_PHYS);
+}
+
+// A consistent snapshot even while the server writes to path
+static bool copy(const std::string& path, const std::string& scratch) {
+  remove_scratch(scratch);
+  sqlite3 *db = nullptr;
+  if (sqlite3_open_v2(path.c_str(), &db, SQLITE_OPEN_READONLY, nullptr) != SQLITE_OK) {
+    sqlite3_close(db);
+    return false;
+  }
+  sqlite3_stmt *statement = nullptr;
+  const bool copied =
+    sqlite3_prepare_v2(db, "VACUUM INTO ?", -1, &statement, nullptr) == SQLITE_OK &&
+    sqlite3_bind_text(statement, 1, scratch.c_str(), scratch.size(), SQLITE_STATIC) == SQLITE_OK &&
+    sqlite3_step(statement) == SQLITE_DONE;
+  sqlite3_finalize(statement);
+  sqlite3_close(db);
+  return copied;
+}
+
+// The copy has to be migrated by a first open before it has the column
+static bool select_profile(const std::string& scratch, const char *profile) {
+  {
+    Database db;
+    if (!db.open(scratch)) {
+      return false;
+    }
+  }
+  sqlite3 *db = nullptr;
+  if (sqlite3_open_v2(scratch.c_str(), &db, SQLITE_OPEN_READWRITE, nullptr) != SQLITE_OK) {
+    sqlite3_close(db);
+    return false;
+  }
+  const std::string update = std::string("UPDATE configuration SET storage_profile = '") + profile + "'";
+  const bool updated = sqlite3_exec(db, update.c_str(), nullptr, nullptr, nullptr) == SQLITE_OK;
+  sqlite3_close(db);
+  return updated;
+}
+
+static Result replay(Database& db, std::chrono::seconds duration) {
+  // Rows to aim at, made up when the database is empty
+  std::vector<int64_t> projects;
+  db.query_rows("SELECT id FROM projects", [&](const Database::Row& row) {
+    projects.push_back(row.integer(0));
+    return true;
+  });
+  if (projects.empty()) {
+    if (const auto id = db.insert("INSERT INTO projects(name, enabled) VALUES('benchmark', 1)")) {
+      projects.push_back(*id);
+    }
+  }
+  const auto last = db.query<std::optional<int64_t>>("SELECT MAX(id) FROM builds");
+  const int64_t builds = last && std::get<0>(*last) ? *std::get<0>(*last) : 1;
+
+  const auto deadline = std::chrono::steady_clock::now() + duration;
+  std::vector<std::vector<uint32_t>> latencies(Benchmark::k_threads);
+  std::vector<uint64_t> failures(Benchmark::k_threads, 0);
+
+  auto worker = [&](size_t index) {
+    std::mt19937_64 rng(index);
+    std::optional<BuildLog> log = BuildLog::create(db, projects.empty() ? 1 : projects[0], builds, 1);
+    std::string text;
+    auto& latency = latencies[index];
+
+    while (std::chrono::steady_clock::now() < deadline) {
+      const int64_t project = projects.empty() ? 1 : projects[rng() % projects.size()];
+      const int64_t build = 1 + static_cast<int64_t>(rng() % builds);
+      const unsigned pick = rng() % 100;
+      const auto started = std::chrono::steady_clock::now();
+
+      bool done = true;
+      unsigned range = k_page_builds;
+      std::optional<Database::Cursor> next;
+      auto skip = [](const Database::Row&) { return true; };
+      if (pick < range) {
+        done = db.query_page(
+          "SELECT start_timestamp, id, status FROM builds WHERE project_id = ?",
+          "start_timestamp", {}, 50, next, skip, project);
+      } else if (pick < (range += k_page_logs)) {
+        done = db.query_page("SELECT timestamp, id, contents FROM system_logs_all WHERE 1",
+                             "timestamp", {}, 100, next, skip);
+      } else if (pick < (range += k_find_build)) {
+        done = db.query<int64_t, int64_t>("SELECT status, start_timestamp FROM builds WHERE id = ?", build).has_value();
+      } else if (pick < (range += k_insert_build)) {
+        done = db.insert("INSERT INTO builds(project_id, status, start_timestamp) VALUES(?, 0, strftime('%s', 'now'))",
+                         project).has_value();
+      } else if (pick < (range += k_update_build)) {
+        done = db.query("UPDATE builds SET status = ? WHERE id = ?", static_cast<int64_t>(rng() % 4), build).has_value();
+      } else if (pick < (range += k_log_request)) {
+        done = db.log_http("GET /api/builds/page?project=" + std::to_string(project) + " 200");
+      } else {
+        // Compiler output, repetitive but not trivially so
+        text.clear();
+        while (text.size() < 4096) {
+          text += "[" + std::to_string(rng() % 1000) + "/1000] Building CXX object src/file" +
+                  std::to_string(rng() % 300) + ".cpp.o\n";
+        }
+        done = log && log->append(text);
+      }
+
+      const auto elapsed = std::chrono::steady_clock::now() - started;
+      latency.push_back(static_cast<uint32_t>(std::chrono::duration_cast<std::chrono::microseconds>(elapsed).count()));
+      failures[index] += !done;
+    }
+  };
+
+  std::vector<std::thread> threads;
+  for (size_t i = 0; i < Benchmark::k_threads; i++) {
+    threads.emplace_back(worker, i);
+  }
+  for (auto &thread : threads) {
+    thread.join();
+  }
+
+  Result result;
+  std::vector<uint32_t> all;
+  for (size_t i = 0; i < Benchmark::k_threads; i++) {
+    all.insert(all.end(), latencies[i].begin(), latencies[i].end());
+    result.failures += failures[i];
+  }
+  std::sort(all.begin(), all.end());
+  result.operations = all.size();
+  if (!all.empty()) {
+    result.p50 = all[all.size() / 2];
+    result.p99 = all[all.size() * 99 / 100];
+  }
+  return result;
+}
+
+int Benchmark::run(const std::string& path, std::chrono::seconds duration) {
+  const std::string scratch = path + ".benchmark";
+  const size_t count = sizeof Database::k_tunings / sizeof *Database::k_tunings;
+
+  std::cout << "Benchmarking " << path << ", " << k_threads << " threads for "
+            << duration.count() << "s per storage profile" << std::endl;
+
+  std::vector<Result> results(count);
+  for (size_t i = 0; i < count; i++) {
+    const Database::Tuning& tuning = Database::k_tunings[i];
+    if (!copy(path, scratch) || !select_profile(scratch, tuning.name)) {
+      std::cerr << "Failed to make a scratch copy of " << path << " at " << scratch << std::endl;
+      remove_scratch(scratch);
+      return 1;
+    }
+
+    {
+      Database db;
+      if (!db.open(scratch) || std::string_view(db.tuning().name) != tuning.name) {
+        std::cerr << "Failed to open " << scratch << " with storage profile " << tuning.name << std::endl;
+        remove_scratch(scratch);
+        return 1;
+      }
+      results[i] = replay(db, duration);
+    }
+    remove_scratch(scratch);
+
+    const Result& result = results[i];
+    std::printf("%-12s %8.0f ops/s  p50 %6llu us  p99 %6llu us  %llu failed\n",
+                tuning.name,
+                result.operations / static_cast<double>(duration.count()),
+                static_cast<unsigned long long>(result.p50),
+                static_cast<unsigned long long>(result.p99),
+                static_cast<unsigned long long>(result.failures));
+  }
+
+  // Profiles go from most to least durable, giving that up has to pay
+  size_t best = 0;
+  for (size_t i = 1; i < count; i++) {
+    if (results[i].operations > results[best].operations * k_margin) {
+      best = i;
+    }
+  }
+
+  const char *name = Database::k_tunings[best].name;
+  std::cout << "Recommended storage profile: " << name << "\n"
+            << "Apply with: UPDATE configuration SET storage_profile = '" << name
+            << "'; and restart" << std::endl;
+  return 0;
+}
@@ -0,0 +1,19 @@
+#ifndef BENCHMARK_H
+#define BENCHMARK_H
+
+#include <string> // std::string
+#include <chrono> // std::chrono
+
+// Replays the mix of reads and writes the server makes against a scratch
+// copy of a database, once for every storage profile, and recommends the
+// one that suits the host. The database itself is only read from, so it
+// can stay in use.
+struct Benchmark
+{
+  // Results go to stdout, returns the exit code for main()
+  static int run(const std::string& path, std::chrono::seconds duration);
+
+  static constexpr size_t k_threads = 8;
+};
+
+#endif
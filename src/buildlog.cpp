@@ -0,0 +1,397 @@
+#include <algorithm> // std::min, std::search
+#include <array> // std::array
+
+#include <cctype> // std::tolower
+
+#include "buildlog.h"
+#include "utility.h"
+
+// Gear hash, one random value per byte. Shifting left each byte means
+// the top bits depend on the last 64 bytes only, so a boundary is decided
+// by local content alone.
+static constexpr std::array<uint64_t, 256> make_gear() {
+  // splitmix64, fixed so chunks stay stable across releases
+  std::array<uint64_t, 256> gear = {};
+  uint64_t state = 0x9e3779b97f4a7c15ull;
+  for (auto &value : gear) {
+    state += 0x9e3779b97f4a7c15ull;
+    uint64_t mix = state;
+    mix = (mix ^ (mix >> 30)) * 0xbf58476d1ce4e5b9ull;
+    mix = (mix ^ (mix >> 27)) * 0x94d049bb133111ebull;
+    value = mix ^ (mix >> 31);
+  }
+  return gear;
+}
+
+static constexpr std::array<uint64_t, 256> k_gear = make_gear();
+
+static constexpr int bits(size_t value) {
+  return value > 1 ? 1 + bits(value >> 1) : 0;
+}
+
+static_assert((BuildLog::k_average_chunk & (BuildLog::k_average_chunk - 1)) == 0,
+              "Average chunk size must be a power of two");
+
+// A boundary where the top bits of the hash are all clear
+static constexpr uint64_t k_boundary =
+  static_cast<uint64_t>(BuildLog::k_average_chunk - 1) << (64 - bits(BuildLog::k_average_chunk));
+
+static bool continuation(char ch) {
+  return (static_cast<unsigned char>(ch) & 0xc0) == 0x80;
+}
+
+BuildLog::BuildLog(Database& db, int64_t id, Codec::Kind codec)
+  : m_db    { &db }
+  , m_id    { id }
+  , m_codec { codec }
+  , m_size  { 0 }
+  , m_gear  { 0 }
+{
+}
+
+BuildLog::BuildLog(BuildLog&& other)
+  : m_db         { other.m_db }
+  , m_id         { other.m_id }
+  , m_codec      { other.m_codec }
+  , m_size       { other.m_size }
+  , m_gear       { other.m_gear }
+  , m_pending    { std::move(other.m_pending) }
+  , m_compressed { std::move(other.m_compressed) }
+  , m_context    { std::move(other.m_context) }
+{
+  other.m_db = nullptr;
+}
+
+BuildLog::~BuildLog() {
+  if (m_db) {
+    flush();
+  }
+}
+
+std::optional<BuildLog> BuildLog::create(Database& db,
+                                         int64_t project_id,
+                                         int64_t build_id,
+                                         int64_t configuration_id,
+                                         Codec::Kind codec)
+{
+  const auto id = db.insert(
+    "INSERT INTO build_logs(project_id, build_id, configuration_id, contents) VALUES(?, ?, ?, '')",
+    project_id, build_id, configuration_id);
+  if (!id) {
+    return std::nullopt;
+  }
+  return BuildLog(db, *id, codec);
+}
+
+bool BuildLog::append(std::string_view contents) {
+  while (!contents.empty()) {
+    const size_t room = std::min(contents.size(), k_chunk_size - m_pending.size());
+    size_t take = room;
+    bool boundary = m_pending.size() + room == k_chunk_size;
+
+    // Only the 64 bytes before k_min_chunk matter for the first boundary
+    size_t i = 0;
+    if (m_pending.size() + 64 < k_min_chunk) {
+      i = std::min(room, k_min_chunk - 64 - m_pending.size());
+    }
+    for (; i < room; i++) {
+      m_gear = (m_gear << 1) + k_gear[static_cast<unsigned char>(contents[i])];
+      if (m_pending.size() + i + 1 >= k_min_chunk && !(m_gear & k_boundary)) {
+        take = i + 1;
+        boundary = true;
+        break;
+      }
+    }
+
+    m_pending.append(contents.data(), take);
+    contents.remove_prefix(take);
+    if (boundary) {
+      if (!write_chunk(m_pending)) {
+        return false;
+      }
+      m_pending.clear();
+      m_gear = 0;
+    }
+  }
+  return true;
+}
+
+bool BuildLog::flush() {
+  if (m_pending.empty()) {
+    return true;
+  }
+  if (!write_chunk(m_pending)) {
+    return false;
+  }
+  m_pending.clear();
+  m_gear = 0;
+  return true;
+}
+
+bool BuildLog::write_chunk(std::string_view contents) {
+  const auto digest = sha1(contents);
+  const std::string_view hash(reinterpret_cast<const char *>(digest.data()), digest.size());
+
+  // Only content never seen before is compressed and written out
+  auto chunk = m_db->query<int64_t>("SELECT id FROM chunk_store WHERE hash = ?", Database::Blob{ hash });
+  std::optional<int64_t> id;
+  if (chunk) {
+    id = std::get<0>(*chunk);
+  } else {
+    id = store_chunk(contents, hash);
+  }
+
+  const bool written = id && m_db->query(
+    "INSERT INTO build_log_refs(build_log_id, start, chunk_id) VALUES(?, ?, ?)",
+    m_id,
+    m_size,
+    *id).has_value();
+
+  if (!written) {
+    return false;
+  }
+
+  // Keep the tail for the next chunk's index entry, from the start of a
+  // character
+  size_t keep = contents.size() - std::min(contents.size(), k_search_overlap);
+  while (keep < contents.size() && continuation(contents[keep])) {
+    keep++;
+  }
+  m_context.assign(contents.data() + keep, contents.size() - keep);
+
+  m_size += contents.size();
+  return true;
+}
+
+std::optional<int64_t> BuildLog::store_chunk(std::string_view contents, std::string_view hash) {
+  m_compressed.clear();
+  Codec::Kind codec = m_codec;
+  if (!Codec::compress(codec, contents, m_compressed) || m_compressed.size() >= contents.size()) {
+    // Incompressible, store it as is
+    codec = Codec::NONE;
+    m_compressed.assign(contents.data(), contents.size());
+  }
+
+  std::string indexed;
+  indexed.reserve(m_context.size() + contents.size());
+  indexed.append(m_context);
+  indexed.append(contents.data(), contents.size());
+
+  // A chunk is only ever stored indexed, while search is on
+  std::optional<int64_t> id;
+  const bool stored = m_db->transaction([&](Database::Writer& writer) {
+    id = writer.insert(
+      "INSERT INTO chunk_store(hash, size, codec, context, data) VALUES(?, ?, ?, ?, ?)",
+      Database::Blob{ hash },
+      contents.size(),
+      static_cast<int64_t>(codec),
+      Database::Blob{ m_context },
+      Database::Blob{ m_compressed });
+    return id && (!m_db->search_enabled() ||
+                  writer.execute("INSERT INTO chunk_search(rowid, contents) VALUES(?, ?)", *id, indexed));
+  });
+  if (stored) {
+    return id;
+  }
+
+  // Another log stored the same chunk first
+  const auto existing = m_db->query<int64_t>("SELECT id FROM chunk_store WHERE hash = ?", Database::Blob{ hash });
+  if (!existing) {
+    return std::nullopt;
+  }
+  return std::get<0>(*existing);
+}
+
+std::optional<uint64_t> BuildLog::size(Database& db, int64_t id) {
+  const auto last = db.query<int64_t, int64_t>(
+    "SELECT r.start, c.size FROM build_log_refs AS r JOIN chunk_store AS c ON c.id = r.chunk_id "
+    "WHERE r.build_log_id = ? ORDER BY r.start DESC LIMIT 1",
+    id);
+  if (last) {
+    return std::get<0>(*last) + std::get<1>(*last);
+  }
+
+  const auto legacy = db.query<int64_t>("SELECT LENGTH(CAST(contents AS BLOB)) FROM build_logs WHERE id = ?", id);
+  if (!legacy) {
+    return std::nullopt;
+  }
+  return std::get<0>(*legacy);
+}
+
+bool BuildLog::read(Database& db,
+                    int64_t id,
+                    uint64_t offset,
+                    FunctionRef<bool(std::string_view)> each)
+{
+  // Chunks are at most k_chunk_size so only the one containing offset can
+  // start before it, the primary key covers the range
+  const int64_t first = offset >= k_chunk_size ? offset - k_chunk_size + 1 : 0;
+
+  bool chunked = false;
+  bool valid = true;
+  std::string contents;
+  auto chunk = [&](const Database::Row& row) {
+    chunked = true;
+    const auto start = static_cast<uint64_t>(row.integer(0));
+    const auto size = static_cast<uint64_t>(row.integer(1));
+    if (start + size <= offset) {
+      return true;
+    }
+
+    contents.clear();
+    const auto codec = static_cast<Codec::Kind>(row.integer(2));
+    if (!Codec::decompress(codec, row.text(3), size, contents)) {
+      valid = false;
+      return false;
+    }
+
+    std::string_view view = contents;
+    if (offset > start) {
+      view.remove_prefix(offset - start);
+    }
+    return each(view);
+  };
+
+  const bool queried = db.query_rows(
+    "SELECT r.start, c.size, c.codec, c.data FROM build_log_refs AS r JOIN chunk_store AS c ON c.id = r.chunk_id "
+    "WHERE r.build_log_id = ? AND r.start >= ? ORDER BY r.start",
+    chunk,
+    id,
+    first);
+
+  if (!queried || !valid) {
+    return false;
+  }
+
+  if (chunked) {
+    return true;
+  }
+
+  // Stored before chunking, or nothing written yet
+  const auto legacy = db.query<std::string>("SELECT contents FROM build_logs WHERE id = ?", id);
+  if (!legacy) {
+    return false;
+  }
+  const std::string& text = std::get<0>(*legacy);
+  if (offset < text.size()) {
+    each(std::string_view(text).substr(offset));
+  }
+  return true;
+}
+
+bool BuildLog::search(Database& db,
+                      std::string_view text,
+                      int64_t before,
+                      size_t limit,
+                      FunctionRef<bool(const Match&)> each)
+{
+  if (text.size() < 3 || text.size() >= k_search_overlap || !db.search_enabled()) {
+    return false;
+  }
+
+  // One quoted phrase so the text is matched literally
+  std::string phrase = "\"";
+  for (const char ch : text) {
+    phrase += ch;
+    if (ch == '"') {
+      phrase += ch;
+    }
+  }
+  phrase += '"';
+
+  struct Hit
+  {
+    int64_t id;
+    size_t size;
+    Codec::Kind codec;
+    std::string context;
+    std::string data;
+  };
+
+  // Collected first, finding the logs needs queries of its own
+  std::vector<Hit> hits;
+  const bool queried = db.query_rows(
+    "SELECT c.id, c.size, c.codec, c.context, c.data "
+    "FROM chunk_search AS f JOIN chunk_store AS c ON c.id = f.rowid "
+    "WHERE f.contents MATCH ? AND f.rowid < ? "
+    "ORDER BY f.rowid DESC LIMIT ?",
+    [&](const Database::Row& row) {
+      hits.push_back({
+        row.integer(0),
+        static_cast<size_t>(row.integer(1)),
+        static_cast<Codec::Kind>(row.integer(2)),
+        std::string(row.text(3)),
+        std::string(row.text(4))
+      });
+      return true;
+    },
+    phrase,
+    before,
+    limit);
+
+  if (!queried) {
+    return false;
+  }
+
+  auto equal = [](char lhs, char rhs) {
+    return std::tolower(static_cast<unsigned char>(lhs)) == std::tolower(static_cast<unsigned char>(rhs));
+  };
+
+  std::string indexed;
+  std::vector<Occurrence> occurrences;
+  for (const auto &hit : hits) {
+    // The same text the index saw, the context came from the first log
+    // to store the chunk
+    indexed = hit.context;
+    if (!Codec::decompress(hit.codec, hit.data, hit.size, indexed)) {
+      return false;
+    }
+
+    // The index folds case beyond ASCII too, those land on the chunk start
+    const auto found = std::search(indexed.begin(), indexed.end(), text.begin(), text.end(), equal);
+    const size_t position = found == indexed.end() ? hit.context.size() : found - indexed.begin();
+
+    size_t first = position - std::min(position, k_snippet_context);
+    size_t last = std::min(indexed.size(), position + text.size() + k_snippet_context);
+    while (first < position && continuation(indexed[first])) {
+      first++;
+    }
+    while (last > position && last < indexed.size() && continuation(indexed[last])) {
+      last--;
+    }
+
+    // Where the chunk is in every log that references it
+    occurrences.clear();
+    const bool listed = db.query_rows(
+      "SELECT r.build_log_id, r.start, l.build_id, l.project_id "
+      "FROM build_log_refs AS r JOIN build_logs AS l ON l.id = r.build_log_id "
+      "WHERE r.chunk_id = ? ORDER BY r.build_log_id DESC, r.start LIMIT ?",
+      [&](const Database::Row& row) {
+        const auto start = static_cast<uint64_t>(row.integer(1)) + position;
+        occurrences.push_back({
+          row.integer(0),
+          row.integer(2),
+          row.integer(3),
+          start > hit.context.size() ? start - hit.context.size() : 0
+        });
+        return true;
+      },
+      hit.id,
+      k_max_occurrences);
+
+    if (!listed) {
+      return false;
+    }
+
+    const Match match{
+      hit.id,
+      std::string_view(indexed).substr(first, last - first),
+      position - first,
+      occurrences
+    };
+    if (!each(match)) {
+      break;
+    }
+  }
+  return true;
+}
@@ -0,0 +1,113 @@
+#ifndef BUILDLOG_H
+#define BUILDLOG_H
+
+#include <string_view> // std::string_view
+#include <optional> // std::optional
+#include <string> // std::string
+#include <vector> // std::vector
+
+#include <cstdint> // int64_t, uint64_t
+
+#include "codec.h"
+#include "database.h"
+
+// Build output is cut into chunks where the content says so, a rolling
+// hash over the last 64 bytes picks the boundaries, so the same run of
+// output gives the same chunks in every build that prints it. Chunks are
+// compressed and stored once in chunk_store keyed by their hash, a log is
+// the list of chunks it references in build_log_refs keyed by the offset
+// of their first byte. Reading from any offset only decompresses the
+// chunks from there on, so a viewer can fetch the tail of a large log
+// cheaply.
+struct BuildLog
+{
+  // Starts an empty log, appends are buffered and written a chunk at a
+  // time so only one writer per log
+  static std::optional<BuildLog> create(Database& db,
+                                        int64_t project_id,
+                                        int64_t build_id,
+                                        int64_t configuration_id,
+                                        Codec::Kind codec = Codec::DEFLATE);
+
+  // Writes whatever is buffered, as a final partial chunk
+  ~BuildLog();
+
+  BuildLog(BuildLog&& other);
+
+  bool append(std::string_view contents);
+  bool flush();
+
+  int64_t id() const { return m_id; }
+
+  // Uncompressed size of everything written so far
+  static std::optional<uint64_t> size(Database& db, int64_t id);
+
+  // Streams the log from offset to each() as it's decompressed, on the
+  // calling thread. Logs from before chunked storage are read from
+  // build_logs.contents.
+  static bool read(Database& db,
+                   int64_t id,
+                   uint64_t offset,
+                   FunctionRef<bool(std::string_view)> each);
+
+  // Chunk sizes, boundaries only count from k_min_chunk on and about one
+  // in k_average_chunk bytes after that is one
+  static constexpr size_t k_min_chunk = 8 * 1024;
+  static constexpr size_t k_average_chunk = 16 * 1024;
+  static constexpr size_t k_chunk_size = 64 * 1024;
+
+  // Every chunk stored is also indexed for substring search by
+  // chunk_search, together with the last k_search_overlap bytes before it
+  // so text that straddles two chunks is found too. Without search (see
+  // Database::search_enabled()) chunks are stored unindexed.
+  static constexpr size_t k_search_overlap = 256;
+
+  struct Occurrence
+  {
+    int64_t build_log_id;
+    int64_t build_id;
+    int64_t project_id;
+    uint64_t offset; // Of the text in the log
+  };
+
+  struct Match
+  {
+    int64_t cursor; // Pass as before to get the next page
+    std::string_view snippet;
+    size_t snippet_match; // Where the text starts in snippet
+    const std::vector<Occurrence>& occurrences; // Newest first
+  };
+
+  // Chunks containing text, case insensitive and newest first, at most
+  // limit of them with up to k_max_occurrences logs each. Text has to be
+  // at least three characters and shorter than k_search_overlap. Logs
+  // from before chunked storage, still in build_logs.contents, aren't
+  // searched. False when search is off.
+  static bool search(Database& db,
+                     std::string_view text,
+                     int64_t before,
+                     size_t limit,
+                     FunctionRef<bool(const Match&)> each);
+
+  static constexpr size_t k_max_occurrences = 50;
+
+  // Bytes of context on either side of a match
+  static constexpr size_t k_snippet_context = 80;
+
+private:
+  BuildLog(Database& db, int64_t id, Codec::Kind codec);
+
+  bool write_chunk(std::string_view contents);
+  std::optional<int64_t> store_chunk(std::string_view contents, std::string_view hash);
+
+  Database *m_db;
+  int64_t m_id;
+  Codec::Kind m_codec;
+  uint64_t m_size; // Written to chunks
+  uint64_t m_gear; // Rolling hash of m_pending
+  std::string m_pending;
+  std::string m_compressed;
+  std::string m_context; // The end of the last chunk
+};
+
+#endif
@@ -0,0 +1,74 @@
+#include <algorithm> // std::lower_bound
+#include <fstream> // std::ifstream
+#include <sstream> // std::ostringstream
+#include <cstdlib> // std::getenv
+
+#include "bundle.h"
+
+// Asset loaded from disk, owns what the views point at
+struct DiskAsset
+{
+  Bundle::Asset asset;
+  std::string path;
+  std::string contents;
+  std::string header;
+};
+
+static std::shared_ptr<const Bundle::Asset> find_disk(const char *directory, std::string_view path) {
+  // Never leave the resource directory
+  if (path.find("..") != std::string_view::npos) {
+    return nullptr;
+  }
+
+  std::ifstream file(std::string(directory) + std::string(path), std::ios::binary);
+  if (!file) {
+    return nullptr;
+  }
+
+  auto disk = std::make_shared<DiskAsset>();
+  std::ostringstream contents;
+  contents << file.rdbuf();
+  disk->path = path;
+  disk->contents = contents.str();
+
+  // Take the content type from the embedded asset if there is one
+  std::string_view content_type = "application/octet-stream";
+  const auto begin = Bundle::k_assets;
+  const auto end = Bundle::k_assets + Bundle::k_count;
+  const auto find = std::lower_bound(begin, end, path, [](const Bundle::Asset& asset, std::string_view path) {
+    return asset.path < path;
+  });
+  if (find != end && find->path == path) {
+    content_type = find->content_type;
+  }
+
+  disk->header = "Content-Type: " + std::string(content_type) + "\r\n"
+                 "Content-Length: " + std::to_string(disk->contents.size()) + "\r\n"
+                 "Cache-Control: no-store\r\n";
+
+  disk->asset.path = disk->path;
+  disk->asset.content_type = content_type;
+  disk->asset.contents = disk->contents;
+  disk->asset.header = disk->header;
+
+  return { disk, &disk->asset };
+}
+
+std::shared_ptr<const Bundle::Asset> Bundle::find(std::string_view path) {
+  static const char *directory = std::getenv("KAIZEN_RESOURCES");
+  if (directory) {
+    return find_disk(directory, path);
+  }
+
+  const auto begin = k_assets;
+  const auto end = k_assets + k_count;
+  const auto find = std::lower_bound(begin, end, path, [](const Asset& asset, std::string_view path) {
+    return asset.path < path;
+  });
+  if (find == end || find->path != path) {
+    return nullptr;
+  }
+
+  // Aliasing an empty owner, embedded assets live forever
+  return { std::shared_ptr<const Asset>(), find };
+}
@@ -0,0 +1,34 @@
+#ifndef BUNDLE_H
+#define BUNDLE_H
+
+#include <string_view> // std::string_view
+#include <memory> // std::shared_ptr
+
+// Static assets from resource/ compiled into the binary by tools/bundle.
+// Everything, including the header lines, is computed at build time.
+struct Bundle
+{
+  struct Asset
+  {
+    std::string_view path; // "/login.html"
+    std::string_view content_type;
+    std::string_view etag;
+    std::string_view contents;
+    std::string_view gzip; // Empty when compressing did not pay off
+
+    // Serialized "Content-Type", "Content-Length", "ETag" etc. lines for the
+    // identity and gzip encodings respectively
+    std::string_view header;
+    std::string_view gzip_header;
+  };
+
+  // Thread safe. When KAIZEN_RESOURCES names a directory assets are read
+  // from there instead, for iterating on them without rebuilding.
+  static std::shared_ptr<const Asset> find(std::string_view path);
+
+  // Generated, sorted by path
+  static const Asset k_assets[];
+  static const size_t k_count;
+};
+
+#endif
@@ -0,0 +1,173 @@
+#include <algorithm> // std::remove_if
+#include <chrono> // std::chrono::milliseconds
+
+#include "channel.h"
+#include "websocket.h"
+
+// Subscribers falling this many frames behind are disconnected
+static constexpr size_t k_max_pending = 256;
+
+// How long the service thread waits before picking up new subscribers
+// and frames queued while it was blocked
+static constexpr int k_poll_timeout = 50;
+
+Channel::Subscriber::Subscriber(Client&& client)
+  : client  { std::move(client) }
+  , offset  { 0 }
+  , closed  { false }
+{
+}
+
+bool Channel::Subscriber::flush() {
+  while (!pending.empty()) {
+    const auto &message = *pending.front();
+    const auto *data = reinterpret_cast<const uint8_t *>(message.data()) + offset;
+    const int n = client.socket().try_send(data, message.size() - offset);
+    if (n < 0) {
+      return false;
+    }
+    if (n == 0) {
+      // Socket buffer is full, try again when writable
+      return true;
+    }
+    offset += n;
+    if (offset == message.size()) {
+      pending.pop_front();
+      offset = 0;
+    }
+  }
+  return true;
+}
+
+bool Channel::Subscriber::queue(const Message& message) {
+  if (pending.size() >= k_max_pending) {
+    return false;
+  }
+  pending.push_back(message);
+  return pending.size() != 1 || flush();
+}
+
+Channel::Channel(std::string_view name)
+  : m_name    { name }
+  , m_running { true }
+  , m_thread  { &Channel::channel_thread, this }
+{
+}
+
+Channel::~Channel() {
+  m_running.store(false);
+  if (m_thread.joinable()) {
+    m_thread.join();
+  }
+}
+
+void Channel::subscribe(Client&& client) {
+  std::lock_guard<std::mutex> lock(m_mutex);
+  m_subscribers.push_back(std::make_shared<Subscriber>(std::move(client)));
+}
+
+size_t Channel::broadcast(std::string_view message) {
+  // Serialize once, shared by every subscriber
+  const auto frame = std::make_shared<const std::string>(
+    WebSocket::serialize(WebSocket::TEXT, message));
+
+  std::lock_guard<std::mutex> lock(m_mutex);
+  size_t count = 0;
+  for (auto &subscriber : m_subscribers) {
+    if (subscriber->closed) {
+      continue;
+    }
+    if (subscriber->queue(frame)) {
+      count++;
+    } else {
+      subscriber->closed = true;
+    }
+  }
+  return count;
+}
+
+bool Channel::receive(Subscriber& subscriber) {
+  uint8_t buffer[512];
+  const int n = subscriber.client.socket().recieve(buffer, sizeof buffer);
+  if (n <= 0) {
+    return false;
+  }
+  subscriber.buffer.append(reinterpret_cast<const char *>(buffer), n);
+
+  auto *data = reinterpret_cast<uint8_t *>(subscriber.buffer.data());
+  size_t size = subscriber.buffer.size();
+  size_t offset = 0;
+  while (offset < size) {
+    WebSocket::Frame frame;
+    const auto consumed = WebSocket::parse(data + offset, size - offset, frame);
+    if (!consumed) {
+      return false;
+    }
+    if (*consumed == 0) {
+      break;
+    }
+    offset += *consumed;
+
+    // The dashboard never talks back, data frames from clients are dropped
+    if (frame.opcode == WebSocket::PING) {
+      auto pong = std::make_shared<const std::string>(
+        WebSocket::serialize(WebSocket::PONG, frame.payload));
+      if (!subscriber.queue(pong)) {
+        return false;
+      }
+    } else if (frame.opcode == WebSocket::CLOSE) {
+      // Echo the close, best effort since we're going away anyways
+      const auto close = WebSocket::serialize(WebSocket::CLOSE, frame.payload.substr(0, 2));
+      subscriber.client.socket().try_send(
+        reinterpret_cast<const uint8_t *>(close.data()), close.size());
+      return false;
+    }
+  }
+
+  subscriber.buffer.erase(0, offset);
+  return true;
+}
+
+void Channel::channel_thread() {
+  std::vector<std::shared_ptr<Subscriber>> subscribers;
+  std::vector<Socket::Poll> polls;
+
+  while (m_running.load()) {
+    {
+      std::lock_guard<std::mutex> lock(m_mutex);
+      m_subscribers.erase(
+        std::remove_if(m_subscribers.begin(), m_subscribers.end(),
+          [](const std::shared_ptr<Subscriber>& subscriber) { return subscriber->closed; }),
+        m_subscribers.end());
+      subscribers = m_subscribers;
+      polls.resize(subscribers.size());
+      for (size_t i = 0; i < subscribers.size(); i++) {
+        polls[i].socket = &subscribers[i]->client.socket();
+        polls[i].want_read = true;
+        polls[i].want_write = !subscribers[i]->pending.empty();
+      }
+    }
+
+    if (subscribers.empty()) {
+      std::this_thread::sleep_for(std::chrono::milliseconds(k_poll_timeout));
+      continue;
+    }
+
+    if (Socket::poll(polls.data(), polls.size(), k_poll_timeout) <= 0) {
+      continue;
+    }
+
+    std::lock_guard<std::mutex> lock(m_mutex);
+    for (size_t i = 0; i < subscribers.size(); i++) {
+      auto &subscriber = *subscribers[i];
+      if (subscriber.closed) {
+        continue;
+      }
+      if (polls[i].readable && !receive(subscriber)) {
+        subscriber.closed = true;
+      } else if (polls[i].writable && !subscriber.flush()) {
+        subscriber.closed = true;
+      }
+    }
+  }
+}
@@ -0,0 +1,59 @@
+#ifndef CHANNEL_H
+#define CHANNEL_H
+
+#include <string_view> // std::string_view
+#include <thread> // std::thread
+#include <atomic> // std::atomic_bool
+#include <mutex> // std::mutex, std::lock_guard
+#include <memory> // std::shared_ptr
+#include <vector> // std::vector
+#include <deque> // std::deque
+#include <string> // std::string
+
+#include "client.h"
+
+// Broadcast channel of WebSocket subscribers. Every message is serialized
+// into a frame exactly once and the same buffer is queued on every
+// subscriber, slow subscribers never hold up the broadcaster.
+struct Channel
+{
+  Channel(std::string_view name);
+  ~Channel();
+
+  // Takes ownership of an upgraded connection
+  void subscribe(Client&& client);
+
+  // Thread safe, returns the number of subscribers the message was queued on
+  size_t broadcast(std::string_view message);
+
+  const std::string& name() const { return m_name; }
+
+private:
+  typedef std::shared_ptr<const std::string> Message;
+
+  struct Subscriber
+  {
+    Subscriber(Client&& client);
+
+    Client client;
+    std::string buffer; // Incoming bytes not yet parsed as frames
+    std::deque<Message> pending; // Outgoing frames not yet written
+    size_t offset; // Bytes of pending.front() already written
+    bool closed;
+
+    bool flush();
+    bool queue(const Message& message);
+  };
+
+  // Services control frames and flushes pending frames to subscribers
+  void channel_thread();
+  bool receive(Subscriber& subscriber);
+
+  std::string m_name;
+  std::mutex m_mutex;
+  std::vector<std::shared_ptr<Subscriber>> m_subscribers;
+  std::atomic_bool m_running;
+  std::thread m_thread;
+};
+
+#endif
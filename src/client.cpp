@@ -1,21 +1,56 @@
 #include <unistd.h> // close, write
+#include <algorithm> // std::min
+#include <charconv> // std::to_chars
+#include <cstdio> // snprintf
 
 #include "client.h"
+#include "http2.h"
+#include "bundle.h"
+
+// Room for up to eight hex digits of chunk size and CRLF
+static constexpr size_t k_chunk_header = 10;
+
+// Bodies up to this size are sent together with the header
+static constexpr size_t k_coalesce = 4096;
+
+static constexpr std::string_view k_html_type = "text/html; charset=utf-8";
+static constexpr std::string_view k_json_type = "application/json";
 
 Client::Client()
-  : m_socket { }
-  , m_fields { }
+  : m_socket       { }
+  , m_fields       { }
+  , m_streaming    { false }
+  , m_http2        { nullptr }
+  , m_http2_stream { 0 }
 {
 }
 
 Client::Client(Socket&& socket)
-  : m_socket { std::move(socket) }
-  , m_fields { }
+  : m_socket       { std::move(socket) }
+  , m_fields       { }
+  , m_streaming    { false }
+  , m_http2        { nullptr }
+  , m_http2_stream { 0 }
+{
+}
+
+Client::Client(Http2Connection& connection, uint32_t stream)
+  : m_socket       { }
+  , m_fields       { }
+  , m_streaming    { false }
+  , m_http2        { &connection }
+  , m_http2_stream { stream }
 {
 }
 
 Client::Client(Client&& other)
-  : Client(std::move(other.m_socket))
+  : m_socket       { std::move(other.m_socket) }
+  , m_fields       { std::move(other.m_fields) }
+  , m_header       { std::move(other.m_header) }
+  , m_stream       { std::move(other.m_stream) }
+  , m_streaming    { other.m_streaming }
+  , m_http2        { other.m_http2 }
+  , m_http2_stream { other.m_http2_stream }
 {
 }
 
@@ -26,53 +61,290 @@ Client::~Client() {
 void Client::operator=(Client &&other) {
   m_socket = std::move(other.m_socket);
   m_fields = std::move(other.m_fields);
+  m_header = std::move(other.m_header);
+  m_stream = std::move(other.m_stream);
+  m_streaming = other.m_streaming;
+  m_http2 = other.m_http2;
+  m_http2_stream = other.m_http2_stream;
+}
+
+bool Client::holds_connection() const {
+  return m_http2 && m_http2->serving();
 }
 
 std::optional<std::string> Client::read() {
   std::string contents;
   char buffer[512];
   for (;;) {
-    int n = m_socket.recieve(reinterpret_cast<uint8_t *>(buffer), sizeof buffer - 1);
+    int n = m_socket.recieve(reinterpret_cast<uint8_t *>(buffer), sizeof buffer);
     if (n < 0) {
       return std::nullopt;
     }
-    buffer[n] = '\0';
-    contents += buffer;
-    if (n < static_cast<int>(sizeof buffer - 1)) {
+    // May be binary, e.g the HTTP/2 preface and frames following it
+    contents.append(buffer, n);
+    if (n < static_cast<int>(sizeof buffer)) {
       break;
     }
   }
   return contents;
 }
 
+bool Client::send(const char *data, size_t size) {
+  // Sockets may accept less than asked for
+  while (size) {
+    const int n = m_socket.send(reinterpret_cast<const uint8_t*>(data), size);
+    if (n <= 0) {
+      return false;
+    }
+    data += n;
+    size -= n;
+  }
+  return true;
+}
+
 void Client::write_line(std::string_view contents) {
-  m_socket.send(reinterpret_cast<const uint8_t*>(contents.data()), contents.size());
-  m_socket.send(reinterpret_cast<const uint8_t*>("\r\n"), 2);
+  send(contents.data(), contents.size());
+  send("\r\n", 2);
 }
 
-void Client::write_html(std::string_view contents) {
-  // 200 OK
-  write_line("HTTP/1.1 200 OK");
+void Client::write_header(int status,
+                          std::string_view content_type,
+                          std::optional<size_t> content_length)
+{
+  const auto snapshot = Response::snapshot();
 
-  write_line("Server: ElastCI");
+  m_header.clear();
+  m_header += Response::status_line(status);
+  m_header += Response::k_server;
+  m_header += snapshot->date_line;
 
   // Content information
-  write_line("Content-Type: text/html; charset=utf-8");
-  write_line("Content-Length: " + std::to_string(contents.size()));
+  if (content_type == k_html_type) {
+    m_header += Response::k_html;
+  } else if (!content_type.empty()) {
+    m_header += "Content-Type: ";
+    m_header += content_type;
+    m_header += "\r\n";
+  }
+
+  if (status == 304) {
+    // No body and no length, it would describe the unsent representation
+  } else if (content_length) {
+    char length[32];
+    const auto result = std::to_chars(length, length + sizeof length, *content_length);
+    m_header += "Content-Length: ";
+    m_header.append(length, result.ptr);
+    m_header += "\r\n";
+  } else {
+    m_header += Response::k_chunked;
+  }
 
   // Write fields
   for (const auto &field : m_fields) {
-    write_line(field);
+    m_header += field;
+    m_header += "\r\n";
   }
 
   // Empty \r\n followed by body
-  write_line("");
-  write_line(contents);
+  m_header += "\r\n";
 
   m_fields.clear();
 }
 
-bool Client::write_file(const std::string& name) {
-  write_html("Requested: " + name);
+void Client::write_html(std::string_view contents) {
+  write_contents(k_html_type, contents);
+}
+
+void Client::write_json(std::string_view contents) {
+  write_contents(k_json_type, contents);
+}
+
+void Client::write_contents(std::string_view content_type, std::string_view contents) {
+  if (m_http2) {
+    m_http2->send_headers(m_http2_stream, 200, m_fields, content_type, contents.size(), contents.empty());
+    if (!contents.empty()) {
+      m_http2->send_data(m_http2_stream, contents, true);
+    }
+    m_fields.clear();
+    return;
+  }
+
+  write_header(200, content_type, contents.size());
+
+  // Small bodies go out in the same send as the header
+  if (contents.size() <= k_coalesce) {
+    m_header += contents;
+    send(m_header.data(), m_header.size());
+  } else {
+    send(m_header.data(), m_header.size()) && send(contents.data(), contents.size());
+  }
+}
+
+bool Client::write_file(const std::string& name,
+                        const std::unordered_map<std::string, std::string>& header_fields)
+{
+  const auto asset = Bundle::find(name);
+  if (!asset) {
+    write_fixed(Response::NOT_FOUND);
+    return false;
+  }
+
+  // Revalidation of an unchanged asset
+  const auto match = header_fields.find("if-none-match");
+  if (match != header_fields.end() && !asset->etag.empty() && match->second == asset->etag) {
+    write_field("ETag: " + std::string(asset->etag));
+    write_empty(304);
+    return true;
+  }
+
+  const auto encoding = header_fields.find("accept-encoding");
+  const bool gzip = !asset->gzip.empty() && encoding != header_fields.end() &&
+                    encoding->second.find("gzip") != std::string::npos;
+  const auto contents = gzip ? asset->gzip : asset->contents;
+
+  if (m_http2) {
+    if (gzip) {
+      write_field("Content-Encoding: gzip");
+    }
+    if (!asset->etag.empty()) {
+      write_field("ETag: " + std::string(asset->etag));
+      write_field("Cache-Control: no-cache");
+    }
+    if (!asset->gzip.empty()) {
+      write_field("Vary: Accept-Encoding");
+    }
+    m_http2->send_headers(m_http2_stream, 200, m_fields, asset->content_type, contents.size(), contents.empty());
+    m_fields.clear();
+    return contents.empty() || m_http2->send_data(m_http2_stream, contents, true);
+  }
+
+  const auto snapshot = Response::snapshot();
+  m_header.clear();
+  m_header += Response::status_line(200);
+  m_header += Response::k_server;
+  m_header += snapshot->date_line;
+  m_header += gzip ? asset->gzip_header : asset->header;
+  for (const auto &field : m_fields) {
+    m_header += field;
+    m_header += "\r\n";
+  }
+  m_header += "\r\n";
+  m_fields.clear();
+
+  if (contents.size() <= k_coalesce) {
+    m_header += contents;
+    return send(m_header.data(), m_header.size());
+  }
+  return send(m_header.data(), m_header.size()) && send(contents.data(), contents.size());
+}
+
+void Client::write_empty(int status) {
+  if (m_http2) {
+    const auto length = status == 304 ? std::nullopt : std::optional<size_t>(0);
+    m_http2->send_headers(m_http2_stream, status, m_fields, {}, length, true);
+    m_fields.clear();
+    return;
+  }
+
+  write_header(status, {}, 0);
+  send(m_header.data(), m_header.size());
+}
+
+void Client::write_fixed(Response::Fixed which) {
+  if (m_http2 || !m_fields.empty()) {
+    for (const auto &field : Response::fixed_fields(which)) {
+      write_field(field);
+    }
+    write_empty(Response::fixed_status(which));
+    return;
+  }
+
+  const auto snapshot = Response::snapshot();
+  const auto &contents = snapshot->fixed[which];
+  send(contents.data(), contents.size());
+}
+
+bool Client::begin_stream(std::string_view content_type) {
+  if (m_http2) {
+    // Framing takes the place of chunking, flow control of the buffer
+    m_streaming = m_http2->send_headers(m_http2_stream, 200, m_fields, content_type, std::nullopt, false);
+    m_fields.clear();
+    return m_streaming;
+  }
+
+  // Stalled readers fail the stream instead of pinning the thread
+  m_socket.set_send_timeout(k_stream_timeout);
+
+  write_header(200, content_type, std::nullopt);
+  if (!send(m_header.data(), m_header.size())) {
+    return false;
+  }
+
+  m_stream.reserve(k_chunk_header + k_stream_buffer + 2);
+  m_stream.assign(k_chunk_header, ' ');
+  m_streaming = true;
+
   return true;
 }
+
+bool Client::flush_stream() {
+  const size_t size = m_stream.size() - k_chunk_header;
+  if (size == 0) {
+    return true;
+  }
+
+  // Write the size line right aligned into the reserved space so the
+  // whole chunk goes out in a single send
+  char header[k_chunk_header + 1];
+  const int length = snprintf(header, sizeof header, "%zx\r\n", size);
+  const size_t offset = k_chunk_header - length;
+  m_stream.replace(offset, length, header, length);
+  m_stream += "\r\n";
+
+  const bool result = send(m_stream.data() + offset, m_stream.size() - offset);
+  m_stream.resize(k_chunk_header);
+  return result;
+}
+
+bool Client::write_stream(std::string_view contents) {
+  if (!m_streaming) {
+    return false;
+  }
+
+  if (m_http2) {
+    m_streaming = m_http2->send_data(m_http2_stream, contents, false);
+    return m_streaming;
+  }
+
+  while (!contents.empty()) {
+    const size_t space = k_chunk_header + k_stream_buffer - m_stream.size();
+    const size_t count = std::min(space, contents.size());
+    m_stream.append(contents.data(), count);
+    contents.remove_prefix(count);
+    if (m_stream.size() == k_chunk_header + k_stream_buffer && !flush_stream()) {
+      m_streaming = false;
+      return false;
+    }
+  }
+
+  return true;
+}
+
+bool Client::end_stream() {
+  if (!m_streaming) {
+    return false;
+  }
+
+  m_streaming = false;
+
+  if (m_http2) {
+    return m_http2->send_data(m_http2_stream, {}, true);
+  }
+
+  const bool result = flush_stream() && send("0\r\n\r\n", 5);
+
+  m_stream.clear();
+  m_stream.shrink_to_fit();
+
+  return result;
+}
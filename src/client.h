@@ -1,24 +1,48 @@
 #ifndef CLIENT_H
 #define CLIENT_H
 
+#include <unordered_map>
 #include <string_view>
 #include <optional>
 #include <string>
 #include <vector>
 
 #include "socket.h"
+#include "response.h"
+
+struct Http2Connection;
 
 struct Client
 {
   Client();
   Client(Socket&& socket);
+  Client(Http2Connection& connection, uint32_t stream);
   Client(Client&& other);
   void operator=(Client&& other);
   ~Client();
 
   void write_line(std::string_view contents);
   void write_html(std::string_view contents);
-  bool write_file(const std::string& name);
+  void write_json(std::string_view contents);
+  // Serves an asset from the bundle, honouring If-None-Match and
+  // Accept-Encoding from the request
+  bool write_file(const std::string& name,
+                  const std::unordered_map<std::string, std::string>& header_fields);
+
+  // Response with no body
+  void write_empty(int status);
+
+  // One of the precomputed responses, a single send for HTTP/1.1
+  void write_fixed(Response::Fixed which);
+
+  // Streaming responses with chunked transfer-encoding. Writes are buffered
+  // up to k_stream_buffer bytes, a full buffer is flushed as one chunk and
+  // blocks the writer until the reader catches up. Returns false once the
+  // reader stalls past k_stream_timeout or goes away, the handler should
+  // stop producing.
+  bool begin_stream(std::string_view content_type = "text/html; charset=utf-8");
+  bool write_stream(std::string_view contents);
+  bool end_stream();
 
   // Header fields and cookie writing
   void write_field(std::string_view contents);
@@ -26,11 +50,43 @@ struct Client
 
   std::optional<std::string> read();
 
+  // A stream of an HTTP/2 connection, without a socket of its own
+  bool http2() const { return m_http2 != nullptr; }
+
+  // An HTTP/2 stream handled on the thread serving its connection, which
+  // the connection's other streams wait for. Not a place to block.
+  bool holds_connection() const;
+
   const Socket& socket() const { return m_socket; };
+  Socket& socket() { return m_socket; };
+
+  static constexpr size_t k_stream_buffer = 16 * 1024;
+  static constexpr int k_stream_timeout = 10000;
 
 private:
+  friend struct Http2Connection;
+
+  void write_contents(std::string_view content_type, std::string_view contents);
+
+  bool send(const char *data, size_t size);
+  bool flush_stream();
+
+  // Serializes the header block from cached pieces into m_header
+  void write_header(int status,
+                    std::string_view content_type,
+                    std::optional<size_t> content_length);
+
   Socket m_socket;
   std::vector<std::string> m_fields;
+  std::string m_header;
+
+  // Chunk being built, the front is reserved for the chunk size line
+  std::string m_stream;
+  bool m_streaming;
+
+  // Responses on HTTP/2 connections are framed by the connection instead
+  Http2Connection *m_http2;
+  uint32_t m_http2_stream;
 };
 
 inline void Client::write_field(std::string_view contents) {
@@ -0,0 +1,65 @@
+#include <zlib.h> // compress2, uncompress
+
+#include "codec.h"
+
+static bool store_block(std::string_view input, std::string& output) {
+  output.append(input.data(), input.size());
+  return true;
+}
+
+static bool load_block(std::string_view input, size_t size, std::string& output) {
+  if (input.size() != size) {
+    return false;
+  }
+  output.append(input.data(), input.size());
+  return true;
+}
+
+static bool deflate_block(std::string_view input, std::string& output) {
+  const size_t offset = output.size();
+  uLongf length = compressBound(input.size());
+  output.resize(offset + length);
+  const int result = compress2(reinterpret_cast<Bytef *>(&output[offset]),
+                               &length,
+                               reinterpret_cast<const Bytef *>(input.data()),
+                               input.size(),
+                               Z_DEFAULT_COMPRESSION);
+  output.resize(result == Z_OK ? offset + length : offset);
+  return result == Z_OK;
+}
+
+static bool inflate_block(std::string_view input, size_t size, std::string& output) {
+  const size_t offset = output.size();
+  uLongf length = size;
+  output.resize(offset + size);
+  const int result = uncompress(reinterpret_cast<Bytef *>(&output[offset]),
+                                &length,
+                                reinterpret_cast<const Bytef *>(input.data()),
+                                input.size());
+  if (result != Z_OK || length != size) {
+    output.resize(offset);
+    return false;
+  }
+  return true;
+}
+
+static const struct {
+  const char *name;
+  bool (*compress)(std::string_view input, std::string& output);
+  bool (*decompress)(std::string_view input, size_t size, std::string& output);
+} k_codecs[Codec::COUNT] = {
+  { "none",    store_block,   load_block },
+  { "deflate", deflate_block, inflate_block },
+};
+
+bool Codec::compress(Kind kind, std::string_view input, std::string& output) {
+  return kind < COUNT && k_codecs[kind].compress(input, output);
+}
+
+bool Codec::decompress(Kind kind, std::string_view input, size_t size, std::string& output) {
+  return kind < COUNT && k_codecs[kind].decompress(input, size, output);
+}
+
+const char *Codec::name(Kind kind) {
+  return kind < COUNT ? k_codecs[kind].name : "unknown";
+}
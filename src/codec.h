@@ -0,0 +1,32 @@
+#ifndef CODEC_H
+#define CODEC_H
+
+#include <string_view> // std::string_view
+#include <string> // std::string
+
+#include <cstdint> // uint8_t
+
+// Block compression for data stored in the database. Every block records
+// the codec it was written with so the default can change without
+// rewriting old data. Adding a codec means a new Kind and an entry in the
+// table in codec.cpp.
+struct Codec
+{
+  // Stored in the database, never renumber
+  enum Kind : uint8_t {
+    NONE = 0,
+    DEFLATE = 1,
+    COUNT
+  };
+
+  // Appends the compressed input to output
+  static bool compress(Kind kind, std::string_view input, std::string& output);
+
+  // Appends exactly size bytes of decompressed input to output, false when
+  // the input is corrupt or decompresses to anything else
+  static bool decompress(Kind kind, std::string_view input, size_t size, std::string& output);
+
+  static const char *name(Kind kind);
+};
+
+#endif
@@ -0,0 +1,84 @@
+#include <algorithm> // std::min
+#include <string_view> // std::string_view
+#include <string> // std::string, std::to_string
+
+#include <cstdint> // int64_t, INT32_MAX
+
+#include "config.h"
+#include "database.h"
+#include "published.h"
+
+struct Setting
+{
+  const char *name;
+  int64_t minimum;
+  void (*set)(Config& config, int64_t value);
+};
+
+static constexpr Setting k_settings[] = {
+  { "log_retention_hours",   0, [](Config& config, int64_t value) { config.log_retention = std::chrono::hours(value); } },
+  { "batch_size",            1, [](Config& config, int64_t value) { config.batch_size = value; } },
+  { "batch_delay_us",        0, [](Config& config, int64_t value) { config.batch_delay = std::chrono::microseconds(value); } },
+  { "busy_initial_us",       1, [](Config& config, int64_t value) { config.busy_initial = std::chrono::microseconds(value); } },
+  { "busy_max_delay_us",     1, [](Config& config, int64_t value) { config.busy_max_delay = std::chrono::microseconds(value); } },
+  { "busy_deadline_ms",      0, [](Config& config, int64_t value) { config.busy_deadline = std::chrono::milliseconds(value); } },
+  { "backup_pages",          1, [](Config& config, int64_t value) { config.backup_pages = static_cast<int>(std::min<int64_t>(value, INT32_MAX)); } },
+  { "backup_interval_ms",    0, [](Config& config, int64_t value) { config.backup_interval = std::chrono::milliseconds(value); } },
+  { "max_queued_clients",    1, [](Config& config, int64_t value) { config.max_queued_clients = value; } },
+  { "search_page",           1, [](Config& config, int64_t value) { config.search_page = value; } },
+  { "max_search_page",       1, [](Config& config, int64_t value) { config.max_search_page = value; } },
+  { "list_page",             1, [](Config& config, int64_t value) { config.list_page = value; } },
+  { "max_list_page",         1, [](Config& config, int64_t value) { config.max_list_page = value; } },
+  { "slow_query_ms",         0, [](Config& config, int64_t value) { config.slow_query = std::chrono::milliseconds(value); } },
+  { "change_retention_hours", 0, [](Config& config, int64_t value) { config.change_retention = std::chrono::hours(value); } },
+};
+
+static Published<Config> s_current { std::make_shared<const Config>() };
+
+std::optional<Config> Config::load(Database& db) {
+  const auto configuration = db.query<int64_t, int64_t>("SELECT http_port, http_threads FROM configuration");
+  if (!configuration) {
+    return std::nullopt;
+  }
+
+  Config config;
+  const auto [port, threads] = *configuration;
+  config.http_port = static_cast<uint16_t>(port);
+  config.http_threads = threads > 0 ? threads : 1;
+
+  const bool queried = db.query_rows(
+    "SELECT name, value FROM settings",
+    [&](const Database::Row& row) {
+      const std::string_view name = row.text(0);
+      for (const auto &setting : k_settings) {
+        if (name != setting.name) {
+          continue;
+        }
+        if (row.integer(1) < setting.minimum) {
+          db.log_system("Setting " + std::string(name) + " is below " + std::to_string(setting.minimum) + ", using the default");
+        } else {
+          setting.set(config, row.integer(1));
+        }
+        return true;
+      }
+      db.log_system("Unknown setting " + std::string(name));
+      return true;
+    });
+
+  if (!queried) {
+    return std::nullopt;
+  }
+
+  // A default page larger than allowed would always be cut down
+  config.search_page = std::min(config.search_page, config.max_search_page);
+  config.list_page = std::min(config.list_page, config.max_list_page);
+  return config;
+}
+
+std::shared_ptr<const Config> Config::current() {
+  return s_current.get();
+}
+
+void Config::publish(const Config& config) {
+  s_current.publish(std::make_shared<const Config>(config));
+}
@@ -0,0 +1,49 @@
+#ifndef CONFIG_H
+#define CONFIG_H
+
+#include <optional> // std::optional
+#include <memory> // std::shared_ptr
+#include <chrono> // std::chrono
+
+#include <cstddef> // size_t
+#include <cstdint> // uint16_t
+
+struct Database;
+
+// Settings read from the database as one immutable snapshot. Readers take
+// the current snapshot without locking (see Published) and hold on to it
+// for as long as they need values that agree with each other. A reload
+// publishes a new snapshot, the old one goes away with its last reader.
+struct Config
+{
+  // From the configuration table, the port only changes on restart
+  uint16_t http_port = 80;
+  size_t http_threads = 4;
+
+  // From the settings table as name and integer value, defaults when
+  // missing
+  std::chrono::hours log_retention{ 24 * 30 };
+  size_t batch_size = 256;
+  std::chrono::microseconds batch_delay{ 2000 };
+  std::chrono::microseconds busy_initial{ 100 };
+  std::chrono::microseconds busy_max_delay{ 50000 };
+  std::chrono::milliseconds busy_deadline{ 5000 };
+  int backup_pages = 128;
+  std::chrono::milliseconds backup_interval{ 10 };
+  size_t max_queued_clients = 1024;
+  size_t search_page = 20;
+  size_t max_search_page = 100;
+  size_t list_page = 50;
+  size_t max_list_page = 500;
+  std::chrono::milliseconds slow_query{ 100 };
+  std::chrono::hours change_retention{ 24 * 7 };
+
+  // Unknown or out of range settings are logged and left at the default
+  static std::optional<Config> load(Database& db);
+
+  // Thread safe, defaults until the first publish()
+  static std::shared_ptr<const Config> current();
+  static void publish(const Config& config);
+};
+
+#endif
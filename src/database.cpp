@@ -1,10 +1,25 @@
+#include <algorithm>
+#include <cerrno>
 #include <chrono>
-#include <future>
+#include <cstdio>
+#include <cstdlib>
+#include <ctime>
+
+#if defined(__linux__)
+#include <linux/futex.h>
+#include <sys/stat.h>
+#include <sys/syscall.h>
+#include <unistd.h>
+#endif
 
 #include "database.h"
+#include "utility.h"
+#include "segmentlog.h"
 
 static constexpr const char k_schema[] =
 R"(
+PRAGMA auto_vacuum = INCREMENTAL;
+
 BEGIN TRANSACTION;
 
 PRAGMA foreign_keys = ON;
@@ -102,18 +117,344 @@ END;
 COMMIT;
 )";
 
-Database::Database()
-  : m_db      { nullptr }
-  , m_running { true }
-  , m_thread  { &Database::database_thread, this }
+// Completion signal for a thread waiting on the database, one per thread
+// and reused for every query it makes. A futex on Linux, so nothing is
+// allocated or locked for the round trip.
+struct Waiter
+{
+  void wait();
+  void wake();
+
+private:
+  std::atomic<uint32_t> m_signaled{ 0 };
+#if !defined(__linux__)
+  std::mutex m_mutex;
+  std::condition_variable m_condition;
+#endif
+};
+
+#if defined(__linux__)
+void Waiter::wait() {
+  while (m_signaled.load(std::memory_order_acquire) == 0) {
+    syscall(SYS_futex, reinterpret_cast<uint32_t *>(&m_signaled), FUTEX_WAIT_PRIVATE, 0, nullptr, nullptr, 0);
+  }
+  m_signaled.store(0, std::memory_order_relaxed);
+}
+
+void Waiter::wake() {
+  m_signaled.store(1, std::memory_order_release);
+  syscall(SYS_futex, reinterpret_cast<uint32_t *>(&m_signaled), FUTEX_WAKE_PRIVATE, 1, nullptr, nullptr, 0);
+}
+#else
+void Waiter::wait() {
+  std::unique_lock<std::mutex> lock(m_mutex);
+  m_condition.wait(lock, [this] { return m_signaled.load() != 0; });
+  m_signaled.store(0);
+}
+
+void Waiter::wake() {
+  std::unique_lock<std::mutex> lock(m_mutex);
+  m_signaled.store(1);
+  m_condition.notify_one();
+}
+#endif
+
+static thread_local Waiter t_waiter;
+
+// Build log chunks, the change feed and settings, the first version on
+// top of k_schema. The search index is k_search.
+static constexpr const char k_first_version[] =
+R"(
+CREATE TABLE IF NOT EXISTS chunk_store(
+  id                            INTEGER NOT NULL PRIMARY KEY,
+  hash                          BLOB NOT NULL UNIQUE,
+  size                          INTEGER NOT NULL,
+  codec                         INTEGER NOT NULL,
+  context                       BLOB NOT NULL,
+  data                          BLOB NOT NULL
+);
+
+CREATE TABLE IF NOT EXISTS build_log_refs(
+  build_log_id                  INTEGER NOT NULL,
+  start                         INTEGER NOT NULL,
+  chunk_id                      INTEGER NOT NULL,
+
+  PRIMARY KEY(build_log_id, start),
+
+  FOREIGN KEY(build_log_id)     REFERENCES build_logs(id),
+  FOREIGN KEY(chunk_id)         REFERENCES chunk_store(id)
+) WITHOUT ROWID;
+
+CREATE INDEX IF NOT EXISTS build_log_refs_chunk ON build_log_refs(chunk_id, build_log_id);
+
+CREATE TABLE IF NOT EXISTS changes(
+  sequence                      INTEGER NOT NULL PRIMARY KEY AUTOINCREMENT,
+  timestamp                     INTEGER NOT NULL,
+  table_name                    TEXT NOT NULL,
+  row_id                        INTEGER NOT NULL,
+  operation                     TEXT NOT NULL
+);
+
+CREATE TABLE IF NOT EXISTS settings(
+  name                          TEXT NOT NULL PRIMARY KEY,
+  value                         INTEGER NOT NULL
+);
+)";
+
+// Substring search over build log chunks, created on open when SQLite
+// has what it needs (see search_unavailable()) rather than by a migration
+// so a build without it still opens the database
+static constexpr const char k_search[] =
+R"(
+CREATE VIRTUAL TABLE IF NOT EXISTS chunk_search USING fts5(
+  contents,
+  content = '',
+  tokenize = 'trigram'
+);
+)";
+
+// What the dashboard, log views and retention look rows up by. The day
+// tables get theirs from index_partitions() and create_partition().
+static constexpr const char k_indexes[] =
+R"(
+CREATE INDEX IF NOT EXISTS builds_project ON builds(project_id, start_timestamp);
+CREATE INDEX IF NOT EXISTS build_logs_build ON build_logs(build_id, configuration_id);
+CREATE INDEX IF NOT EXISTS http_logs_timestamp ON http_logs(timestamp);
+CREATE INDEX IF NOT EXISTS system_logs_timestamp ON system_logs(timestamp);
+CREATE INDEX IF NOT EXISTS changes_timestamp ON changes(timestamp);
+)";
+
+// Listing every build newest first, see Database::query_page
+static constexpr const char k_build_pages[] =
+R"(
+CREATE INDEX IF NOT EXISTS builds_start ON builds(start_timestamp);
+)";
+
+// Read on open like the rest of configuration, see Database::Tuning
+static constexpr const char k_storage_profile[] =
+R"(
+ALTER TABLE configuration ADD COLUMN storage_profile TEXT NOT NULL DEFAULT 'balanced';
+)";
+
+// Read on open, see Database::LogStorage
+static constexpr const char k_log_storage[] =
+R"(
+ALTER TABLE configuration ADD COLUMN log_storage TEXT NOT NULL DEFAULT 'sqlite';
+)";
+
+// Prefixes of the day tables, indexed by LogTable. The undivided tables
+// from the first release are still read through the views.
+static constexpr const char *k_log_tables[] = { "http_logs", "system_logs" };
+
+static constexpr int64_t k_day = 24 * 60 * 60;
+
+// Tables whose row changes are recorded in changes, by id
+static constexpr const char *k_captured[] = { "projects", "configurations", "builds", "build_logs" };
+
+// How often waiters look for changes committed by other processes
+static constexpr auto k_change_poll = std::chrono::seconds(1);
+
+// SQLite caps a compound SELECT at 500 terms, older days are left out of
+// the views but can still be read by name
+static constexpr size_t k_max_view_partitions = 400;
+
+// Incremental vacuum runs in steps of this many pages once the database
+// thread has been idle for k_vacuum_idle
+static constexpr const char k_vacuum_step[] = "PRAGMA incremental_vacuum(256)";
+static constexpr auto k_vacuum_idle = std::chrono::milliseconds(50);
+
+static std::string partition_name(const char *table, int64_t day) {
+  const time_t time = day * k_day;
+  tm date;
+  gmtime_r(&time, &date);
+  char buffer[64];
+  snprintf(buffer, sizeof buffer, "%s_%04d%02d%02d", table, date.tm_year + 1900, date.tm_mon + 1, date.tm_mday);
+  return buffer;
+}
+
+// First column of the first row, for pragmas and other single values
+static int64_t scalar(sqlite3 *db, const char *expression) {
+  int64_t value = 0;
+  auto read = [](void *context, int columns, char **values, char **) {
+    if (columns && values[0]) {
+      *static_cast<int64_t *>(context) = std::strtoll(values[0], nullptr, 10);
+    }
+    return 0;
+  };
+  sqlite3_exec(db, expression, read, &value, nullptr);
+  return value;
+}
+
+static std::string text(sqlite3 *db, const char *expression) {
+  std::string value;
+  auto read = [](void *context, int columns, char **values, char **) {
+    if (columns && values[0]) {
+      *static_cast<std::string *>(context) = values[0];
+    }
+    return 0;
+  };
+  sqlite3_exec(db, expression, read, &value, nullptr);
+  return value;
+}
+
+// The system SQLite may be built without FTS5, and the trigram tokenizer
+// only came with 3.34. The reason search is off, nullptr when it can be on.
+static const char *search_unavailable() {
+  if (!sqlite3_compileoption_used("ENABLE_FTS5")) {
+    return "SQLite was built without FTS5";
+  }
+  if (sqlite3_libversion_number() < 3034000) {
+    return "SQLite is older than 3.34 and has no trigram tokenizer";
+  }
+  return nullptr;
+}
+
+// Per connection settings of a storage profile, journal mode and
+// synchronous only matter to the writer
+static bool apply_tuning(sqlite3 *db, const Database::Tuning& tuning, bool writer) {
+  std::string pragmas =
+    "PRAGMA cache_size = -" + std::to_string(tuning.cache_size) + ";"
+    "PRAGMA mmap_size = " + std::to_string(tuning.mmap_size) + ";"
+    "PRAGMA temp_store = " + tuning.temp_store + ";";
+  if (writer) {
+    pragmas +=
+      "PRAGMA journal_mode = WAL;"
+      "PRAGMA synchronous = " + std::string(tuning.synchronous) + ";"
+      "PRAGMA wal_autocheckpoint = " + std::to_string(tuning.checkpoint_pages) + ";";
+  }
+  return sqlite3_exec(db, pragmas.c_str(), nullptr, nullptr, nullptr) == SQLITE_OK;
+}
+
+// In the same transaction as the change itself, whoever makes it
+static bool create_change_triggers(sqlite3 *db) {
+  static constexpr const char *k_operations[][2] = {
+    { "insert", "NEW" },
+    { "update", "NEW" },
+    { "delete", "OLD" }
+  };
+
+  std::string triggers;
+  for (const char *table : k_captured) {
+    for (const auto &operation : k_operations) {
+      const std::string name = std::string(table) + "_" + operation[0] + "_changes";
+      triggers += "CREATE TRIGGER IF NOT EXISTS " + name + " AFTER " + operation[0] + " ON " + table + " BEGIN "
+                  "INSERT INTO changes(timestamp, table_name, row_id, operation) "
+                  "VALUES(CAST(strftime('%s', 'now') AS INTEGER), '" + table + "', " + operation[1] + ".id, '" + operation[0] + "'); "
+                  "END;";
+    }
+  }
+  return sqlite3_exec(db, triggers.c_str(), nullptr, nullptr, nullptr) == SQLITE_OK;
+}
+
+static std::string partition_index(const std::string& name) {
+  return "CREATE INDEX IF NOT EXISTS " + name + "_timestamp ON " + name + "(timestamp);";
+}
+
+static bool index_partitions(sqlite3 *db) {
+  std::string indexes;
+  auto add = [](void *context, int, char **values, char **) {
+    *static_cast<std::string *>(context) += partition_index(values[0]);
+    return 0;
+  };
+  for (const char *prefix : k_log_tables) {
+    const std::string list =
+      "SELECT name FROM sqlite_master WHERE type = 'table' AND name GLOB '" +
+      std::string(prefix) + "_[0-9][0-9][0-9][0-9][0-9][0-9][0-9][0-9]'";
+    if (sqlite3_exec(db, list.c_str(), add, &indexes, nullptr) != SQLITE_OK) {
+      return false;
+    }
+  }
+  return sqlite3_exec(db, indexes.c_str(), nullptr, nullptr, nullptr) == SQLITE_OK;
+}
+
+// Schema changes since k_schema, in order. Migration i takes a database
+// from PRAGMA user_version i to i + 1 in one transaction with the version
+// bump, so an interrupted upgrade is retried whole on the next open. Only
+// ever append.
+struct Migration
+{
+  const char *description;
+  const char *expression;
+  bool (*run)(sqlite3 *db); // After expression, when it takes more than SQL
+};
+
+static constexpr Migration k_migrations[] = {
+  { "Build log chunk store, search, change feed and settings", k_first_version, create_change_triggers },
+  { "Indexes for dashboard queries and retention", k_indexes, index_partitions },
+  { "Index for paging through all builds", k_build_pages, nullptr },
+  { "Storage profile", k_storage_profile, nullptr },
+  { "Log storage", k_log_storage, nullptr },
+};
+
+static constexpr int k_schema_version = sizeof k_migrations / sizeof *k_migrations;
+
+Database::Database(size_t readers)
+  : m_reader_count    { readers }
+  , m_tuning          { k_default_tuning }
+  , m_has_readers     { false }
+  , m_read_sleepers   { 0 }
+  , m_read_room_waiters { 0 }
+  , m_reading         { true }
+  , m_statements      { new Registered[k_max_statements] }
+  , m_statement_count { 0 }
+  , m_begin           { *prepare("BEGIN IMMEDIATE") }
+  , m_commit          { *prepare("COMMIT") }
+  , m_rollback        { *prepare("ROLLBACK") }
+  , m_last_sequence   { *prepare("SELECT seq FROM sqlite_sequence WHERE name = 'changes'") }
+  , m_savepoint       { *prepare("SAVEPOINT writer") }
+  , m_release         { *prepare("RELEASE writer") }
+  , m_rollback_savepoint { *prepare("ROLLBACK TO writer") }
+  , m_running         { true }
+  , m_sleeping        { false }
+  , m_room_waiters    { 0 }
+  , m_max_batch       { 256 }
+  , m_max_delay       { 2000 }
+  , m_dropped_logs    { 0 }
+  , m_busy_initial    { 100 }
+  , m_busy_max_delay  { 50000 }
+  , m_busy_deadline   { 5000000 }
+  , m_busy_retries    { 0 }
+  , m_busy_timeouts   { 0 }
+  , m_reported_drops  { 0 }
+  , m_retention       { 0 }
+  , m_expire          { false }
+  , m_expired_partitions { 0 }
+  , m_log_storage     { SQLITE_STORAGE }
+  , m_search          { false }
+  , m_expired_segments { 0 }
+  , m_free_pages      { 0 }
+  , m_slow_query      { 100000 }
+  , m_last_change     { 0 }
+  , m_change_retention { 0 }
+  , m_backup_db       { nullptr }
+  , m_backup          { nullptr }
+  , m_backup_pages    { 128 }
+  , m_backup_interval { 10000 }
+  , m_backup_state    { BackupStatus::IDLE }
+  , m_backup_remaining { 0 }
+  , m_backup_total    { 0 }
+  , m_thread          { &Database::database_thread, this }
 {
 }
 
 Database::~Database() {
   log_system("Closed database");
 
+  // Readers hand writes over to the writer so they have to stop first
+  {
+    std::unique_lock<std::mutex> lock(m_read_mutex);
+    m_reading = false;
+  }
+  m_read_condition.notify_all();
+  for (auto &reader : m_readers) {
+    reader->thread.join();
+  }
+
   // No longer running
-  m_running.store(false);
+  {
+    std::unique_lock<std::mutex> lock(m_mutex);
+    m_running.store(false);
+  }
 
   // Wake up the blocked thread
   m_condition.notify_one();
@@ -122,30 +463,41 @@ Database::~Database() {
   if (m_thread.joinable()) {
     m_thread.join();
   }
+}
 
+Database::Connection::~Connection() {
   // Release memory held by the database
-  if (m_db) {
+  if (db) {
     // Finalize any prepared statements in cache
-    for (auto &[_, statement] : m_statement_cache) {
+    for (auto *statement : statements) {
       sqlite3_finalize(statement);
     }
+    for (auto &cached : recent) {
+      sqlite3_finalize(cached.statement);
+    }
 
     // Close the database
-    sqlite3_close(m_db);
+    sqlite3_close(db);
   }
 }
 
+int Database::schema_version() {
+  return k_schema_version;
+}
+
 bool Database::open(std::string_view name) {
-  if (sqlite3_open_v2(name.data(), &m_db, SQLITE_OPEN_READWRITE, nullptr) == SQLITE_OK) {
-    log_system("Opened database (Existing)");
-    return true;
+  if (sqlite3_open_v2(name.data(), &m_writer.db, SQLITE_OPEN_READWRITE, nullptr) == SQLITE_OK) {
+    if (open_readers(name)) {
+      log_system("Opened database (Existing)");
+      return true;
+    }
   }
   return false;
 }
 
 bool Database::create(std::string_view name) {
-  if (sqlite3_open(name.data(), &m_db) == SQLITE_OK) {
-    if (create_tables()) {
+  if (sqlite3_open(name.data(), &m_writer.db) == SQLITE_OK) {
+    if (create_tables() && open_readers(name)) {
       log_system("Opened database (Created)");
       return true;
     }
@@ -153,174 +505,1590 @@ bool Database::create(std::string_view name) {
   return false;
 }
 
-std::optional<std::vector<Database::Variant>> Database::query(
-  const std::string& expression,
-  const char *rd_spec,
-  const char *wr_spec,
-  ...
-) {
-  std::vector<Variant> wr_data;
-  std::vector<Variant> rd_data;
+std::optional<Database::Statement> Database::prepare(std::string_view expression) {
+  std::unique_lock<std::mutex> lock(m_statement_mutex);
+  const size_t index = m_statement_count.load();
+  if (index == k_max_statements) {
+    return std::nullopt;
+  }
+  m_statements[index].expression = expression;
+  // Publishes the entry to the lock free lookups in source()
+  m_statement_count.store(index + 1);
+  return Statement{ index };
+}
+
+Database::Source Database::source(std::string_view expression) const {
+  return { expression, k_ad_hoc };
+}
+
+Database::Source Database::source(Statement statement) const {
+  if (statement.index >= m_statement_count.load()) {
+    // Fails to prepare
+    return { {}, k_ad_hoc };
+  }
+  return { m_statements[statement.index].expression, statement.index };
+}
+
+bool Database::migrate(int& version) {
+  sqlite3 *db = m_writer.db;
+  version = static_cast<int>(scalar(db, "PRAGMA user_version"));
+  if (version > k_schema_version) {
+    log_system("Database schema version " + std::to_string(version) + " is newer than this build supports");
+    return false;
+  }
+
+  for (int next = version; next < k_schema_version; next++) {
+    const Migration& migration = k_migrations[next];
+    const std::string bump = "PRAGMA user_version = " + std::to_string(next + 1);
+    const bool migrated =
+      sqlite3_exec(db, "BEGIN IMMEDIATE", nullptr, nullptr, nullptr) == SQLITE_OK &&
+      sqlite3_exec(db, migration.expression, nullptr, nullptr, nullptr) == SQLITE_OK &&
+      (!migration.run || migration.run(db)) &&
+      sqlite3_exec(db, bump.c_str(), nullptr, nullptr, nullptr) == SQLITE_OK &&
+      sqlite3_exec(db, "COMMIT", nullptr, nullptr, nullptr) == SQLITE_OK;
+    if (!migrated) {
+      const std::string error = sqlite3_errmsg(db);
+      if (!sqlite3_get_autocommit(db)) {
+        sqlite3_exec(db, "ROLLBACK", nullptr, nullptr, nullptr);
+      }
+      log_system("Failed to migrate database to schema version " + std::to_string(next + 1) + ": " + error);
+      return false;
+    }
+  }
+  return true;
+}
+
+bool Database::open_readers(std::string_view name) {
+  attach(m_writer);
+
+  int version = 0;
+  if (!migrate(version)) {
+    return false;
+  }
+
+  if (!load_partitions() || !create_views()) {
+    return false;
+  }
+  m_expire.store(true);
+
+  std::string search_error;
+  if (const char *reason = search_unavailable()) {
+    search_error = reason;
+  } else if (sqlite3_exec(m_writer.db, k_search, nullptr, nullptr, nullptr) != SQLITE_OK) {
+    search_error = sqlite3_errmsg(m_writer.db);
+  }
+  m_search = search_error.empty();
+
+  m_last_change.store(scalar(m_writer.db, "SELECT seq FROM sqlite_sequence WHERE name = 'changes'"));
+
+  // WAL lets readers work off the last commit while the writer appends,
+  // how often it's synced is up to the profile
+  const std::string profile = text(m_writer.db, "SELECT storage_profile FROM configuration");
+  const Tuning *tuning = find_tuning(profile);
+  m_tuning = tuning ? tuning - k_tunings : k_default_tuning;
+  if (!apply_tuning(m_writer.db, k_tunings[m_tuning], true)) {
+    return false;
+  }
+
+  const std::string storage = text(m_writer.db, "SELECT log_storage FROM configuration");
+  if (!open_segment_logs(name, storage == k_log_storages[SEGMENT_STORAGE])) {
+    return false;
+  }
+
+  for (size_t i = 0; i < m_reader_count; i++) {
+    auto reader = std::make_unique<Reader>();
+    if (sqlite3_open_v2(name.data(), &reader->connection.db, SQLITE_OPEN_READONLY, nullptr) != SQLITE_OK) {
+      // Fewer readers is fine, none means the writer does everything
+      break;
+    }
+    attach(reader->connection);
+    apply_tuning(reader->connection.db, k_tunings[m_tuning], false);
+    reader->thread = std::thread(&Database::reader_thread, this, std::ref(reader->connection));
+    m_readers.push_back(std::move(reader));
+  }
+  m_has_readers.store(!m_readers.empty());
+
+  // Logged only now, the database thread writes logs to the partitions
+  // loaded above
+  for (int next = version; next < k_schema_version; next++) {
+    log_system("Migrated database to schema version " + std::to_string(next + 1) + " (" + k_migrations[next].description + ")");
+  }
+  if (!m_search) {
+    log_system("Build log search is off, chunks are stored unindexed: " + search_error);
+  }
+  // Converting is left to convert_auto_vacuum(), until then dropped days
+  // only go on the freelist
+  if (scalar(m_writer.db, "PRAGMA auto_vacuum") != 2) {
+    log_system("Freed log pages are not returned to the file until kaizen --vacuum is run once");
+  }
+  if (!tuning) {
+    log_system("Unknown storage profile '" + profile + "', using " + k_tunings[m_tuning].name);
+  }
+  log_system(std::string("Storage profile: ") + k_tunings[m_tuning].name);
+  if (storage != k_log_storages[SQLITE_STORAGE] && storage != k_log_storages[SEGMENT_STORAGE]) {
+    log_system("Unknown log storage '" + storage + "'");
+  }
+  if (m_log_storage == SEGMENT_STORAGE && storage != k_log_storages[SEGMENT_STORAGE]) {
+    log_system(std::string("Log storage stays segments while ") + name.data() + ".logs holds records");
+  }
+  log_system(std::string("Log storage: ") + k_log_storages[m_log_storage]);
+  return true;
+}
+
+// Segments go in a directory named after the database, one per table.
+// Records only ever move from SQLite to segments: ids and timestamps
+// carry on after the newest row so reads can take SQLite first, and once
+// segments hold records they keep getting them even when configured
+// otherwise, so no records end up where no read looks.
+bool Database::open_segment_logs(std::string_view name, bool configured) {
+  const std::string directory = std::string(name) + ".logs";
+  struct stat status;
+  if (!configured && stat(directory.c_str(), &status) != 0) {
+    return true;
+  }
+  if (mkdir(directory.c_str(), 0755) != 0 && errno != EEXIST) {
+    return false;
+  }
 
-  // Collect variants to write to the database
-  va_list va;
-  va_start(va, wr_spec);
-  for (const char *ch = wr_spec; ch && *ch; ch++) {
-    if (*ch == 's') {
-      wr_data.emplace_back(std::string(va_arg(va, const char *)));
-    } else if (*ch == 'i') {
-      wr_data.emplace_back(static_cast<int64_t>(va_arg(va, int64_t)));
-    } else if (*ch == 'b') {
-      wr_data.emplace_back(static_cast<int64_t>(va_arg(va, int)));
-    } else {
-      return std::nullopt;
+  bool empty = true;
+  for (size_t table = 0; table < 2; table++) {
+    const std::string prefix = k_log_tables[table];
+    const std::string last_id =
+      "SELECT COALESCE(MAX(seq), 0) FROM sqlite_sequence WHERE name = '" + prefix + "' OR name GLOB '" + prefix + "_[0-9]*'";
+    const std::string last_timestamp = "SELECT COALESCE(MAX(timestamp), 0) FROM " + prefix + "_all";
+    m_segment_logs[table] = SegmentLog::open(directory + "/" + prefix,
+                                             scalar(m_writer.db, last_id.c_str()),
+                                             scalar(m_writer.db, last_timestamp.c_str()));
+    if (!m_segment_logs[table]) {
+      return false;
     }
+    empty = empty && m_segment_logs[table]->empty();
+  }
+
+  if (!configured && empty) {
+    m_segment_logs[0].reset();
+    m_segment_logs[1].reset();
+    return true;
   }
-  va_end(va);
+  m_log_storage = SEGMENT_STORAGE;
+  return true;
+}
 
-  std::promise<std::optional<std::vector<Variant>>> promise;
-  std::future<std::optional<std::vector<Variant>>> future = promise.get_future();
+const Database::Tuning *Database::find_tuning(std::string_view name) {
+  for (const auto &tuning : k_tunings) {
+    if (name == tuning.name) {
+      return &tuning;
+    }
+  }
+  return nullptr;
+}
 
-  std::string error_message("Unknown");
-  enqueue([&]{
-    sqlite3_stmt *statement = create_statement(expression);
+bool Database::run(const Source& source,
+                   Binder bind,
+                   FunctionRef<void(sqlite3_stmt*)> read,
+                   int type)
+{
+  Waiter& waiter = t_waiter;
+  bool success = false;
 
+  auto execute = [&](Connection& connection) {
+    sqlite3_stmt *statement = connection.create_statement(source);
     if (!statement) {
-      goto error;
+      return false;
+    }
+
+    const bool result = bind(statement) && connection.complete_statement(statement, type);
+    if (result) {
+      read(statement);
+    }
+
+    // Don't hold the statement open across the rest of the batch
+    connection.finish_statement(statement);
+    return result;
+  };
+
+  // Results only count once the batch they were part of committed
+  auto complete = [&](bool committed) {
+    success = committed;
+    waiter.wake();
+  };
+
+  dispatch(source, { execute, complete });
+
+  // Wait for the database thread to execute the operation
+  waiter.wait();
+  return success;
+}
+
+bool Database::transaction(FunctionRef<bool(Writer&)> body) {
+  Waiter& waiter = t_waiter;
+  bool success = false;
+
+  // Outside a batch transaction the savepoint is one of its own
+  auto execute = [&](Connection& connection) {
+    if (!connection.execute(source(m_savepoint))) {
+      return false;
+    }
+    Writer writer(*this, connection);
+    if (body(writer) && connection.execute(source(m_release))) {
+      return true;
+    }
+    connection.execute(source(m_rollback_savepoint));
+    connection.execute(source(m_release));
+    return false;
+  };
+
+  auto complete = [&](bool committed) {
+    success = committed;
+    waiter.wake();
+  };
+
+  enqueue({ execute, complete });
+  waiter.wait();
+  return success;
+}
+
+Database::Writer::Writer(Database& db, Connection& connection)
+  : m_db         { db }
+  , m_connection { connection }
+{
+}
+
+bool Database::Writer::run(const std::string& expression, Binder bind, int64_t *rowid) {
+  sqlite3_stmt *statement = m_connection.create_statement(m_db.source(expression));
+  if (!statement) {
+    return false;
+  }
+  const bool success = bind(statement) && m_connection.complete_statement(statement, SQLITE_DONE);
+  if (success && rowid) {
+    *rowid = sqlite3_last_insert_rowid(m_connection.db);
+  }
+  m_connection.finish_statement(statement);
+  return success;
+}
+
+Database::Row::Row(const Cell *cells, const char *text, size_t columns)
+  : m_cells   { cells }
+  , m_text    { text }
+  , m_columns { columns }
+{
+}
+
+bool Database::Row::null(size_t column) const {
+  return m_cells[column].type == SQLITE_NULL;
+}
+
+int64_t Database::Row::integer(size_t column) const {
+  return m_cells[column].type == SQLITE_INTEGER ? m_cells[column].integer : 0;
+}
+
+double Database::Row::real(size_t column) const {
+  return m_cells[column].type == SQLITE_FLOAT ? m_cells[column].real : 0.0;
+}
+
+std::string_view Database::Row::text(size_t column) const {
+  const Cell& cell = m_cells[column];
+  if (cell.type != SQLITE_TEXT && cell.type != SQLITE_BLOB) {
+    return {};
+  }
+  return { m_text + cell.offset, cell.length };
+}
+
+std::string Database::Cursor::encode() const {
+  uint8_t bytes[16];
+  for (size_t i = 0; i < 8; i++) {
+    bytes[i] = static_cast<uint8_t>(static_cast<uint64_t>(timestamp) >> (56 - i * 8));
+    bytes[8 + i] = static_cast<uint8_t>(static_cast<uint64_t>(id) >> (56 - i * 8));
+  }
+
+  // URL safe, '+' would come back as a space from a query string
+  std::string token = base64_encode(bytes, sizeof bytes);
+  token.erase(token.find_last_not_of('=') + 1);
+  for (char &ch : token) {
+    ch = ch == '+' ? '-' : ch == '/' ? '_' : ch;
+  }
+  return token;
+}
+
+std::optional<Database::Cursor> Database::Cursor::decode(std::string_view token) {
+  const auto bytes = base64_decode(token);
+  if (!bytes || bytes->size() != 16) {
+    return std::nullopt;
+  }
+
+  uint64_t timestamp = 0;
+  uint64_t id = 0;
+  for (size_t i = 0; i < 8; i++) {
+    timestamp = (timestamp << 8) | static_cast<uint8_t>((*bytes)[i]);
+    id = (id << 8) | static_cast<uint8_t>((*bytes)[8 + i]);
+  }
+  return Cursor{ static_cast<int64_t>(timestamp), static_cast<int64_t>(id) };
+}
+
+std::string Database::page_expression(const std::string& expression, const char *timestamp) {
+  // Row values compare like tuples, which is what a seek past
+  // (timestamp, id) needs, and SQLite turns them into an index range
+  if (!timestamp) {
+    return expression + " AND id < ? ORDER BY id DESC LIMIT ?";
+  }
+  const std::string key = timestamp;
+  return expression + " AND (" + key + ", id) < (?, ?) ORDER BY " + key + " DESC, id DESC LIMIT ?";
+}
+
+void Database::Batch::clear() {
+  rows = 0;
+  cells.clear();
+  text.clear();
+}
+
+bool Database::run_rows(const Source& source,
+                        Binder bind,
+                        FunctionRef<bool(const Row&)> each)
+{
+  // Batches go back and forth between the database thread and this one
+  // so their buffers get reused
+  struct Cursor
+  {
+    std::mutex mutex;
+    std::condition_variable condition;
+    std::deque<Batch> ready; // Oldest first
+    std::vector<Batch> spare; // Taken by the caller and cleared
+    size_t columns = 0;
+    bool stopped = false;
+    bool aborted = false; // The caller fell too far behind
+    bool done = false;
+    bool success = false;
+  } cursor;
+
+  auto execute = [&](Connection& connection) {
+    sqlite3_stmt *statement = connection.create_statement(source);
+    if (!statement || !bind(statement)) {
+      if (statement) {
+        connection.finish_statement(statement);
+      }
+      return false;
     }
 
-    // Bind statements
-    for (const char *ch = wr_spec; ch && *ch; ch++) {
-      const size_t index = ch - wr_spec;
-      if (*ch == 's') {
-        const std::string& text = std::get<std::string>(wr_data[index]);
-        if (sqlite3_bind_text(statement, index + 1, text.data(), text.size(), nullptr) != SQLITE_OK) {
-          goto error;
+    const size_t columns = sqlite3_column_count(statement);
+
+    // Queues the batch for the caller and starts on a spare one, false
+    // once it stopped. The connection and its snapshot are only held up
+    // for so long by a caller that doesn't keep up, writing to a slow
+    // client say.
+    auto deliver = [&](Batch& batch) {
+      {
+        std::unique_lock<std::mutex> lock(cursor.mutex);
+        if (cursor.ready.size() >= k_max_pending_batches) {
+          // The caller's pace isn't the statement's cost
+          const auto waiting = std::chrono::steady_clock::now();
+          cursor.aborted = !cursor.condition.wait_for(lock, k_deliver_timeout, [&] {
+            return cursor.ready.size() < k_max_pending_batches || cursor.stopped;
+          });
+          connection.active.paused += std::chrono::steady_clock::now() - waiting;
         }
-      } else if (*ch == 'i') {
-        const auto value = std::get<int64_t>(wr_data[index]);
-        if (sqlite3_bind_int(statement, index + 1, value) != SQLITE_OK) {
-          goto error;
+        if (cursor.stopped || cursor.aborted) {
+          return false;
         }
-      } else if (*ch == 'b') {
-        const auto value = std::get<bool>(wr_data[index]);
-        if (sqlite3_bind_int(statement, index + 1, static_cast<int>(value)) != SQLITE_OK) {
-          goto error;
+        cursor.columns = columns;
+        cursor.ready.push_back(std::move(batch));
+        if (cursor.spare.empty()) {
+          batch = Batch();
+        } else {
+          batch = std::move(cursor.spare.back());
+          cursor.spare.pop_back();
         }
       }
-    }
+      cursor.condition.notify_one();
+      return true;
+    };
 
-    if (!complete_statement(statement, rd_spec ? SQLITE_ROW : SQLITE_DONE)) {
-      goto error;
-    }
+    Batch batch;
+
+    int result = SQLITE_DONE;
+    while ((result = connection.step(statement)) == SQLITE_ROW) {
+      for (size_t column = 0; column < columns; column++) {
+        Row::Cell cell{ sqlite3_column_type(statement, column), 0, 0.0, 0, 0 };
+        if (cell.type == SQLITE_INTEGER) {
+          cell.integer = sqlite3_column_int64(statement, column);
+        } else if (cell.type == SQLITE_FLOAT) {
+          cell.real = sqlite3_column_double(statement, column);
+        } else if (cell.type == SQLITE_TEXT || cell.type == SQLITE_BLOB) {
+          const void *data = cell.type == SQLITE_TEXT
+            ? static_cast<const void *>(sqlite3_column_text(statement, column))
+            : sqlite3_column_blob(statement, column);
+          cell.offset = batch.text.size();
+          cell.length = sqlite3_column_bytes(statement, column);
+          batch.text.append(static_cast<const char *>(data), cell.length);
+        }
+        batch.cells.push_back(cell);
+      }
+      batch.rows++;
 
-    if (rd_spec) {
-      for (const char *ch = rd_spec; *ch; ch++) {
-        const size_t index = ch - rd_spec;
-        if (*ch == 's') {
-          rd_data.emplace_back(sqlite3_column_text(statement, index));
-        } else if (*ch == 'i') {
-          rd_data.emplace_back(static_cast<int64_t>(sqlite3_column_int(statement, index)));
-        } else if (*ch == 'b') {
-          rd_data.emplace_back(static_cast<bool>(sqlite3_column_int(statement, index)));
+      if (batch.rows >= k_batch_rows || batch.text.size() >= k_batch_bytes) {
+        if (!deliver(batch)) {
+          break;
         }
       }
     }
 
-    promise.set_value(rd_data);
-    return;
+    if (result == SQLITE_DONE && batch.rows && !deliver(batch)) {
+      result = SQLITE_ROW;
+    }
 
-  error:
-    error_message = sqlite3_errmsg(m_db);
-    promise.set_value(std::nullopt);
-  });
+    connection.finish_statement(statement);
 
-  // Wait for the database thread to execute the operation
-  return future.get();
+    // Stopping early isn't a failure, giving up on the caller is
+    return result == SQLITE_DONE || (result == SQLITE_ROW && !cursor.aborted);
+  };
+
+  auto complete = [&](bool committed) {
+    {
+      std::unique_lock<std::mutex> lock(cursor.mutex);
+      cursor.success = committed;
+      cursor.done = true;
+    }
+    cursor.condition.notify_one();
+  };
+
+  dispatch(source, { execute, complete });
+
+  Batch batch;
+  size_t columns = 0;
+  for (;;) {
+    {
+      std::unique_lock<std::mutex> lock(cursor.mutex);
+      if (batch.rows) {
+        batch.clear();
+        cursor.spare.push_back(std::move(batch));
+      }
+      cursor.condition.wait(lock, [&] { return !cursor.ready.empty() || cursor.done; });
+      if (cursor.ready.empty()) {
+        return cursor.success;
+      }
+      batch = std::move(cursor.ready.front());
+      cursor.ready.pop_front();
+      columns = cursor.columns;
+    }
+    cursor.condition.notify_one();
+
+    // Batches still arriving after each() asked to stop are dropped
+    for (size_t i = 0; i < batch.rows && !cursor.stopped; i++) {
+      const Row row{ batch.cells.data() + i * columns, batch.text.data(), columns };
+      if (!each(row)) {
+        std::unique_lock<std::mutex> lock(cursor.mutex);
+        cursor.stopped = true;
+        cursor.condition.notify_one();
+      }
+    }
+  }
 }
 
 bool Database::create_tables() {
-  return sqlite3_exec(m_db, k_schema, nullptr, nullptr, nullptr) == SQLITE_OK;
+  return sqlite3_exec(m_writer.db, k_schema, nullptr, nullptr, nullptr) == SQLITE_OK;
 }
 
-sqlite3_stmt *Database::create_statement(std::string_view contents) {
-  auto find = m_statement_cache.find(contents.data());
-  if (find != m_statement_cache.end()) {
-    auto *statement = find->second;
-    if (sqlite3_reset(statement) != SQLITE_OK || sqlite3_clear_bindings(statement) != SQLITE_OK) {
-      sqlite3_finalize(statement);
-      m_statement_cache.erase(find);
-      goto create;
+sqlite3_stmt *Database::Connection::create_statement(const Source& source) {
+  active = { nullptr, std::chrono::steady_clock::now(), {}, 0 };
+
+  sqlite3_stmt **slot = nullptr;
+  Profile **profile = nullptr;
+  if (source.statement != k_ad_hoc) {
+    if (statements.size() <= source.statement) {
+      statements.resize(source.statement + 1, nullptr);
+      statement_profiles.resize(source.statement + 1, nullptr);
+    }
+    slot = &statements[source.statement];
+    profile = &statement_profiles[source.statement];
+  } else {
+    auto find = cache.find(source.expression);
+    if (find != cache.end()) {
+      recent.splice(recent.begin(), recent, find->second);
+      slot = &find->second->statement;
+      profile = &find->second->profile;
     }
-    return statement;
   }
 
-create:
-  // Keep trying until we can create a statement
-  sqlite3_stmt *statement = nullptr;
-  int prepare = 0;
-  while ((prepare = sqlite3_prepare_v2(m_db, contents.data(), -1, &statement, nullptr)) == SQLITE_BUSY) {
-    ;
+  if (slot && *slot) {
+    if (sqlite3_reset(*slot) == SQLITE_OK && sqlite3_clear_bindings(*slot) == SQLITE_OK) {
+      active.profile = *profile;
+      return *slot;
+    }
+    sqlite3_finalize(*slot);
+    *slot = nullptr;
   }
 
+  // Locks are waited out by the busy handler, see Database::busy
+  sqlite3_stmt *statement = nullptr;
+  const int prepare = sqlite3_prepare_v2(db, source.expression.data(), source.expression.size(), &statement, nullptr);
+
   // Couldn't create a prepared statement
-  if (prepare != SQLITE_OK) {
+  if (prepare != SQLITE_OK || !statement) {
     return nullptr;
   }
 
-  m_statement_cache.insert({ contents.data(), statement });
+  if (slot) {
+    *slot = statement;
+    if (!*profile) {
+      *profile = profile_for(source.expression);
+    }
+    active.profile = *profile;
+    return statement;
+  }
+
+  // Make room by dropping the least recently used
+  if (recent.size() >= k_statement_cache) {
+    cache.erase(recent.back().expression);
+    sqlite3_finalize(recent.back().statement);
+    recent.pop_back();
+  }
+
+  recent.push_front({ std::string(source.expression), statement, profile_for(source.expression) });
+  cache.emplace(recent.front().expression, recent.begin());
+  active.profile = recent.front().profile;
   return statement;
 }
 
-bool Database::complete_statement(sqlite3_stmt *statement, int type) {
-  int attempt = 0;
-  while ((attempt = sqlite3_step(statement)) == SQLITE_BUSY) {
-    ;
+Database::Profile *Database::Connection::profile_for(std::string_view expression) {
+  std::unique_lock<std::mutex> lock(profile_mutex);
+  auto find = profiles.find(std::string(expression));
+  if (find != profiles.end()) {
+    return &find->second;
+  }
+  if (profiles.size() >= k_max_profiles) {
+    return nullptr;
   }
-  return attempt == type;
+  auto& profile = profiles[std::string(expression)];
+  profile.expression = expression;
+  return &profile;
 }
 
-void Database::enqueue(std::function<void()> &&function)
-{
-  {
-    std::unique_lock<std::mutex> lock(m_mutex);
-    m_queue.emplace(std::move(function));
+static size_t histogram_bucket(uint64_t duration) {
+  size_t bucket = 0;
+  while (duration && bucket < Database::k_histogram_buckets - 1) {
+    duration >>= 1;
+    bucket++;
   }
-  m_condition.notify_one();
+  return bucket;
 }
 
-bool Database::log(const std::string& table, const std::string& contents) {
-  const auto now = std::chrono::system_clock::now();
-  const auto epoch = now.time_since_epoch();
-  const auto seconds = std::chrono::duration_cast<std::chrono::seconds>(epoch);
-  const auto timestamp = static_cast<int64_t>(seconds.count());
-  const auto result = query("INSERT INTO " + table + "(timestamp, contents) VALUES(?, ?)", nullptr, "is", timestamp, contents.c_str());
-  return !!result;
+void Database::Connection::finish_statement(sqlite3_stmt *statement) {
+  const auto elapsed = std::chrono::steady_clock::now() - active.started - active.paused;
+  const auto duration = static_cast<uint64_t>(
+    std::max<int64_t>(std::chrono::duration_cast<std::chrono::microseconds>(elapsed).count(), 0));
+
+  // Read and cleared so they only ever cover one run
+  const int fullscan_steps = sqlite3_stmt_status(statement, SQLITE_STMTSTATUS_FULLSCAN_STEP, 1);
+  const int sorts = sqlite3_stmt_status(statement, SQLITE_STMTSTATUS_SORT, 1);
+  const int autoindexes = sqlite3_stmt_status(statement, SQLITE_STMTSTATUS_AUTOINDEX, 1);
+  const int vm_steps = sqlite3_stmt_status(statement, SQLITE_STMTSTATUS_VM_STEP, 1);
+  sqlite3_reset(statement);
+
+  Profile *profile = active.profile;
+  if (profile) {
+    std::unique_lock<std::mutex> lock(profile_mutex);
+    profile->count++;
+    profile->rows += active.rows;
+    profile->total += duration;
+    profile->max = std::max(profile->max, duration);
+    profile->fullscan_steps += fullscan_steps;
+    profile->sorts += sorts;
+    profile->autoindexes += autoindexes;
+    profile->vm_steps += vm_steps;
+    profile->histogram[histogram_bucket(duration)]++;
+  }
+  active.profile = nullptr;
+
+  const int64_t threshold = owner ? owner->m_slow_query.load() : 0;
+  if (threshold > 0 && duration >= static_cast<uint64_t>(threshold)) {
+    owner->record_slow(*this, profile, sqlite3_sql(statement), duration);
+  }
 }
 
-bool Database::log_http(const std::string& contents) {
-  return log("http_logs", contents);
+bool Database::Connection::complete_statement(sqlite3_stmt *statement, int type) {
+  return step(statement) == type;
 }
 
-bool Database::log_system(const std::string& contents) {
-  return log("system_logs", contents);
+int Database::Connection::step(sqlite3_stmt *statement) {
+  // SQLITE_BUSY only comes back once the busy handler gave up
+  const int result = sqlite3_step(statement);
+  if (result == SQLITE_ROW) {
+    active.rows++;
+  }
+  return result;
 }
 
-// Database thread
+int Database::busy(void *context, int count) {
+  auto& connection = *static_cast<Connection *>(context);
+  Database& database = *connection.owner;
+
+  const auto now = std::chrono::steady_clock::now();
+  if (count == 0) {
+    connection.busy_since = now;
+  }
+
+  const auto waited = std::chrono::duration_cast<std::chrono::microseconds>(now - connection.busy_since);
+  const int64_t remaining = database.m_busy_deadline.load() - waited.count();
+  if (remaining <= 0) {
+    database.m_busy_timeouts++;
+    return 0;
+  }
+
+  // Doubles every retry, never sleeping past the deadline
+  const int64_t initial = std::max<int64_t>(database.m_busy_initial.load(), 1);
+  const int64_t delay = std::min({ initial << std::min(count, 20), database.m_busy_max_delay.load(), remaining });
+
+  database.m_busy_retries++;
+  std::this_thread::sleep_for(std::chrono::microseconds(delay));
+  return 1;
+}
+
+void Database::attach(Connection& connection) {
+  connection.owner = this;
+  sqlite3_busy_handler(connection.db, &Database::busy, &connection);
+}
+
+void Database::set_busy_backoff(std::chrono::microseconds initial,
+                                std::chrono::microseconds max_delay,
+                                std::chrono::milliseconds deadline)
+{
+  m_busy_initial.store(initial.count());
+  m_busy_max_delay.store(max_delay.count());
+  m_busy_deadline.store(std::chrono::duration_cast<std::chrono::microseconds>(deadline).count());
+}
+
+Database::Stats Database::stats() const {
+  return {
+    m_dropped_logs.load(),
+    m_busy_retries.load(),
+    m_busy_timeouts.load(),
+    m_expired_partitions.load(),
+    m_expired_segments.load()
+  };
+}
+
+void Database::enqueue(const Task& task)
+{
+  // Full means the database thread is far behind, wait for room rather
+  // than fail the query
+  if (!m_tasks.push(task)) {
+    std::unique_lock<std::mutex> lock(m_mutex);
+    // Pairs with the fence in database_thread, either we see the room or
+    // it sees us waiting
+    m_room_waiters++;
+    std::atomic_thread_fence(std::memory_order_seq_cst);
+    m_room_condition.wait(lock, [&] { return m_tasks.push(task); });
+    m_room_waiters--;
+  }
+
+  // Pairs with the fence in database_thread, either it sees the task or
+  // we see it sleeping
+  std::atomic_thread_fence(std::memory_order_seq_cst);
+  if (m_sleeping.load(std::memory_order_relaxed)) {
+    std::unique_lock<std::mutex> lock(m_mutex);
+    m_condition.notify_one();
+  }
+}
+
+// Never 0, that's an empty hint
+static uint64_t write_hint(std::string_view expression) {
+  return std::hash<std::string_view>()(expression) | 1;
+}
+
+void Database::dispatch(const Source& source, const Task& task) {
+  // Expressions not yet known to be writes are tried on a reader first
+  bool read = m_has_readers.load(std::memory_order_relaxed);
+  if (read && source.statement != k_ad_hoc) {
+    read = m_statements[source.statement].read_only.load() != 0;
+  } else if (read) {
+    const uint64_t hint = write_hint(source.expression);
+    read = m_write_hints[hint % k_write_hints].load(std::memory_order_relaxed) != hint;
+  }
+  if (read) {
+    enqueue_read({ source, task });
+  } else {
+    enqueue(task);
+  }
+}
+
+void Database::enqueue_read(const Read& read)
+{
+  // Readers are far behind, see enqueue()
+  if (!m_reads.push(read)) {
+    std::unique_lock<std::mutex> lock(m_read_mutex);
+    m_read_room_waiters++;
+    std::atomic_thread_fence(std::memory_order_seq_cst);
+    m_read_room_condition.wait(lock, [&] { return m_reads.push(read); });
+    m_read_room_waiters--;
+  }
+
+  // Pairs with the fence in reader_thread
+  std::atomic_thread_fence(std::memory_order_seq_cst);
+  if (m_read_sleepers.load(std::memory_order_relaxed)) {
+    std::unique_lock<std::mutex> lock(m_read_mutex);
+    m_read_condition.notify_one();
+  }
+}
+
+void Database::set_batching(size_t max_batch, std::chrono::microseconds max_delay) {
+  m_max_batch.store(std::max<size_t>(max_batch, 1));
+  m_max_delay.store(max_delay.count());
+}
+
+bool Database::Connection::execute(const Source& source) {
+  sqlite3_stmt *statement = create_statement(source);
+  const bool result = statement && complete_statement(statement, SQLITE_DONE);
+  if (statement) {
+    finish_statement(statement);
+  }
+  return result;
+}
+
+void Database::run_batch(std::vector<Task>& tasks, std::vector<LogRecord>& logs) {
+  // A single write gains nothing from an explicit transaction
+  sqlite3 *db = m_writer.db;
+  bool transaction = db && tasks.size() + logs.size() > 1 && sqlite3_get_autocommit(db);
+  if (transaction && !m_writer.execute(source(m_begin))) {
+    // Still locked at the busy deadline, every statement on its own would
+    // wait it out again
+    if (sqlite3_errcode(db) == SQLITE_BUSY) {
+      m_dropped_logs += logs.size();
+      m_reported_drops += logs.size();
+      for (const auto &task : tasks) {
+        task.complete(false);
+      }
+      return;
+    }
+    transaction = false;
+  }
+
+  const int64_t total_changes = db ? sqlite3_total_changes64(db) : 0;
+  auto& results = m_results;
+  results.assign(tasks.size(), false);
+  for (size_t i = 0; i < tasks.size(); i++) {
+    results[i] = tasks[i].execute(m_writer);
+    // Most failures only undo their own statement, some (I/O errors, out
+    // of memory) roll back the whole transaction and with it every task
+    // before this one
+    if (transaction && sqlite3_get_autocommit(db)) {
+      std::fill(results.begin(), results.begin() + i + 1, false);
+      transaction = false;
+    }
+  }
+
+  const bool wrote = db && sqlite3_total_changes64(db) != total_changes;
+
+  if (!logs.empty()) {
+    write_logs(logs);
+  }
+
+  bool committed = true;
+  if (transaction && !m_writer.execute(source(m_commit))) {
+    m_writer.execute(source(m_rollback));
+    committed = false;
+  }
+
+  // Only tasks can touch the captured tables, and only when they wrote
+  if (wrote && committed) {
+    sqlite3_stmt *statement = m_writer.create_statement(source(m_last_sequence));
+    if (statement) {
+      if (m_writer.step(statement) == SQLITE_ROW) {
+        publish_changes(sqlite3_column_int64(statement, 0));
+      }
+      m_writer.finish_statement(statement);
+    }
+  }
+
+  for (size_t i = 0; i < tasks.size(); i++) {
+    tasks[i].complete(committed && results[i]);
+  }
+}
+
+void Database::publish_changes(int64_t last) {
+  {
+    std::unique_lock<std::mutex> lock(m_change_mutex);
+    if (last <= m_last_change.load()) {
+      return;
+    }
+    m_last_change.store(last);
+  }
+  m_change_condition.notify_all();
+}
+
+bool Database::changes(int64_t after, size_t limit, FunctionRef<bool(const Change&)> each) {
+  return query_rows(
+    "SELECT sequence, timestamp, table_name, row_id, operation FROM changes WHERE sequence > ? ORDER BY sequence LIMIT ?",
+    [&](const Row& row) {
+      return each({ row.integer(0), row.integer(1), row.text(2), row.integer(3), row.text(4) });
+    },
+    after,
+    limit);
+}
+
+bool Database::wait_changes(int64_t after, std::chrono::milliseconds timeout) {
+  const auto deadline = std::chrono::steady_clock::now() + timeout;
+  for (;;) {
+    {
+      std::unique_lock<std::mutex> lock(m_change_mutex);
+      const auto until = std::min(deadline, std::chrono::steady_clock::now() + k_change_poll);
+      if (m_change_condition.wait_until(lock, until, [&] { return m_last_change.load() > after; })) {
+        return true;
+      }
+    }
+
+    // Nothing from us, look for commits by other processes
+    const auto last = query<std::optional<int64_t>>("SELECT seq FROM sqlite_sequence WHERE name = 'changes'");
+    if (last && std::get<0>(*last)) {
+      publish_changes(*std::get<0>(*last));
+      if (*std::get<0>(*last) > after) {
+        return true;
+      }
+    }
+    if (std::chrono::steady_clock::now() >= deadline) {
+      return false;
+    }
+  }
+}
+
+std::optional<int64_t> Database::oldest_change() {
+  const auto oldest = query<std::optional<int64_t>>("SELECT MIN(sequence) FROM changes");
+  if (!oldest) {
+    return std::nullopt;
+  }
+  return std::get<0>(*oldest);
+}
+
+static int64_t now() {
+  const auto now = std::chrono::system_clock::now();
+  const auto epoch = now.time_since_epoch();
+  const auto seconds = std::chrono::duration_cast<std::chrono::seconds>(epoch);
+  return static_cast<int64_t>(seconds.count());
+}
+
+bool Database::log(LogTable table, const std::string& contents) {
+  const auto timestamp = now();
+  {
+    std::unique_lock<std::mutex> lock(m_mutex);
+    if (m_logs.size() >= k_max_pending_logs) {
+      m_dropped_logs++;
+      return false;
+    }
+    m_logs.push_back({ table, timestamp, contents });
+  }
+  m_condition.notify_one();
+  return true;
+}
+
+bool Database::log_http(const std::string& contents) {
+  return log(HTTP_LOGS, contents);
+}
+
+bool Database::log_system(const std::string& contents) {
+  return log(SYSTEM_LOGS, contents);
+}
+
+uint64_t Database::Profile::percentile(double fraction) const {
+  const double goal = fraction * count;
+  uint64_t seen = 0;
+  for (size_t bucket = 0; bucket < k_histogram_buckets; bucket++) {
+    seen += histogram[bucket];
+    if (seen && seen >= goal) {
+      return uint64_t(1) << bucket;
+    }
+  }
+  return 0;
+}
+
+std::vector<Database::Profile> Database::profile() {
+  std::vector<Connection*> connections{ &m_writer };
+  for (auto &reader : m_readers) {
+    connections.push_back(&reader->connection);
+  }
+
+  // The same SQL runs on the writer and every reader
+  std::unordered_map<std::string_view, Profile> merged;
+  for (Connection *connection : connections) {
+    std::unique_lock<std::mutex> lock(connection->profile_mutex);
+    for (const auto &[expression, profile] : connection->profiles) {
+      if (!profile.count) {
+        continue;
+      }
+      auto& total = merged[expression];
+      if (total.expression.empty()) {
+        total.expression = expression;
+      }
+      total.count += profile.count;
+      total.rows += profile.rows;
+      total.total += profile.total;
+      total.max = std::max(total.max, profile.max);
+      total.fullscan_steps += profile.fullscan_steps;
+      total.sorts += profile.sorts;
+      total.autoindexes += profile.autoindexes;
+      total.vm_steps += profile.vm_steps;
+      for (size_t bucket = 0; bucket < k_histogram_buckets; bucket++) {
+        total.histogram[bucket] += profile.histogram[bucket];
+      }
+      if (!profile.plan.empty()) {
+        total.plan = profile.plan;
+      }
+    }
+  }
+
+  std::vector<Profile> profiles;
+  profiles.reserve(merged.size());
+  for (auto &entry : merged) {
+    profiles.push_back(std::move(entry.second));
+  }
+  return profiles;
+}
+
+void Database::reset_profile() {
+  std::vector<Connection*> connections{ &m_writer };
+  for (auto &reader : m_readers) {
+    connections.push_back(&reader->connection);
+  }
+
+  // Statements point at their profile so entries are cleared, not erased
+  for (Connection *connection : connections) {
+    std::unique_lock<std::mutex> lock(connection->profile_mutex);
+    for (auto &[expression, profile] : connection->profiles) {
+      profile = Profile{};
+      profile.expression = expression;
+    }
+  }
+
+  std::unique_lock<std::mutex> lock(m_slow_mutex);
+  m_slow_queries.clear();
+}
+
+void Database::set_slow_query(std::chrono::milliseconds threshold) {
+  m_slow_query.store(std::chrono::duration_cast<std::chrono::microseconds>(threshold).count());
+}
+
+std::vector<Database::SlowQuery> Database::slow_queries() const {
+  std::unique_lock<std::mutex> lock(m_slow_mutex);
+  return { m_slow_queries.begin(), m_slow_queries.end() };
+}
+
+// One line per step of EXPLAIN QUERY PLAN, indented under its parent the
+// way the sqlite3 shell shows it
+static std::string explain(sqlite3 *db, const char *expression) {
+  const std::string explain = std::string("EXPLAIN QUERY PLAN ") + expression;
+  sqlite3_stmt *statement = nullptr;
+  if (sqlite3_prepare_v2(db, explain.data(), explain.size(), &statement, nullptr) != SQLITE_OK || !statement) {
+    return {};
+  }
+
+  std::string plan;
+  std::unordered_map<int64_t, size_t> depths;
+  while (sqlite3_step(statement) == SQLITE_ROW) {
+    const int64_t id = sqlite3_column_int64(statement, 0);
+    const auto parent = depths.find(sqlite3_column_int64(statement, 1));
+    const size_t depth = parent == depths.end() ? 0 : parent->second + 1;
+    depths[id] = depth;
+
+    const auto *detail = reinterpret_cast<const char *>(sqlite3_column_text(statement, 3));
+    plan.append(depth * 2, ' ');
+    plan += detail ? detail : "";
+    plan += '\n';
+  }
+
+  sqlite3_finalize(statement);
+  return plan;
+}
+
+void Database::record_slow(Connection& connection, Profile *profile, const char *expression, uint64_t duration) {
+  if (!expression) {
+    return;
+  }
+
+  // Bound values are left out, they may be anything from a password to
+  // a whole build log
+  SlowQuery slow{ now(), duration, expression, explain(connection.db, expression) };
+  if (profile) {
+    std::unique_lock<std::mutex> lock(connection.profile_mutex);
+    profile->plan = slow.plan;
+  }
+
+  log_system("Slow query (" + std::to_string(duration / 1000) + " ms): " + slow.expression);
+
+  std::unique_lock<std::mutex> lock(m_slow_mutex);
+  if (m_slow_queries.size() >= k_slow_queries) {
+    m_slow_queries.pop_front();
+  }
+  m_slow_queries.push_back(std::move(slow));
+}
+
+void Database::write_logs(std::vector<LogRecord>& records) {
+  // Leave a trace of records lost to overflow since the last batch
+  const uint64_t dropped = m_dropped_logs.load();
+  if (dropped != m_reported_drops) {
+    records.push_back({
+      SYSTEM_LOGS,
+      now(),
+      "Dropped " + std::to_string(dropped - m_reported_drops) + " log records"
+    });
+    m_reported_drops = dropped;
+  }
+
+  // Nowhere to write before the database is opened
+  if (!m_writer.db) {
+    m_dropped_logs += records.size();
+    m_reported_drops += records.size();
+    return;
+  }
+
+  if (m_expire.exchange(false)) {
+    expire_partitions();
+    expire_changes();
+  }
+
+  for (const auto &record : records) {
+    Partitions& partitions = m_partitions[record.table];
+    const int64_t day = record.timestamp / k_day;
+
+    if (SegmentLog *segments = m_segment_logs[record.table].get()) {
+      // No day tables to create, retention still looks again every day
+      if (day != partitions.current) {
+        partitions.current = day;
+        m_expire.store(true);
+      }
+      if (!segments->append(record.timestamp, record.contents)) {
+        m_dropped_logs++;
+        m_reported_drops++;
+      }
+      continue;
+    }
+
+    if (day != partitions.current) {
+      if (!partitions.days.count(day) && !create_partition(record.table, day)) {
+        m_dropped_logs++;
+        m_reported_drops++;
+        continue;
+      }
+      partitions.current = day;
+      partitions.insert = "INSERT INTO " + partition_name(k_log_tables[record.table], day) + "(timestamp, contents) VALUES(?, ?)";
+    }
+
+    sqlite3_stmt *statement = m_writer.create_statement(source(partitions.insert));
+    if (!statement ||
+        sqlite3_bind_int64(statement, 1, record.timestamp) != SQLITE_OK ||
+        sqlite3_bind_text(statement, 2, record.contents.data(), record.contents.size(), nullptr) != SQLITE_OK ||
+        !m_writer.complete_statement(statement, SQLITE_DONE))
+    {
+      m_dropped_logs++;
+      m_reported_drops++;
+    }
+    if (statement) {
+      m_writer.finish_statement(statement);
+    }
+  }
+
+  if (m_log_storage == SEGMENT_STORAGE) {
+    sync_segment_logs();
+  }
+}
+
+// Segments are synced as often as the storage profile has SQLite sync
+// the WAL: every batch, at most once a second, or only when a segment is
+// full and on close
+void Database::sync_segment_logs() {
+  const std::string_view synchronous = k_tunings[m_tuning].synchronous;
+  const auto current = std::chrono::steady_clock::now();
+  if (synchronous == "OFF" || (synchronous == "NORMAL" && current - m_segments_synced < std::chrono::seconds(1))) {
+    return;
+  }
+  m_segments_synced = current;
+  for (auto &segments : m_segment_logs) {
+    if (!segments->sync()) {
+      log_system("Failed to sync log segments");
+    }
+  }
+}
+
+// Whatever SQLite holds came before the segments, see open_segment_logs()
+bool Database::scan_logs(LogTable table, const Cursor& after, int64_t to, FunctionRef<bool(const LogEntry&)> each) {
+  bool stopped = false;
+  const bool scanned = query_rows(
+    std::string("SELECT timestamp, id, contents FROM ") + k_log_tables[table] +
+    "_all WHERE timestamp >= ? AND (timestamp, id) > (?, ?) AND timestamp < ? ORDER BY timestamp, id",
+    [&](const Row& row) {
+      stopped = !each({ row.integer(0), row.integer(1), row.text(2) });
+      return !stopped;
+    },
+    after.timestamp,
+    after.timestamp,
+    after.id,
+    to);
+  if (!scanned || stopped) {
+    return scanned;
+  }
+
+  // Ids only go up with timestamps in segments, so the id alone is
+  // enough to resume
+  SegmentLog *segments = m_segment_logs[table].get();
+  return !segments || segments->scan(after.timestamp, to, after.id, [&](const SegmentLog::Record& record) {
+    return each({ record.timestamp, record.id, record.contents });
+  });
+}
+
+bool Database::page_logs(LogTable table,
+                         const Cursor& before,
+                         size_t limit,
+                         std::optional<Cursor>& next,
+                         FunctionRef<bool(const LogEntry&)> each)
+{
+  next.reset();
+  // An empty page, the segments would hand out a record before the count
+  // is checked and the rest would be limit - count past zero
+  if (limit == 0) {
+    return true;
+  }
+
+  size_t count = 0;
+  bool stopped = false;
+  if (SegmentLog *segments = m_segment_logs[table].get()) {
+    Cursor last = before;
+    segments->scan_back(before.timestamp, before.id, [&](const SegmentLog::Record& record) {
+      last = { record.timestamp, record.id };
+      count++;
+      stopped = !each({ record.timestamp, record.id, record.contents });
+      return !stopped && count < limit;
+    });
+    if (count == limit) {
+      next = last;
+    }
+    if (stopped || count == limit) {
+      return true;
+    }
+  }
+
+  return query_page(
+    std::string("SELECT timestamp, id, contents FROM ") + k_log_tables[table] + "_all WHERE 1",
+    "timestamp", before, limit - count, next,
+    [&](const Row& row) {
+      return each({ row.integer(0), row.integer(1), row.text(2) });
+    });
+}
+
+void Database::set_log_retention(std::chrono::hours retention) {
+  m_retention.store(std::chrono::duration_cast<std::chrono::seconds>(retention).count());
+  m_expire.store(true);
+}
+
+void Database::set_change_retention(std::chrono::hours retention) {
+  m_change_retention.store(std::chrono::duration_cast<std::chrono::seconds>(retention).count());
+  m_expire.store(true);
+}
+
+bool Database::load_partitions() {
+  for (size_t table = 0; table < 2; table++) {
+    const std::string prefix = k_log_tables[table];
+    const std::string list =
+      "SELECT name FROM sqlite_master WHERE type = 'table' AND name GLOB '" +
+      prefix + "_[0-9][0-9][0-9][0-9][0-9][0-9][0-9][0-9]'";
+
+    auto add = [](void *context, int, char **values, char **) {
+      const std::string_view name = values[0];
+      tm date = {};
+      if (sscanf(name.data() + name.size() - 8, "%4d%2d%2d", &date.tm_year, &date.tm_mon, &date.tm_mday) == 3) {
+        date.tm_year -= 1900;
+        date.tm_mon -= 1;
+        static_cast<Partitions *>(context)->days.insert(timegm(&date) / k_day);
+      }
+      return 0;
+    };
+
+    if (sqlite3_exec(m_writer.db, list.c_str(), add, &m_partitions[table], nullptr) != SQLITE_OK) {
+      return false;
+    }
+  }
+  return true;
+}
+
+bool Database::create_partition(LogTable table, int64_t day) {
+  const std::string prefix = k_log_tables[table];
+  const std::string name = partition_name(prefix.c_str(), day);
+
+  // Ids carry on from the newest day so they stay unique across the view.
+  // The savepoint keeps readers from seeing the table without the view.
+  const std::string create =
+    "SAVEPOINT partition;"
+    "CREATE TABLE IF NOT EXISTS " + name + "("
+      "id INTEGER NOT NULL PRIMARY KEY AUTOINCREMENT, "
+      "timestamp INTEGER NOT NULL, "
+      "contents TEXT NOT NULL);" +
+    partition_index(name) +
+    "INSERT INTO sqlite_sequence(name, seq) "
+      "SELECT '" + name + "', COALESCE(MAX(seq), 0) FROM sqlite_sequence "
+      "WHERE name = '" + prefix + "' OR name GLOB '" + prefix + "_[0-9]*';";
+  if (sqlite3_exec(m_writer.db, create.c_str(), nullptr, nullptr, nullptr) != SQLITE_OK) {
+    sqlite3_exec(m_writer.db, "ROLLBACK TO partition; RELEASE partition", nullptr, nullptr, nullptr);
+    return false;
+  }
+
+  m_partitions[table].days.insert(day);
+  if (!create_views()) {
+    m_partitions[table].days.erase(day);
+    sqlite3_exec(m_writer.db, "ROLLBACK TO partition; RELEASE partition", nullptr, nullptr, nullptr);
+    return false;
+  }
+  sqlite3_exec(m_writer.db, "RELEASE partition", nullptr, nullptr, nullptr);
+
+  // A new day is when the oldest one may have run out
+  m_expire.store(true);
+  return true;
+}
+
+bool Database::create_views() {
+  for (size_t table = 0; table < 2; table++) {
+    const std::string prefix = k_log_tables[table];
+    const auto& days = m_partitions[table].days;
+
+    std::string view =
+      "DROP VIEW IF EXISTS " + prefix + "_all;"
+      "CREATE VIEW " + prefix + "_all AS SELECT id, timestamp, contents FROM " + prefix;
+    auto day = days.begin();
+    std::advance(day, days.size() - std::min(days.size(), k_max_view_partitions));
+    for (; day != days.end(); ++day) {
+      view += " UNION ALL SELECT id, timestamp, contents FROM " + partition_name(prefix.c_str(), *day);
+    }
+
+    if (sqlite3_exec(m_writer.db, view.c_str(), nullptr, nullptr, nullptr) != SQLITE_OK) {
+      return false;
+    }
+  }
+  return true;
+}
+
+// Consumers further behind than this start over, see oldest_change()
+void Database::expire_changes() {
+  const int64_t retention = m_change_retention.load();
+  if (!retention) {
+    return;
+  }
+  const std::string expire = "DELETE FROM changes WHERE timestamp < " + std::to_string(now() - retention);
+  if (sqlite3_exec(m_writer.db, expire.c_str(), nullptr, nullptr, nullptr) != SQLITE_OK) {
+    log_system(std::string("Failed to expire changes: ") + sqlite3_errmsg(m_writer.db));
+  }
+}
+
+void Database::expire_partitions() {
+  const int64_t retention = m_retention.load();
+  if (!retention) {
+    return;
+  }
+
+  // Only days that ended before the cutoff, the rest may still hold
+  // records worth keeping
+  const int64_t cutoff = now() - retention;
+  for (auto &segments : m_segment_logs) {
+    if (segments) {
+      m_expired_segments += segments->expire(cutoff);
+    }
+  }
+
+  std::string expire = "SAVEPOINT expire;";
+  uint64_t expired = 0;
+  for (size_t table = 0; table < 2; table++) {
+    const std::string prefix = k_log_tables[table];
+    auto& partitions = m_partitions[table];
+    while (!partitions.days.empty() && (*partitions.days.begin() + 1) * k_day <= cutoff) {
+      const int64_t day = *partitions.days.begin();
+      expire += "DROP TABLE IF EXISTS " + partition_name(prefix.c_str(), day) + ";";
+      partitions.days.erase(partitions.days.begin());
+      if (partitions.current == day) {
+        partitions.current = -1;
+      }
+      expired++;
+    }
+
+    // The undivided table shrinks until it's empty
+    expire += "DELETE FROM " + prefix + " WHERE timestamp < " + std::to_string(cutoff) + ";";
+  }
+
+  if (sqlite3_exec(m_writer.db, expire.c_str(), nullptr, nullptr, nullptr) != SQLITE_OK || !create_views()) {
+    // Try again with the next new day
+    sqlite3_exec(m_writer.db, "ROLLBACK TO expire; RELEASE expire", nullptr, nullptr, nullptr);
+    m_partitions[0].days.clear();
+    m_partitions[1].days.clear();
+    load_partitions();
+    return;
+  }
+  sqlite3_exec(m_writer.db, "RELEASE expire", nullptr, nullptr, nullptr);
+  m_expired_partitions += expired;
+
+  if (scalar(m_writer.db, "PRAGMA auto_vacuum") == 2) {
+    m_free_pages = scalar(m_writer.db, "PRAGMA freelist_count");
+  }
+}
+
+bool Database::convert_auto_vacuum(const std::string& name, std::string& error) {
+  sqlite3 *db = nullptr;
+  if (sqlite3_open_v2(name.c_str(), &db, SQLITE_OPEN_READWRITE, nullptr) != SQLITE_OK) {
+    error = db ? sqlite3_errmsg(db) : "out of memory";
+    sqlite3_close(db);
+    return false;
+  }
+
+  bool success = scalar(db, "PRAGMA auto_vacuum") == 2;
+  if (!success) {
+    success = sqlite3_exec(db, "PRAGMA auto_vacuum = INCREMENTAL; VACUUM", nullptr, nullptr, nullptr) == SQLITE_OK;
+    if (!success) {
+      error = sqlite3_errmsg(db);
+    } else if (scalar(db, "PRAGMA auto_vacuum") != 2) {
+      // VACUUM only applies the mode when nothing else has the file open
+      error = "auto_vacuum is unchanged, is the database in use?";
+      success = false;
+    }
+  }
+  sqlite3_close(db);
+  return success;
+}
+
+void Database::vacuum_step() {
+  if (sqlite3_exec(m_writer.db, k_vacuum_step, nullptr, nullptr, nullptr) != SQLITE_OK) {
+    // Locked past the busy deadline, leave the rest for the next expiry
+    m_free_pages = 0;
+    return;
+  }
+  m_free_pages = scalar(m_writer.db, "PRAGMA freelist_count");
+}
+
+bool Database::backup(std::string_view path) {
+  if (path.empty()) {
+    return false;
+  }
+  {
+    std::unique_lock<std::mutex> lock(m_mutex);
+    if (m_backup_state.load() == BackupStatus::RUNNING) {
+      return false;
+    }
+    m_backup_state.store(BackupStatus::RUNNING);
+    m_backup_remaining.store(0);
+    m_backup_total.store(0);
+    m_backup_path = path;
+  }
+  m_condition.notify_one();
+  return true;
+}
+
+void Database::set_backup_rate(int pages, std::chrono::milliseconds interval) {
+  m_backup_pages.store(std::max(pages, 1));
+  m_backup_interval.store(std::chrono::duration_cast<std::chrono::microseconds>(interval).count());
+}
+
+Database::BackupStatus Database::backup_status() const {
+  return {
+    static_cast<BackupStatus::State>(m_backup_state.load()),
+    m_backup_remaining.load(),
+    m_backup_total.load()
+  };
+}
+
+void Database::begin_backup(const std::string& path) {
+  m_backup_target = path;
+
+  // Left over from an interrupted backup
+  const std::string partial = path + ".partial";
+  std::remove(partial.c_str());
+
+  if (!m_writer.db || sqlite3_open(partial.c_str(), &m_backup_db) != SQLITE_OK) {
+    end_backup(SQLITE_CANTOPEN);
+    return;
+  }
+
+  // Never used before it's complete, nothing to roll back to
+  sqlite3_exec(m_backup_db, "PRAGMA journal_mode = OFF", nullptr, nullptr, nullptr);
+
+  // Sharing the writer's connection means our own writes are copied over
+  // as they're made instead of restarting the backup
+  m_backup = sqlite3_backup_init(m_backup_db, "main", m_writer.db, "main");
+  if (!m_backup) {
+    end_backup(sqlite3_errcode(m_backup_db));
+    return;
+  }
+  m_backup_next = std::chrono::steady_clock::now();
+}
+
+void Database::backup_step() {
+  const int result = sqlite3_backup_step(m_backup, m_backup_pages.load());
+  m_backup_remaining.store(sqlite3_backup_remaining(m_backup));
+  m_backup_total.store(sqlite3_backup_pagecount(m_backup));
+
+  // Locked by another process, try again next step
+  if (result == SQLITE_OK || result == SQLITE_BUSY || result == SQLITE_LOCKED) {
+    m_backup_next = std::chrono::steady_clock::now() + std::chrono::microseconds(m_backup_interval.load());
+    return;
+  }
+  end_backup(result);
+}
+
+void Database::end_backup(int result) {
+  if (m_backup) {
+    const int finish = sqlite3_backup_finish(m_backup);
+    if (result == SQLITE_DONE && finish != SQLITE_OK) {
+      result = finish;
+    }
+    m_backup = nullptr;
+  }
+  if (m_backup_db) {
+    sqlite3_close(m_backup_db);
+    m_backup_db = nullptr;
+  }
+
+  const std::string partial = m_backup_target + ".partial";
+  const bool done = result == SQLITE_DONE && std::rename(partial.c_str(), m_backup_target.c_str()) == 0;
+  if (!done) {
+    std::remove(partial.c_str());
+  }
+  m_backup_state.store(done ? BackupStatus::DONE : BackupStatus::FAILED);
+
+  if (done) {
+    log_system("Backed up database to " + m_backup_target);
+  } else {
+    log_system("Failed to back up database to " + m_backup_target + ": " + sqlite3_errstr(result));
+  }
+}
+
+// Database thread
 void Database::database_thread() {
+  std::vector<Task> tasks;
+  std::vector<LogRecord> logs;
+  std::string backup_path;
   for (;;) {
-    std::function<void()> function;
+    const size_t max_batch = m_max_batch.load();
     {
       std::unique_lock<std::mutex> lock(m_mutex);
-      m_condition.wait(lock, [this] {
-          return !m_running.load() || !m_queue.empty();
+
+      // Producers check for this after pushing, see enqueue()
+      m_sleeping.store(true, std::memory_order_relaxed);
+      std::atomic_thread_fence(std::memory_order_seq_cst);
+
+      const auto ready = [this] {
+          return !m_running.load() || !m_tasks.empty() || !m_logs.empty() || !m_backup_path.empty();
+      };
+
+      // Background work runs while there's nothing else, a backup at its
+      // own pace and vacuum once idle for a while
+      bool idle = false;
+      if (m_backup) {
+        idle = !m_condition.wait_until(lock, m_backup_next, ready);
+      } else if (m_free_pages) {
+        idle = !m_condition.wait_for(lock, k_vacuum_idle, ready);
+      } else {
+        m_condition.wait(lock, ready);
+      }
+
+      if (idle) {
+        m_sleeping.store(false, std::memory_order_relaxed);
+        lock.unlock();
+        if (m_backup) {
+          backup_step();
+        } else {
+          vacuum_step();
+        }
+        continue;
+      }
+
+      backup_path.swap(m_backup_path);
+
+      const auto max_delay = std::chrono::microseconds(m_max_delay.load());
+
+      // When nobody is waiting on the result linger a little so more
+      // records can share the commit
+      if (m_tasks.empty() && m_logs.size() < max_batch && max_delay.count() && m_running.load()) {
+        m_condition.wait_for(lock, max_delay, [&] {
+          return !m_running.load() || !m_tasks.empty() || m_logs.size() >= max_batch;
+        });
+      }
+
+      m_sleeping.store(false, std::memory_order_relaxed);
+
+      if (!m_running.load() && m_tasks.empty() && m_logs.empty()) {
+        break;
+      }
+
+      // Records are cheap to batch and bounded by k_max_pending_logs
+      logs.swap(m_logs);
+    }
+
+    Task task;
+    while (tasks.size() < max_batch && m_tasks.pop(task)) {
+      tasks.push_back(task);
+    }
+
+    // Pairs with the fence in enqueue()
+    std::atomic_thread_fence(std::memory_order_seq_cst);
+    if (m_room_waiters.load(std::memory_order_relaxed)) {
+      std::unique_lock<std::mutex> lock(m_mutex);
+      m_room_condition.notify_all();
+    }
+
+    if (!backup_path.empty()) {
+      begin_backup(backup_path);
+      backup_path.clear();
+    }
+
+    run_batch(tasks, logs);
+    tasks.clear();
+    logs.clear();
+
+    // A steady stream of writes mustn't hold the backup up forever
+    if (m_backup && std::chrono::steady_clock::now() >= m_backup_next) {
+      backup_step();
+    }
+  }
+
+  if (m_backup) {
+    end_backup(SQLITE_ABORT);
+  }
+}
+
+// Reader threads
+void Database::reader_thread(Connection& connection) {
+  for (;;) {
+    Read read;
+    if (!m_reads.pop(read)) {
+      std::unique_lock<std::mutex> lock(m_read_mutex);
+
+      // Producers check for sleepers after pushing, see enqueue_read()
+      m_read_sleepers++;
+      std::atomic_thread_fence(std::memory_order_seq_cst);
+
+      m_read_condition.wait(lock, [this] {
+        return !m_reading || !m_reads.empty();
       });
-      if (!m_running.load() && m_queue.empty()) {
+      m_read_sleepers--;
+
+      if (!m_reading && m_reads.empty()) {
         return;
       }
-      function = std::move(m_queue.front());
-      m_queue.pop();
+      continue;
+    }
+
+    // Pairs with the fence in enqueue_read()
+    std::atomic_thread_fence(std::memory_order_seq_cst);
+    if (m_read_room_waiters.load(std::memory_order_relaxed)) {
+      std::unique_lock<std::mutex> lock(m_read_mutex);
+      m_read_room_condition.notify_all();
+    }
+
+    // Only the statement itself can tell whether it writes
+    sqlite3_stmt *statement = connection.create_statement(read.source);
+    if (statement) {
+      const bool read_only = sqlite3_stmt_readonly(statement);
+      if (read.source.statement != k_ad_hoc) {
+        m_statements[read.source.statement].read_only.store(read_only);
+      } else if (!read_only) {
+        const uint64_t hint = write_hint(read.source.expression);
+        m_write_hints[hint % k_write_hints].store(hint, std::memory_order_relaxed);
+      }
+      if (!read_only) {
+        enqueue(read.task);
+        continue;
+      }
     }
-    function();
+
+    read.task.complete(read.task.execute(connection));
   }
 }
@@ -4,64 +4,900 @@
 #include <condition_variable>
 #include <unordered_map>
 #include <string_view>
-#include <functional>
 #include <thread>
+#include <chrono>
 #include <atomic>
 #include <string>
 #include <mutex>
-#include <queue>
-#include <variant>
+#include <list>
+#include <deque>
+#include <set>
+#include <tuple>
+#include <type_traits>
+#include <utility>
+#include <optional>
+#include <vector>
+#include <memory>
 #include <cstdint>
 
 #include <sqlite3.h>
 
+#include "ring.h"
+
+struct SegmentLog;
+
+// Non-owning reference to a callable, lets the non-template halves of
+// Database take lambdas without std::function allocating. The callable
+// has to outlive the reference.
+template<typename Signature>
+struct FunctionRef;
+
+template<typename R, typename... Args>
+struct FunctionRef<R(Args...)>
+{
+  FunctionRef() = default;
+
+  template<typename F, typename = std::enable_if_t<!std::is_same_v<std::decay_t<F>, FunctionRef>>>
+  FunctionRef(F&& function)
+    : m_object { const_cast<void *>(static_cast<const void *>(&function)) }
+    , m_call   { [](void *object, Args... args) -> R {
+                   return (*static_cast<std::remove_reference_t<F> *>(object))(std::forward<Args>(args)...);
+                 } }
+  {
+  }
+
+  R operator()(Args... args) const {
+    return m_call(m_object, std::forward<Args>(args)...);
+  }
+
+private:
+  void *m_object = nullptr;
+  R (*m_call)(void *, Args...) = nullptr;
+};
+
 struct Database {
-  Database();
+  // Read only queries are spread over this many connections of their own,
+  // each with a thread. Zero runs everything on the writer.
+  Database(size_t readers = k_default_readers);
   ~Database();
 
-  typedef std::variant<bool, int64_t, std::string> Variant;
+  static constexpr size_t k_default_readers = 4;
 
   bool open(std::string_view name);
   bool create(std::string_view name);
 
-  // Thread safe
+  // PRAGMA user_version both leave the file at, older files are migrated
+  static int schema_version();
+
+  // Storage profiles, chosen by configuration.storage_profile and applied
+  // to every connection on open. Only durable survives power loss with
+  // every commit, balanced may lose the last few but never corrupts and
+  // throughput can corrupt the file if the host goes down mid-write.
+  struct Tuning
+  {
+    const char *name;
+    const char *synchronous;
+    int64_t cache_size; // KiB per connection
+    int64_t mmap_size; // Bytes per connection
+    const char *temp_store;
+    int checkpoint_pages; // WAL size that triggers a checkpoint
+  };
+
+  static constexpr Tuning k_tunings[] = {
+    { "durable",    "FULL",   8 * 1024,   0,                    "DEFAULT", 1000 },
+    { "balanced",   "NORMAL", 32 * 1024,  256ll * 1024 * 1024,  "MEMORY",  1000 },
+    { "throughput", "OFF",    128 * 1024, 1024ll * 1024 * 1024, "MEMORY",  10000 },
+  };
+
+  static constexpr size_t k_default_tuning = 1;
+
+  static const Tuning *find_tuning(std::string_view name);
+
+  // The profile the database was opened with
+  const Tuning& tuning() const { return k_tunings[m_tuning]; }
+
+  // Thread safe and non-blocking, records are queued for the database
+  // thread to write. Returns false when the record had to be dropped
+  // because k_max_pending_logs are already queued.
   bool log_http(const std::string& contents);
   bool log_system(const std::string& contents);
 
-  // Thread safe
-  std::optional<std::vector<Database::Variant>> query(
-    const std::string& expression,
-    const char *rd_spec = nullptr,
-    const char *wr_spec = nullptr,
-    ...
-  );
+  enum LogTable { HTTP_LOGS, SYSTEM_LOGS };
+
+  // Where log_http() and log_system() records are kept, chosen by
+  // configuration.log_storage on open. Segments are append only files
+  // next to the database (see SegmentLog), cheaper to write and to expire
+  // but only read through scan_logs() and page_logs(), which also cover
+  // the records SQLite held from before the switch.
+  enum LogStorage { SQLITE_STORAGE, SEGMENT_STORAGE };
+  static constexpr const char *k_log_storages[] = { "sqlite", "segments" };
+
+  LogStorage log_storage() const { return m_log_storage; }
+
+  // Whether chunk_search exists and can be used, decided on open. Without
+  // FTS5 and its trigram tokenizer the server runs without log search.
+  bool search_enabled() const { return m_search; }
+
+  // Writes queued together are grouped into one transaction, at most
+  // max_batch tasks to a group. When only log records are queued the
+  // database thread waits up to max_delay for more to share the commit.
+  void set_batching(size_t max_batch, std::chrono::microseconds max_delay);
+
+  // Records dropped on overflow since the database was created
+  uint64_t dropped_logs() const { return m_dropped_logs.load(); }
+
+  // Log records go to one table per UTC day, http_logs_YYYYMMDD and
+  // system_logs_YYYYMMDD, read back through the http_logs_all and
+  // system_logs_all views. Days that ended more than retention ago are
+  // dropped whole, zero keeps everything. Freed pages are handed back to
+  // the file a few at a time while the database thread is idle.
+  void set_log_retention(std::chrono::hours retention);
+
+  // Files from before log partitioning keep freed pages on the freelist
+  // until one full VACUUM switches them to incremental auto_vacuum. That
+  // rewrites the whole file and holds it locked, so it's a one-off admin
+  // action (kaizen --vacuum) on a database nothing else has open rather
+  // than something open() does. Errors go to error, true when the file
+  // already was or now is incremental.
+  static bool convert_auto_vacuum(const std::string& name, std::string& error);
+
+  // Lock contention (checkpoints, backups, an external sqlite3 shell) is
+  // waited out with exponential backoff, starting at initial and doubling
+  // up to max_delay per retry. Once deadline has passed the statement
+  // fails with SQLITE_BUSY.
+  void set_busy_backoff(std::chrono::microseconds initial,
+                        std::chrono::microseconds max_delay,
+                        std::chrono::milliseconds deadline);
+
+  // Copies the database to path while it stays in use, a few pages at a
+  // time between write batches on the database thread so the writer is
+  // never stalled and the copy never has to restart. Written next to path
+  // and renamed into place once complete. False when a backup is already
+  // running.
+  bool backup(std::string_view path);
+
+  // At most pages per step, with interval between steps
+  void set_backup_rate(int pages, std::chrono::milliseconds interval);
+
+  struct BackupStatus
+  {
+    enum State { IDLE, RUNNING, DONE, FAILED } state;
+    int remaining; // Pages left to copy, once started
+    int total;
+  };
+
+  BackupStatus backup_status() const;
+
+  // Row changes to projects, configurations, builds and build_logs are
+  // recorded by triggers in the changes table, in the same transaction as
+  // the change and whichever process makes it. Sequences only go up so
+  // a consumer keeps the last one it saw and asks for what came after.
+  struct Change
+  {
+    int64_t sequence;
+    int64_t timestamp;
+    std::string_view table;
+    int64_t row; // id of the changed row
+    std::string_view operation; // insert, update or delete
+  };
+
+  // Thread safe, in sequence order and at most limit
+  bool changes(int64_t after, size_t limit, FunctionRef<bool(const Change&)> each);
+
+  // Waits up to timeout for a change after sequence, false when there
+  // was none. Commits through this Database wake waiters immediately,
+  // those of other processes are noticed within a second.
+  bool wait_changes(int64_t after, std::chrono::milliseconds timeout);
+
+  int64_t last_change() const { return m_last_change.load(); }
+
+  // Changes older than retention are dropped, zero keeps everything. A
+  // consumer whose last sequence is below oldest_change() has to start
+  // over with a full read.
+  void set_change_retention(std::chrono::hours retention);
+  std::optional<int64_t> oldest_change();
+
+  // Counters for monitoring, since the database was created
+  struct Stats
+  {
+    uint64_t dropped_logs;
+    uint64_t busy_retries; // Backoffs slept on a locked database
+    uint64_t busy_timeouts; // Statements given up on at the deadline
+    uint64_t expired_partitions; // Days of log records dropped by retention
+    uint64_t expired_segments; // Segment files dropped by retention
+  };
+
+  Stats stats() const;
+
+  static constexpr size_t k_histogram_buckets = 24;
+
+  // What every statement run on any connection has cost, merged by SQL.
+  // Counters come from sqlite3_stmt_status and time runs from preparing
+  // or reusing the statement to its reset, less time query_rows() spent
+  // waiting on its caller.
+  struct Profile
+  {
+    std::string expression;
+    uint64_t count = 0;
+    uint64_t rows = 0; // Result rows stepped
+    uint64_t total = 0; // Microseconds
+    uint64_t max = 0;
+    uint64_t fullscan_steps = 0;
+    uint64_t sorts = 0;
+    uint64_t autoindexes = 0;
+    uint64_t vm_steps = 0;
+    // Runs by latency, bucket i holds those under 2^i microseconds and
+    // the last everything slower
+    uint64_t histogram[k_histogram_buckets] = {};
+    std::string plan; // EXPLAIN QUERY PLAN from the last slow run
+
+    // Upper bound in microseconds of the bucket reaching fraction of runs
+    uint64_t percentile(double fraction) const;
+  };
+
+  // Thread safe, statements that never ran since the last reset are left out
+  std::vector<Profile> profile();
+  void reset_profile();
+
+  // Statements taking threshold or longer are logged to the system log
+  // with their query plan and kept in slow_queries(), zero disables
+  void set_slow_query(std::chrono::milliseconds threshold);
+
+  struct SlowQuery
+  {
+    int64_t timestamp;
+    uint64_t duration; // Microseconds
+    std::string expression;
+    std::string plan;
+  };
+
+  // Thread safe, the last k_slow_queries, oldest first
+  std::vector<SlowQuery> slow_queries() const;
+
+  static constexpr size_t k_slow_queries = 64;
+
+  // Distinct SQL profiled per connection, beyond this new SQL goes
+  // unprofiled until the connection is closed
+  static constexpr size_t k_max_profiles = 1024;
+
+  static constexpr size_t k_max_pending_logs = 4096;
+
+  // Handle to a statement registered with prepare(). Queries through a
+  // handle skip hashing the SQL and each connection prepares it only once.
+  struct Statement
+  {
+    size_t index;
+  };
+
+  // Thread safe, nullopt once k_max_statements are registered. Meant for
+  // the fixed set of hot queries, ad-hoc SQL goes through a bounded cache
+  // of k_statement_cache statements per connection instead.
+  std::optional<Statement> prepare(std::string_view expression);
+
+  static constexpr size_t k_max_statements = 128;
+  static constexpr size_t k_statement_cache = 64;
+
+  // Queries in flight per queue before callers wait for room
+  static constexpr size_t k_max_queued = 1024;
+
+  // Thread safe, read only statements run on the reader pool and
+  // everything else on the writer. Parameters are bound in order and the
+  // first row is read into Results, with no Results the statement has to
+  // run to completion instead. Supported types are integers, bool, double,
+  // std::string, std::string_view (parameters only), const char* and
+  // std::optional of those for NULL.
+  //
+  //   auto row = db.query<int64_t, std::string>("SELECT id, name FROM projects WHERE id = ?", id);
+  template<typename... Results, typename... Params>
+  std::optional<std::tuple<Results...>> query(const std::string& expression, const Params&... params);
+  template<typename... Results, typename... Params>
+  std::optional<std::tuple<Results...>> query(Statement statement, const Params&... params);
+
+  // Runs an INSERT to completion, returning the rowid of the new row
+  template<typename... Params>
+  std::optional<int64_t> insert(const std::string& expression, const Params&... params);
+
+  // Thread safe, runs body on the writer inside a savepoint of the write
+  // batch so whatever it does through the Writer commits or is undone as
+  // one. False when body returned false or a statement failed. body runs
+  // on the database thread and must not query the database otherwise.
+  //
+  //   db.transaction([&](Database::Writer& writer) {
+  //     const auto id = writer.insert("INSERT INTO ...", ...);
+  //     return id && writer.execute("INSERT INTO ...", *id);
+  //   });
+  struct Writer;
+  bool transaction(FunctionRef<bool(Writer&)> body);
+
+  // Binds as a BLOB rather than TEXT, parameters only
+  struct Blob
+  {
+    std::string_view data;
+  };
+
+  // One result row, only valid for the duration of the callback it was
+  // passed to. Text points into the batch the row was copied into so
+  // nothing is allocated per cell. Accessors don't convert between types,
+  // a column of another type reads as 0 or empty.
+  struct Row
+  {
+    struct Cell
+    {
+      int type;
+      int64_t integer;
+      double real;
+      size_t offset;
+      size_t length;
+    };
+
+    size_t columns() const { return m_columns; }
+    bool null(size_t column) const;
+    int64_t integer(size_t column) const;
+    double real(size_t column) const;
+    std::string_view text(size_t column) const;
+
+  private:
+    friend struct Database;
+    Row(const Cell *cells, const char *text, size_t columns);
+    const Cell *m_cells;
+    const char *m_text;
+    size_t m_columns;
+  };
+
+  // Thread safe, streams every result row to each() on the calling thread.
+  // Rows are copied out in batches on a database thread which keeps going
+  // while the caller works through them. Once k_max_pending_batches wait
+  // for it the caller has k_deliver_timeout to take one, or the statement
+  // is abandoned and this returns false, so a slow caller can't hold on
+  // to a connection. Return false from each() to stop early. each() must
+  // not query the database itself, the connection it's waiting on may be
+  // the one it needs.
+  template<typename Each, typename... Params>
+  bool query_rows(const std::string& expression, Each&& each, const Params&... params);
+  template<typename Each, typename... Params>
+  bool query_rows(Statement statement, Each&& each, const Params&... params);
+
+  // Position in a listing ordered newest first by (timestamp, id). The
+  // next page seeks past the last row of this one with a range scan of an
+  // index on the timestamp, so page N costs what page 1 does where OFFSET
+  // would step over every row before it. The default is the first page.
+  struct Cursor
+  {
+    int64_t timestamp = INT64_MAX;
+    int64_t id = INT64_MAX;
+
+    // Opaque and URL safe, for handing to clients
+    std::string encode() const;
+    static std::optional<Cursor> decode(std::string_view token);
+  };
+
+  // Thread safe, streams one page of at most limit rows to each(). The
+  // expression selects the timestamp and id columns first and ends in a
+  // WHERE clause the seek is ANDed onto, ORDER BY and LIMIT are appended.
+  // Without a timestamp column the listing is by id alone, selected
+  // first. It wants an index on the filtered columns followed by the
+  // timestamp, SQLite adds the rowid id to every index. next is set
+  // to the cursor after the last row when the page came back full.
+  //
+  //   db.query_page("SELECT start_timestamp, id, status FROM builds WHERE project_id = ?",
+  //                 "start_timestamp", after, 50, next, each, project);
+  template<typename Each, typename... Params>
+  bool query_page(const std::string& expression,
+                  const char *timestamp,
+                  const Cursor& after,
+                  size_t limit,
+                  std::optional<Cursor>& next,
+                  Each&& each,
+                  const Params&... params);
+
+  // A record of log_http() or log_system()
+  struct LogEntry
+  {
+    int64_t timestamp;
+    int64_t id;
+    std::string_view contents; // Only valid in the callback
+  };
+
+  // Records of table after the cursor and before to, oldest first by
+  // (timestamp, id), from whichever storage holds them. Starting at
+  // Cursor{ from, 0 } takes every record from then on.
+  bool scan_logs(LogTable table, const Cursor& after, int64_t to, FunctionRef<bool(const LogEntry&)> each);
+
+  // One page of records of table before the cursor, newest first like
+  // query_page() and across both storages the same way
+  bool page_logs(LogTable table,
+                 const Cursor& before,
+                 size_t limit,
+                 std::optional<Cursor>& next,
+                 FunctionRef<bool(const LogEntry&)> each);
+
+  // Rows or bytes of text in a batch before it's handed to the caller
+  static constexpr size_t k_batch_rows = 256;
+  static constexpr size_t k_batch_bytes = 64 * 1024;
+  static constexpr size_t k_max_pending_batches = 16;
+  static constexpr std::chrono::milliseconds k_deliver_timeout{ 1000 };
 
 private:
-  bool log(const std::string& table, const std::string& contents);
+  struct LogRecord
+  {
+    LogTable table;
+    int64_t timestamp;
+    std::string contents;
+  };
+
+  // What a query runs, a registered statement or ad-hoc SQL
+  struct Source
+  {
+    std::string_view expression;
+    size_t statement;
+  };
+
+  static constexpr size_t k_ad_hoc = SIZE_MAX;
+
+  Source source(std::string_view expression) const;
+  Source source(Statement statement) const;
+
+  // One SQLite connection, only ever used by the thread that owns it
+  struct Connection
+  {
+    ~Connection();
+
+    // Prepared statements are cached, we just reset and clear bindings
+    // for reuse.
+    sqlite3_stmt *create_statement(const Source& source);
+    bool complete_statement(sqlite3_stmt *statement, int type);
+    int step(sqlite3_stmt *statement);
+    bool execute(const Source& source);
+
+    // Records the run of the statement last created into its profile and
+    // resets it
+    void finish_statement(sqlite3_stmt *statement);
+
+    sqlite3 *db = nullptr;
+
+    // For the busy handler
+    Database *owner = nullptr;
+    std::chrono::steady_clock::time_point busy_since;
+
+    // Registered statements indexed by handle, prepared on first use
+    std::vector<sqlite3_stmt*> statements;
+    std::vector<Profile*> statement_profiles;
+
+    // Ad-hoc statements, most recently used first. Keys are views of the
+    // expressions in the list so lookups don't allocate.
+    struct Cached
+    {
+      std::string expression;
+      sqlite3_stmt *statement;
+      Profile *profile;
+    };
+    std::list<Cached> recent;
+    std::unordered_map<std::string_view, std::list<Cached>::iterator> cache;
+
+    // Only the owning thread records, profile() reads under the mutex.
+    // Nodes never move so statements keep pointers to theirs.
+    Profile *profile_for(std::string_view expression);
+    std::mutex profile_mutex;
+    std::unordered_map<std::string, Profile> profiles;
+
+    // The statement being run
+    struct Active
+    {
+      Profile *profile = nullptr;
+      std::chrono::steady_clock::time_point started;
+      std::chrono::steady_clock::duration paused{};
+      uint64_t rows = 0;
+    } active;
+  };
+
+  bool log(LogTable table, const std::string& contents);
+  void write_logs(std::vector<LogRecord>& records);
+
+  // Day tables of one LogTable, only touched by the database thread once
+  // the database is open
+  struct Partitions
+  {
+    std::set<int64_t> days; // Since the epoch
+    int64_t current = -1;
+    std::string insert; // Into the current day
+  };
+
+  bool load_partitions();
+  bool create_partition(LogTable table, int64_t day);
+  bool create_views();
+  bool open_segment_logs(std::string_view name, bool configured);
+  void sync_segment_logs();
+  void expire_partitions();
+  void expire_changes();
+  void vacuum_step();
+
+  void publish_changes(int64_t last);
+
+  void record_slow(Connection& connection, Profile *profile, const char *expression, uint64_t duration);
+
+  void begin_backup(const std::string& path);
+  void backup_step();
+  void end_backup(int result);
+
+  // Work for the database threads. Writes run inside a group transaction
+  // and are completed once it has committed or rolled back. Both refer
+  // to state on the stack of the caller, which waits for completion.
+  struct Task
+  {
+    FunctionRef<bool(Connection&)> execute;
+    FunctionRef<void(bool committed)> complete;
+  };
+
+  void run_batch(std::vector<Task>& tasks, std::vector<LogRecord>& logs);
 
   // Threaded function for the database
   void database_thread();
   bool create_tables();
+  bool migrate(int& version); // Sets the version migrated from
+  bool open_readers(std::string_view name);
+  void attach(Connection& connection);
+  static int busy(void *context, int count);
+
+  Connection m_writer;
+
+  // Read only connections, they see the last commit thanks to WAL
+  struct Reader
+  {
+    Connection connection;
+    std::thread thread;
+  };
+
+  struct Read
+  {
+    Source source;
+    Task task;
+  };
+
+  // Non-template halves of query() and query_rows()
+  typedef FunctionRef<bool(sqlite3_stmt*)> Binder;
+  bool run(const Source& source,
+           Binder bind,
+           FunctionRef<void(sqlite3_stmt*)> read,
+           int type);
+  bool run_rows(const Source& source,
+                Binder bind,
+                FunctionRef<bool(const Row&)> each);
+
+  template<typename... Results, typename... Params>
+  std::optional<std::tuple<Results...>> fetch(const Source& source, const Params&... params);
+
+  static std::string page_expression(const std::string& expression, const char *timestamp);
+
+  template<typename T>
+  static bool bind(sqlite3_stmt *statement, int index, const T& value);
+  template<typename T>
+  static T column(sqlite3_stmt *statement, int index);
+  template<size_t... I, typename... Params>
+  static bool bind_all(sqlite3_stmt *statement, std::index_sequence<I...>, const Params&... params);
+  template<typename... Results, size_t... I>
+  static std::tuple<Results...> columns(sqlite3_stmt *statement, std::index_sequence<I...>);
+
+  void reader_thread(Connection& connection);
+  void enqueue_read(const Read& read);
+  void dispatch(const Source& source, const Task& task);
+
+  struct Batch
+  {
+    void clear();
+    size_t rows = 0;
+    std::vector<Row::Cell> cells;
+    std::string text;
+  };
+
+  size_t m_reader_count;
+  size_t m_tuning; // Into k_tunings
+  std::vector<std::unique_ptr<Reader>> m_readers; // Filled once on open
+  std::atomic_bool m_has_readers;
+  Ring<Read, k_max_queued> m_reads;
+  // Readers only take the mutex to sleep, producers only when one is or
+  // when the ring is full
+  std::mutex m_read_mutex;
+  std::condition_variable m_read_condition;
+  std::atomic<size_t> m_read_sleepers;
+  std::condition_variable m_read_room_condition;
+  std::atomic<size_t> m_read_room_waiters;
+  bool m_reading; // Guarded by m_read_mutex
 
-  sqlite3 *m_db;
+  // Hashes of ad-hoc SQL a reader found to write, so it goes straight to
+  // the writer next time. A collision only evicts, at worst a write is
+  // tried on a reader once more.
+  static constexpr size_t k_write_hints = 256;
+  std::atomic<uint64_t> m_write_hints[k_write_hints] = {};
 
-  // Statement cache for common prepared statements, we just reset and
-  // clear bindings for reuse.
-  sqlite3_stmt *create_statement(std::string_view contents);
-  bool complete_statement(sqlite3_stmt *statement, int type);
-  std::unordered_map<std::string, sqlite3_stmt*> m_statement_cache;
+  // Registered statements, entries never move once counted
+  struct Registered
+  {
+    std::string expression;
+    std::atomic<int> read_only{ -1 }; // Unknown until a reader prepared it
+  };
 
-  // Enqueued tasks to run on the SQLite3 thread
+  std::mutex m_statement_mutex;
+  std::unique_ptr<Registered[]> m_statements;
+  std::atomic<size_t> m_statement_count;
+
+  // Used by every write batch
+  Statement m_begin;
+  Statement m_commit;
+  Statement m_rollback;
+  Statement m_last_sequence;
+
+  // Used by transaction()
+  Statement m_savepoint;
+  Statement m_release;
+  Statement m_rollback_savepoint;
+
+  // Enqueued tasks to run on the SQLite3 thread. The thread only takes
+  // the mutex to sleep, producers only when it is or when the ring is
+  // full.
   std::mutex m_mutex;
   std::condition_variable m_condition;
   std::atomic_bool m_running;
-  std::queue<std::function<void()>> m_queue;
+  std::atomic_bool m_sleeping;
+  std::condition_variable m_room_condition;
+  std::atomic<size_t> m_room_waiters;
+  Ring<Task, k_max_queued> m_tasks;
+  std::vector<bool> m_results; // Only touched by the database thread
+  std::atomic<size_t> m_max_batch;
+  std::atomic<int64_t> m_max_delay; // Microseconds
+
+  // Fire and forget log records, bounded
+  std::vector<LogRecord> m_logs;
+  std::atomic<uint64_t> m_dropped_logs;
+
+  // Busy backoff, in microseconds
+  std::atomic<int64_t> m_busy_initial;
+  std::atomic<int64_t> m_busy_max_delay;
+  std::atomic<int64_t> m_busy_deadline;
+  std::atomic<uint64_t> m_busy_retries;
+  std::atomic<uint64_t> m_busy_timeouts;
+  uint64_t m_reported_drops; // Only touched by the database thread
+
+  // Log partitioning and retention
+  Partitions m_partitions[2]; // Indexed by LogTable
+  std::atomic<int64_t> m_retention; // Seconds
+  std::atomic_bool m_expire; // Retention is due to be applied
+  std::atomic<uint64_t> m_expired_partitions;
+
+  // Log records in segments instead, both tables or neither. Opened with
+  // the database and then only appended to by the database thread.
+  LogStorage m_log_storage;
+  std::unique_ptr<SegmentLog> m_segment_logs[2]; // Indexed by LogTable
+  bool m_search; // Set on open
+  std::chrono::steady_clock::time_point m_segments_synced; // Database thread only
+  std::atomic<uint64_t> m_expired_segments;
+  int64_t m_free_pages; // Left for incremental vacuum, database thread only
+
+  // Slow query log
+  std::atomic<int64_t> m_slow_query; // Microseconds
+  mutable std::mutex m_slow_mutex;
+  std::deque<SlowQuery> m_slow_queries; // Guarded by m_slow_mutex
+
+  // Last change sequence known to be committed
+  std::atomic<int64_t> m_last_change;
+  std::atomic<int64_t> m_change_retention; // Seconds
+  std::mutex m_change_mutex;
+  std::condition_variable m_change_condition;
+
+  // Online backup, requested through m_backup_path and then run by the
+  // database thread
+  std::string m_backup_path; // Guarded by m_mutex
+  std::string m_backup_target;
+  sqlite3 *m_backup_db;
+  sqlite3_backup *m_backup;
+  std::chrono::steady_clock::time_point m_backup_next;
+  std::atomic<int> m_backup_pages;
+  std::atomic<int64_t> m_backup_interval; // Microseconds
+  std::atomic<int> m_backup_state; // BackupStatus::State
+  std::atomic<int> m_backup_remaining;
+  std::atomic<int> m_backup_total;
 
   // Needs to be the last thing initialized because the thread depends
   // on the objects above to be initialized.
   std::thread m_thread;
 
-  void enqueue(std::function<void()> &&function);
+  void enqueue(const Task& task);
+};
+
+// Statements of one Database::transaction(), on the writer connection
+struct Database::Writer
+{
+  // Like Database::insert() and query() without results
+  template<typename... Params>
+  std::optional<int64_t> insert(const std::string& expression, const Params&... params);
+  template<typename... Params>
+  bool execute(const std::string& expression, const Params&... params);
+
+private:
+  friend struct Database;
+  Writer(Database& db, Connection& connection);
+
+  bool run(const std::string& expression, Binder bind, int64_t *rowid);
+
+  Database& m_db;
+  Connection& m_connection;
 };
 
+template<typename... Params>
+inline std::optional<int64_t> Database::Writer::insert(const std::string& expression, const Params&... params) {
+  int64_t rowid = 0;
+  const bool success = run(
+    expression,
+    [&](sqlite3_stmt *statement) {
+      return bind_all(statement, std::index_sequence_for<Params...>{}, params...);
+    },
+    &rowid);
+  if (!success) {
+    return std::nullopt;
+  }
+  return rowid;
+}
+
+template<typename... Params>
+inline bool Database::Writer::execute(const std::string& expression, const Params&... params) {
+  return run(
+    expression,
+    [&](sqlite3_stmt *statement) {
+      return bind_all(statement, std::index_sequence_for<Params...>{}, params...);
+    },
+    nullptr);
+}
+
+template<typename T>
+inline bool Database::bind(sqlite3_stmt *statement, int index, const T& value) {
+  if constexpr (std::is_same_v<T, bool>) {
+    return sqlite3_bind_int(statement, index, value ? 1 : 0) == SQLITE_OK;
+  } else if constexpr (std::is_integral_v<T> || std::is_enum_v<T>) {
+    return sqlite3_bind_int64(statement, index, static_cast<sqlite3_int64>(value)) == SQLITE_OK;
+  } else if constexpr (std::is_floating_point_v<T>) {
+    return sqlite3_bind_double(statement, index, value) == SQLITE_OK;
+  } else if constexpr (std::is_convertible_v<const T&, std::string_view>) {
+    // The caller waits on the query so the text outlives the statement
+    const std::string_view text = value;
+    return sqlite3_bind_text(statement, index, text.data(), text.size(), SQLITE_STATIC) == SQLITE_OK;
+  } else if constexpr (std::is_same_v<T, Blob>) {
+    return sqlite3_bind_blob(statement, index, value.data.data(), value.data.size(), SQLITE_STATIC) == SQLITE_OK;
+  } else if constexpr (std::is_same_v<T, std::nullopt_t>) {
+    return sqlite3_bind_null(statement, index) == SQLITE_OK;
+  } else {
+    // Anything else has to be an optional
+    if (!value) {
+      return sqlite3_bind_null(statement, index) == SQLITE_OK;
+    }
+    return bind(statement, index, *value);
+  }
+}
+
+template<typename T>
+inline T Database::column(sqlite3_stmt *statement, int index) {
+  if constexpr (std::is_same_v<T, bool>) {
+    return sqlite3_column_int64(statement, index) != 0;
+  } else if constexpr (std::is_integral_v<T> || std::is_enum_v<T>) {
+    return static_cast<T>(sqlite3_column_int64(statement, index));
+  } else if constexpr (std::is_floating_point_v<T>) {
+    return static_cast<T>(sqlite3_column_double(statement, index));
+  } else if constexpr (std::is_same_v<T, std::string>) {
+    const auto *text = reinterpret_cast<const char *>(sqlite3_column_text(statement, index));
+    return text ? std::string(text, sqlite3_column_bytes(statement, index)) : std::string();
+  } else {
+    // Anything else has to be an optional
+    if (sqlite3_column_type(statement, index) == SQLITE_NULL) {
+      return std::nullopt;
+    }
+    return column<typename T::value_type>(statement, index);
+  }
+}
+
+template<size_t... I, typename... Params>
+inline bool Database::bind_all([[maybe_unused]] sqlite3_stmt *statement,
+                               std::index_sequence<I...>,
+                               const Params&... params)
+{
+  return (bind(statement, I + 1, params) && ...);
+}
+
+template<typename... Results, size_t... I>
+inline std::tuple<Results...> Database::columns([[maybe_unused]] sqlite3_stmt *statement,
+                                                std::index_sequence<I...>)
+{
+  return std::tuple<Results...>(column<Results>(statement, I)...);
+}
+
+template<typename... Results, typename... Params>
+inline std::optional<std::tuple<Results...>> Database::query(const std::string& expression, const Params&... params) {
+  return fetch<Results...>(source(expression), params...);
+}
+
+template<typename... Results, typename... Params>
+inline std::optional<std::tuple<Results...>> Database::query(Statement statement, const Params&... params) {
+  return fetch<Results...>(source(statement), params...);
+}
+
+template<typename... Results, typename... Params>
+inline std::optional<std::tuple<Results...>> Database::fetch(const Source& source, const Params&... params) {
+  std::tuple<Results...> results;
+  const bool success = run(
+    source,
+    [&](sqlite3_stmt *statement) {
+      return bind_all(statement, std::index_sequence_for<Params...>{}, params...);
+    },
+    [&](sqlite3_stmt *statement) {
+      results = columns<Results...>(statement, std::index_sequence_for<Results...>{});
+    },
+    sizeof...(Results) ? SQLITE_ROW : SQLITE_DONE);
+  if (!success) {
+    return std::nullopt;
+  }
+  return results;
+}
+
+template<typename... Params>
+inline std::optional<int64_t> Database::insert(const std::string& expression, const Params&... params) {
+  int64_t rowid = 0;
+  const bool success = run(
+    source(expression),
+    [&](sqlite3_stmt *statement) {
+      return bind_all(statement, std::index_sequence_for<Params...>{}, params...);
+    },
+    [&](sqlite3_stmt *statement) {
+      rowid = sqlite3_last_insert_rowid(sqlite3_db_handle(statement));
+    },
+    SQLITE_DONE);
+  if (!success) {
+    return std::nullopt;
+  }
+  return rowid;
+}
+
+template<typename Each, typename... Params>
+inline bool Database::query_rows(const std::string& expression, Each&& each, const Params&... params) {
+  return run_rows(
+    source(expression),
+    [&](sqlite3_stmt *statement) {
+      return bind_all(statement, std::index_sequence_for<Params...>{}, params...);
+    },
+    each);
+}
+
+template<typename Each, typename... Params>
+inline bool Database::query_rows(Statement statement, Each&& each, const Params&... params) {
+  return run_rows(
+    source(statement),
+    [&](sqlite3_stmt *statement) {
+      return bind_all(statement, std::index_sequence_for<Params...>{}, params...);
+    },
+    each);
+}
+
+template<typename Each, typename... Params>
+inline bool Database::query_page(const std::string& expression,
+                                 const char *timestamp,
+                                 const Cursor& after,
+                                 size_t limit,
+                                 std::optional<Cursor>& next,
+                                 Each&& each,
+                                 const Params&... params)
+{
+  size_t rows = 0;
+  Cursor last;
+  auto page = [&](const Row& row) {
+    rows++;
+    last = timestamp ? Cursor{ row.integer(0), row.integer(1) } : Cursor{ 0, row.integer(0) };
+    return each(row);
+  };
+
+  const auto count = static_cast<int64_t>(limit);
+  const bool queried = timestamp
+    ? query_rows(page_expression(expression, timestamp), page, params..., after.timestamp, after.id, count)
+    : query_rows(page_expression(expression, timestamp), page, params..., after.id, count);
+
+  // A short page is the last one
+  next = queried && limit && rows == limit ? std::optional<Cursor>(last) : std::nullopt;
+  return queried;
+}
+
 #endif
@@ -0,0 +1,476 @@
+#include <algorithm> // std::min
+
+#include "hpack.h"
+
+// RFC 7541 Appendix A
+static const std::pair<std::string_view, std::string_view> k_static_table[] = {
+  { ":authority", "" },
+  { ":method", "GET" },
+  { ":method", "POST" },
+  { ":path", "/" },
+  { ":path", "/index.html" },
+  { ":scheme", "http" },
+  { ":scheme", "https" },
+  { ":status", "200" },
+  { ":status", "204" },
+  { ":status", "206" },
+  { ":status", "304" },
+  { ":status", "400" },
+  { ":status", "404" },
+  { ":status", "500" },
+  { "accept-charset", "" },
+  { "accept-encoding", "gzip, deflate" },
+  { "accept-language", "" },
+  { "accept-ranges", "" },
+  { "accept", "" },
+  { "access-control-allow-origin", "" },
+  { "age", "" },
+  { "allow", "" },
+  { "authorization", "" },
+  { "cache-control", "" },
+  { "content-disposition", "" },
+  { "content-encoding", "" },
+  { "content-language", "" },
+  { "content-length", "" },
+  { "content-location", "" },
+  { "content-range", "" },
+  { "content-type", "" },
+  { "cookie", "" },
+  { "date", "" },
+  { "etag", "" },
+  { "expect", "" },
+  { "expires", "" },
+  { "from", "" },
+  { "host", "" },
+  { "if-match", "" },
+  { "if-modified-since", "" },
+  { "if-none-match", "" },
+  { "if-range", "" },
+  { "if-unmodified-since", "" },
+  { "last-modified", "" },
+  { "link", "" },
+  { "location", "" },
+  { "max-forwards", "" },
+  { "proxy-authenticate", "" },
+  { "proxy-authorization", "" },
+  { "range", "" },
+  { "referer", "" },
+  { "refresh", "" },
+  { "retry-after", "" },
+  { "server", "" },
+  { "set-cookie", "" },
+  { "strict-transport-security", "" },
+  { "transfer-encoding", "" },
+  { "user-agent", "" },
+  { "vary", "" },
+  { "via", "" },
+  { "www-authenticate", "" },
+};
+
+static constexpr size_t k_static_size = sizeof k_static_table / sizeof *k_static_table;
+
+// RFC 7541 Appendix B, indexed by symbol, 256 is EOS
+static const struct { uint32_t code; uint8_t bits; } k_huffman[257] = {
+  { 0x1ff8, 13 }, { 0x7fffd8, 23 }, { 0xfffffe2, 28 }, { 0xfffffe3, 28 },
+  { 0xfffffe4, 28 }, { 0xfffffe5, 28 }, { 0xfffffe6, 28 }, { 0xfffffe7, 28 },
+  { 0xfffffe8, 28 }, { 0xffffea, 24 }, { 0x3ffffffc, 30 }, { 0xfffffe9, 28 },
+  { 0xfffffea, 28 }, { 0x3ffffffd, 30 }, { 0xfffffeb, 28 }, { 0xfffffec, 28 },
+  { 0xfffffed, 28 }, { 0xfffffee, 28 }, { 0xfffffef, 28 }, { 0xffffff0, 28 },
+  { 0xffffff1, 28 }, { 0xffffff2, 28 }, { 0x3ffffffe, 30 }, { 0xffffff3, 28 },
+  { 0xffffff4, 28 }, { 0xffffff5, 28 }, { 0xffffff6, 28 }, { 0xffffff7, 28 },
+  { 0xffffff8, 28 }, { 0xffffff9, 28 }, { 0xffffffa, 28 }, { 0xffffffb, 28 },
+  { 0x14, 6 }, { 0x3f8, 10 }, { 0x3f9, 10 }, { 0xffa, 12 },
+  { 0x1ff9, 13 }, { 0x15, 6 }, { 0xf8, 8 }, { 0x7fa, 11 },
+  { 0x3fa, 10 }, { 0x3fb, 10 }, { 0xf9, 8 }, { 0x7fb, 11 },
+  { 0xfa, 8 }, { 0x16, 6 }, { 0x17, 6 }, { 0x18, 6 },
+  { 0x0, 5 }, { 0x1, 5 }, { 0x2, 5 }, { 0x19, 6 },
+  { 0x1a, 6 }, { 0x1b, 6 }, { 0x1c, 6 }, { 0x1d, 6 },
+  { 0x1e, 6 }, { 0x1f, 6 }, { 0x5c, 7 }, { 0xfb, 8 },
+  { 0x7ffc, 15 }, { 0x20, 6 }, { 0xffb, 12 }, { 0x3fc, 10 },
+  { 0x1ffa, 13 }, { 0x21, 6 }, { 0x5d, 7 }, { 0x5e, 7 },
+  { 0x5f, 7 }, { 0x60, 7 }, { 0x61, 7 }, { 0x62, 7 },
+  { 0x63, 7 }, { 0x64, 7 }, { 0x65, 7 }, { 0x66, 7 },
+  { 0x67, 7 }, { 0x68, 7 }, { 0x69, 7 }, { 0x6a, 7 },
+  { 0x6b, 7 }, { 0x6c, 7 }, { 0x6d, 7 }, { 0x6e, 7 },
+  { 0x6f, 7 }, { 0x70, 7 }, { 0x71, 7 }, { 0x72, 7 },
+  { 0xfc, 8 }, { 0x73, 7 }, { 0xfd, 8 }, { 0x1ffb, 13 },
+  { 0x7fff0, 19 }, { 0x1ffc, 13 }, { 0x3ffc, 14 }, { 0x22, 6 },
+  { 0x7ffd, 15 }, { 0x3, 5 }, { 0x23, 6 }, { 0x4, 5 },
+  { 0x24, 6 }, { 0x5, 5 }, { 0x25, 6 }, { 0x26, 6 },
+  { 0x27, 6 }, { 0x6, 5 }, { 0x74, 7 }, { 0x75, 7 },
+  { 0x28, 6 }, { 0x29, 6 }, { 0x2a, 6 }, { 0x7, 5 },
+  { 0x2b, 6 }, { 0x76, 7 }, { 0x2c, 6 }, { 0x8, 5 },
+  { 0x9, 5 }, { 0x2d, 6 }, { 0x77, 7 }, { 0x78, 7 },
+  { 0x79, 7 }, { 0x7a, 7 }, { 0x7b, 7 }, { 0x7ffe, 15 },
+  { 0x7fc, 11 }, { 0x3ffd, 14 }, { 0x1ffd, 13 }, { 0xffffffc, 28 },
+  { 0xfffe6, 20 }, { 0x3fffd2, 22 }, { 0xfffe7, 20 }, { 0xfffe8, 20 },
+  { 0x3fffd3, 22 }, { 0x3fffd4, 22 }, { 0x3fffd5, 22 }, { 0x7fffd9, 23 },
+  { 0x3fffd6, 22 }, { 0x7fffda, 23 }, { 0x7fffdb, 23 }, { 0x7fffdc, 23 },
+  { 0x7fffdd, 23 }, { 0x7fffde, 23 }, { 0xffffeb, 24 }, { 0x7fffdf, 23 },
+  { 0xffffec, 24 }, { 0xffffed, 24 }, { 0x3fffd7, 22 }, { 0x7fffe0, 23 },
+  { 0xffffee, 24 }, { 0x7fffe1, 23 }, { 0x7fffe2, 23 }, { 0x7fffe3, 23 },
+  { 0x7fffe4, 23 }, { 0x1fffdc, 21 }, { 0x3fffd8, 22 }, { 0x7fffe5, 23 },
+  { 0x3fffd9, 22 }, { 0x7fffe6, 23 }, { 0x7fffe7, 23 }, { 0xffffef, 24 },
+  { 0x3fffda, 22 }, { 0x1fffdd, 21 }, { 0xfffe9, 20 }, { 0x3fffdb, 22 },
+  { 0x3fffdc, 22 }, { 0x7fffe8, 23 }, { 0x7fffe9, 23 }, { 0x1fffde, 21 },
+  { 0x7fffea, 23 }, { 0x3fffdd, 22 }, { 0x3fffde, 22 }, { 0xfffff0, 24 },
+  { 0x1fffdf, 21 }, { 0x3fffdf, 22 }, { 0x7fffeb, 23 }, { 0x7fffec, 23 },
+  { 0x1fffe0, 21 }, { 0x1fffe1, 21 }, { 0x3fffe0, 22 }, { 0x1fffe2, 21 },
+  { 0x7fffed, 23 }, { 0x3fffe1, 22 }, { 0x7fffee, 23 }, { 0x7fffef, 23 },
+  { 0xfffea, 20 }, { 0x3fffe2, 22 }, { 0x3fffe3, 22 }, { 0x3fffe4, 22 },
+  { 0x7ffff0, 23 }, { 0x3fffe5, 22 }, { 0x3fffe6, 22 }, { 0x7ffff1, 23 },
+  { 0x3ffffe0, 26 }, { 0x3ffffe1, 26 }, { 0xfffeb, 20 }, { 0x7fff1, 19 },
+  { 0x3fffe7, 22 }, { 0x7ffff2, 23 }, { 0x3fffe8, 22 }, { 0x1ffffec, 25 },
+  { 0x3ffffe2, 26 }, { 0x3ffffe3, 26 }, { 0x3ffffe4, 26 }, { 0x7ffffde, 27 },
+  { 0x7ffffdf, 27 }, { 0x3ffffe5, 26 }, { 0xfffff1, 24 }, { 0x1ffffed, 25 },
+  { 0x7fff2, 19 }, { 0x1fffe3, 21 }, { 0x3ffffe6, 26 }, { 0x7ffffe0, 27 },
+  { 0x7ffffe1, 27 }, { 0x3ffffe7, 26 }, { 0x7ffffe2, 27 }, { 0xfffff2, 24 },
+  { 0x1fffe4, 21 }, { 0x1fffe5, 21 }, { 0x3ffffe8, 26 }, { 0x3ffffe9, 26 },
+  { 0xffffffd, 28 }, { 0x7ffffe3, 27 }, { 0x7ffffe4, 27 }, { 0x7ffffe5, 27 },
+  { 0xfffec, 20 }, { 0xfffff3, 24 }, { 0xfffed, 20 }, { 0x1fffe6, 21 },
+  { 0x3fffe9, 22 }, { 0x1fffe7, 21 }, { 0x1fffe8, 21 }, { 0x7ffff3, 23 },
+  { 0x3fffea, 22 }, { 0x3fffeb, 22 }, { 0x1ffffee, 25 }, { 0x1ffffef, 25 },
+  { 0xfffff4, 24 }, { 0xfffff5, 24 }, { 0x3ffffea, 26 }, { 0x7ffff4, 23 },
+  { 0x3ffffeb, 26 }, { 0x7ffffe6, 27 }, { 0x3ffffec, 26 }, { 0x3ffffed, 26 },
+  { 0x7ffffe7, 27 }, { 0x7ffffe8, 27 }, { 0x7ffffe9, 27 }, { 0x7ffffea, 27 },
+  { 0x7ffffeb, 27 }, { 0xffffffe, 28 }, { 0x7ffffec, 27 }, { 0x7ffffed, 27 },
+  { 0x7ffffee, 27 }, { 0x7ffffef, 27 }, { 0x7fffff0, 27 }, { 0x3ffffee, 26 },
+  { 0x3fffffff, 30 },
+};
+
+// Binary decoding tree built from the code table on first use
+struct HuffmanTree
+{
+  struct Node
+  {
+    int16_t next[2];
+    int16_t symbol;
+  };
+
+  HuffmanTree() {
+    nodes.push_back({ { -1, -1 }, -1 });
+    for (int16_t symbol = 0; symbol < 257; symbol++) {
+      const auto &entry = k_huffman[symbol];
+      size_t node = 0;
+      for (int bit = entry.bits - 1; bit >= 0; bit--) {
+        const int branch = (entry.code >> bit) & 1;
+        if (nodes[node].next[branch] < 0) {
+          nodes[node].next[branch] = static_cast<int16_t>(nodes.size());
+          nodes.push_back({ { -1, -1 }, -1 });
+        }
+        node = nodes[node].next[branch];
+      }
+      nodes[node].symbol = symbol;
+    }
+  }
+
+  std::vector<Node> nodes;
+};
+
+bool Hpack::huffman_decode(const uint8_t *data, size_t size, std::string& out) {
+  static const HuffmanTree tree;
+
+  size_t node = 0;
+  int depth = 0; // Bits consumed since the last symbol
+  bool ones = true; // Those bits were all set, a valid EOS prefix padding
+  for (size_t i = 0; i < size; i++) {
+    for (int bit = 7; bit >= 0; bit--) {
+      const int branch = (data[i] >> bit) & 1;
+      const int16_t next = tree.nodes[node].next[branch];
+      if (next < 0) {
+        return false;
+      }
+      node = next;
+      depth++;
+      ones = ones && branch;
+      const int16_t symbol = tree.nodes[node].symbol;
+      if (symbol == 256) {
+        return false;
+      } else if (symbol >= 0) {
+        out += static_cast<char>(symbol);
+        node = 0;
+        depth = 0;
+        ones = true;
+      }
+    }
+  }
+
+  // Padding longer than seven bits or not from EOS is an error
+  return depth <= 7 && ones;
+}
+
+size_t Hpack::huffman_size(std::string_view contents) {
+  size_t bits = 0;
+  for (const unsigned char ch : contents) {
+    bits += k_huffman[ch].bits;
+  }
+  return (bits + 7) / 8;
+}
+
+void Hpack::huffman_encode(std::string_view contents, std::string& out) {
+  uint64_t buffer = 0;
+  int bits = 0;
+  for (const unsigned char ch : contents) {
+    const auto &entry = k_huffman[ch];
+    buffer = (buffer << entry.bits) | entry.code;
+    bits += entry.bits;
+    while (bits >= 8) {
+      bits -= 8;
+      out += static_cast<char>((buffer >> bits) & 0xff);
+    }
+  }
+  if (bits) {
+    // Pad with the most significant bits of EOS
+    out += static_cast<char>(((buffer << (8 - bits)) | (0xff >> bits)) & 0xff);
+  }
+}
+
+// Integers with an N-bit prefix (RFC 7541 5.1)
+static bool decode_integer(const uint8_t *&data, const uint8_t *end, int prefix, size_t& value) {
+  if (data == end) {
+    return false;
+  }
+  const uint8_t mask = (1 << prefix) - 1;
+  value = *data++ & mask;
+  if (value < mask) {
+    return true;
+  }
+  for (int shift = 0; shift <= 28; shift += 7) {
+    if (data == end) {
+      return false;
+    }
+    const uint8_t byte = *data++;
+    value += static_cast<size_t>(byte & 0x7f) << shift;
+    if (!(byte & 0x80)) {
+      return true;
+    }
+  }
+  return false;
+}
+
+static void encode_integer(std::string& out, uint8_t flags, int prefix, size_t value) {
+  const uint8_t mask = (1 << prefix) - 1;
+  if (value < mask) {
+    out += static_cast<char>(flags | value);
+    return;
+  }
+  out += static_cast<char>(flags | mask);
+  value -= mask;
+  while (value >= 0x80) {
+    out += static_cast<char>((value & 0x7f) | 0x80);
+    value >>= 7;
+  }
+  out += static_cast<char>(value);
+}
+
+static bool decode_string(const uint8_t *&data, const uint8_t *end, std::string& out) {
+  if (data == end) {
+    return false;
+  }
+  const bool huffman = *data & 0x80;
+  size_t length = 0;
+  if (!decode_integer(data, end, 7, length) || static_cast<size_t>(end - data) < length) {
+    return false;
+  }
+  out.clear();
+  if (huffman) {
+    if (!Hpack::huffman_decode(data, length, out)) {
+      return false;
+    }
+  } else {
+    out.assign(reinterpret_cast<const char *>(data), length);
+  }
+  data += length;
+  return true;
+}
+
+static void encode_string(std::string& out, std::string_view contents) {
+  const size_t compressed = Hpack::huffman_size(contents);
+  if (compressed < contents.size()) {
+    encode_integer(out, 0x80, 7, compressed);
+    Hpack::huffman_encode(contents, out);
+  } else {
+    encode_integer(out, 0x00, 7, contents.size());
+    out += contents;
+  }
+}
+
+// Entry overhead from RFC 7541 4.1
+static constexpr size_t entry_size(std::string_view name, std::string_view value) {
+  return name.size() + value.size() + 32;
+}
+
+Hpack::Table::Table(size_t max_size)
+  : m_size     { 0 }
+  , m_max_size { max_size }
+{
+}
+
+void Hpack::Table::evict(size_t size) {
+  while (!m_entries.empty() && m_size + size > m_max_size) {
+    const auto &entry = m_entries.back();
+    m_size -= entry_size(entry.first, entry.second);
+    m_entries.pop_back();
+  }
+}
+
+void Hpack::Table::add(std::string_view name, std::string_view value) {
+  const size_t size = entry_size(name, value);
+  evict(size);
+  // Entries larger than the table just empty it
+  if (size <= m_max_size) {
+    m_entries.emplace_front(name, value);
+    m_size += size;
+  }
+}
+
+void Hpack::Table::resize(size_t max_size) {
+  m_max_size = max_size;
+  evict(0);
+}
+
+std::optional<std::pair<std::string_view, std::string_view>> Hpack::Table::get(size_t index) const {
+  if (index == 0) {
+    return std::nullopt;
+  }
+  if (index <= k_static_size) {
+    return k_static_table[index - 1];
+  }
+  index -= k_static_size + 1;
+  if (index < m_entries.size()) {
+    return std::make_pair<std::string_view, std::string_view>(m_entries[index].first, m_entries[index].second);
+  }
+  return std::nullopt;
+}
+
+void Hpack::Table::find(std::string_view name, std::string_view value,
+                        size_t& index, size_t& name_index) const
+{
+  index = 0;
+  name_index = 0;
+  for (size_t i = 0; i < k_static_size; i++) {
+    if (k_static_table[i].first == name) {
+      if (k_static_table[i].second == value) {
+        index = i + 1;
+        return;
+      }
+      if (!name_index) {
+        name_index = i + 1;
+      }
+    }
+  }
+  for (size_t i = 0; i < m_entries.size(); i++) {
+    if (m_entries[i].first == name) {
+      if (m_entries[i].second == value) {
+        index = k_static_size + i + 1;
+        return;
+      }
+      if (!name_index) {
+        name_index = k_static_size + i + 1;
+      }
+    }
+  }
+}
+
+Hpack::Decoder::Decoder(size_t max_size)
+  : m_table    { max_size }
+  , m_max_size { max_size }
+{
+}
+
+bool Hpack::Decoder::decode(const uint8_t *data, size_t size, Fields& fields) {
+  const uint8_t *end = data + size;
+  std::string name;
+  std::string value;
+  while (data != end) {
+    const uint8_t byte = *data;
+    if (byte & 0x80) {
+      // Indexed header field
+      size_t index = 0;
+      if (!decode_integer(data, end, 7, index)) {
+        return false;
+      }
+      const auto entry = m_table.get(index);
+      if (!entry) {
+        return false;
+      }
+      fields.emplace_back(entry->first, entry->second);
+    } else if ((byte & 0xe0) == 0x20) {
+      // Dynamic table size update
+      size_t max_size = 0;
+      if (!decode_integer(data, end, 5, max_size) || max_size > m_max_size) {
+        return false;
+      }
+      m_table.resize(max_size);
+    } else {
+      // Literal with incremental indexing, without indexing or never indexed
+      const bool indexing = (byte & 0xc0) == 0x40;
+      size_t index = 0;
+      if (!decode_integer(data, end, indexing ? 6 : 4, index)) {
+        return false;
+      }
+      if (index) {
+        const auto entry = m_table.get(index);
+        if (!entry) {
+          return false;
+        }
+        name = entry->first;
+      } else if (!decode_string(data, end, name)) {
+        return false;
+      }
+      if (!decode_string(data, end, value)) {
+        return false;
+      }
+      if (indexing) {
+        m_table.add(name, value);
+      }
+      fields.emplace_back(name, value);
+    }
+  }
+  return true;
+}
+
+Hpack::Encoder::Encoder(size_t max_size)
+  : m_table   { max_size }
+  , m_resized { false }
+{
+}
+
+void Hpack::Encoder::resize(size_t max_size) {
+  // Never grow past the default, the peer only bounds what we may use
+  m_table.resize(std::min<size_t>(max_size, 4096));
+  m_resized = true;
+}
+
+void Hpack::Encoder::encode(std::string_view name, std::string_view value, std::string& out,
+                            Indexing indexing)
+{
+  if (m_resized) {
+    encode_integer(out, 0x20, 5, m_table.max_size());
+    m_resized = false;
+  }
+
+  size_t index = 0;
+  size_t name_index = 0;
+  m_table.find(name, value, index, name_index);
+
+  if (index && indexing != NEVER_INDEX) {
+    encode_integer(out, 0x80, 7, index);
+    return;
+  }
+
+  if (indexing == INDEX) {
+    encode_integer(out, 0x40, 6, name_index);
+  } else {
+    encode_integer(out, indexing == NEVER_INDEX ? 0x10 : 0x00, 4, name_index);
+  }
+
+  if (!name_index) {
+    encode_string(out, name);
+  }
+  encode_string(out, value);
+
+  if (indexing == INDEX) {
+    m_table.add(name, value);
+  }
+}
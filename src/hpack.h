@@ -0,0 +1,81 @@
+#ifndef HPACK_H
+#define HPACK_H
+
+#include <string_view> // std::string_view
+#include <optional> // std::optional
+#include <utility> // std::pair
+#include <string> // std::string
+#include <vector> // std::vector
+#include <deque> // std::deque
+
+#include <cstdint> // uint8_t, uint32_t
+
+// HTTP/2 header compression (RFC 7541)
+struct Hpack
+{
+  typedef std::vector<std::pair<std::string, std::string>> Fields;
+
+  // Dynamic table, shared by both directions. Index 1 is the newest entry
+  // when placed after the static table.
+  struct Table
+  {
+    Table(size_t max_size);
+
+    void add(std::string_view name, std::string_view value);
+    void resize(size_t max_size);
+
+    std::optional<std::pair<std::string_view, std::string_view>> get(size_t index) const;
+
+    // Returns the HPACK index (static or dynamic) of an exact match in
+    // |index| or of a name only match in |name_index|, zero when absent
+    void find(std::string_view name, std::string_view value,
+              size_t& index, size_t& name_index) const;
+
+    size_t max_size() const { return m_max_size; }
+
+  private:
+    void evict(size_t size);
+
+    std::deque<std::pair<std::string, std::string>> m_entries;
+    size_t m_size;
+    size_t m_max_size;
+  };
+
+  struct Decoder
+  {
+    Decoder(size_t max_size = 4096);
+
+    // Returns false on a compression error, which is fatal to the connection
+    bool decode(const uint8_t *data, size_t size, Fields& fields);
+
+  private:
+    Table m_table;
+    size_t m_max_size; // Limit advertised in our SETTINGS_HEADER_TABLE_SIZE
+  };
+
+  // How a literal field is represented. Fields whose values rarely repeat
+  // should not churn the table and sensitive ones (cookies) must never be
+  // entered in any table along the way.
+  enum Indexing { INDEX, NO_INDEX, NEVER_INDEX };
+
+  struct Encoder
+  {
+    Encoder(size_t max_size = 4096);
+
+    void encode(std::string_view name, std::string_view value, std::string& out,
+                Indexing indexing = INDEX);
+
+    // Peer changed SETTINGS_HEADER_TABLE_SIZE, signalled on the next field
+    void resize(size_t max_size);
+
+  private:
+    Table m_table;
+    bool m_resized;
+  };
+
+  static bool huffman_decode(const uint8_t *data, size_t size, std::string& out);
+  static void huffman_encode(std::string_view contents, std::string& out);
+  static size_t huffman_size(std::string_view contents);
+};
+
+#endif
@@ -0,0 +1,806 @@
+#include <algorithm> // std::min, std::remove
+#include <charconv> // std::to_chars
+
+#include "http2.h"
+#include "client.h"
+#include "utility.h"
+#include "response.h"
+
+// Frame types
+static constexpr uint8_t k_data = 0x0;
+static constexpr uint8_t k_headers = 0x1;
+static constexpr uint8_t k_priority = 0x2;
+static constexpr uint8_t k_rst_stream = 0x3;
+static constexpr uint8_t k_settings = 0x4;
+static constexpr uint8_t k_push_promise = 0x5;
+static constexpr uint8_t k_ping = 0x6;
+static constexpr uint8_t k_goaway = 0x7;
+static constexpr uint8_t k_window_update = 0x8;
+static constexpr uint8_t k_continuation = 0x9;
+
+// Frame flags
+static constexpr uint8_t k_end_stream = 0x1;
+static constexpr uint8_t k_ack = 0x1;
+static constexpr uint8_t k_end_headers = 0x4;
+static constexpr uint8_t k_padded = 0x8;
+static constexpr uint8_t k_priority_flag = 0x20;
+
+// Error codes
+static constexpr uint32_t k_no_error = 0x0;
+static constexpr uint32_t k_protocol_error = 0x1;
+static constexpr uint32_t k_flow_control_error = 0x3;
+static constexpr uint32_t k_stream_closed = 0x5;
+static constexpr uint32_t k_frame_size_error = 0x6;
+static constexpr uint32_t k_refused_stream = 0x7;
+static constexpr uint32_t k_compression_error = 0x9;
+
+// What we advertise, everything else is left at the protocol defaults
+static constexpr uint32_t k_max_streams = 100;
+static constexpr uint32_t k_max_frame = 16384;
+static constexpr uint32_t k_default_window = 65535;
+static constexpr int64_t k_max_window = 0x7fffffff;
+
+// Header blocks larger than this are not worth decoding
+static constexpr size_t k_max_block = 64 * 1024;
+
+// Connections with nothing to do for this long are closed (milliseconds)
+static constexpr int k_idle_timeout = 5000;
+
+static uint32_t read_u32(const uint8_t *data) {
+  return (uint32_t(data[0]) << 24) | (uint32_t(data[1]) << 16) | (uint32_t(data[2]) << 8) | data[3];
+}
+
+static void write_u32(std::string& out, uint32_t value) {
+  out += static_cast<char>((value >> 24) & 0xff);
+  out += static_cast<char>((value >> 16) & 0xff);
+  out += static_cast<char>((value >> 8) & 0xff);
+  out += static_cast<char>(value & 0xff);
+}
+
+Http2Connection::Http2Connection(Client& client, Handler handler, Offload offload)
+  : m_client             { client }
+  , m_handler            { std::move(handler) }
+  , m_offload            { std::move(offload) }
+  , m_handlers           { 0 }
+  , m_continuation       { 0 }
+  , m_continuation_end   { false }
+  , m_last_stream        { 0 }
+  , m_window             { k_default_window }
+  , m_initial_window     { k_default_window }
+  , m_max_frame          { k_max_frame }
+  , m_flushed            { 0 }
+  , m_congested          { false }
+  , m_preface            { true }
+  , m_goaway             { false }
+  , m_error              { false }
+{
+}
+
+bool Http2Connection::serve(std::string&& contents) {
+  m_buffer = std::move(contents);
+  return serve();
+}
+
+bool Http2Connection::upgrade(std::string_view settings,
+                              std::string&& method,
+                              std::string&& query,
+                              Fields&& header_fields)
+{
+  const auto payload = base64_decode(settings);
+  if (!payload || !this->settings(reinterpret_cast<const uint8_t *>(payload->data()), payload->size())) {
+    return false;
+  }
+
+  m_client.write_line("HTTP/1.1 101 Switching Protocols");
+  m_client.write_line("Connection: Upgrade");
+  m_client.write_line("Upgrade: h2c");
+  m_client.write_line("");
+
+  // The upgraded request is stream 1, already half closed by the client
+  Stream &stream = m_streams[1];
+  stream.method = std::move(method);
+  stream.path = std::move(query);
+  stream.header_fields = std::move(header_fields);
+  stream.window = m_initial_window;
+  stream.pending_end = false;
+  stream.remote_closed = true;
+  stream.local_closed = false;
+  stream.responded = false;
+
+  m_last_stream = 1;
+  m_ready.push_back(1);
+
+  return serve();
+}
+
+bool Http2Connection::serve() {
+  // Server connection preface
+  std::string preface;
+  preface += std::string_view("\0\x03", 2);
+  write_u32(preface, k_max_streams);
+  if (!write_frame(k_settings, 0, 0, preface)) {
+    return false;
+  }
+
+  m_client.socket().set_send_timeout(Client::k_stream_timeout);
+  m_thread = std::this_thread::get_id();
+
+  bool idle = false;
+  std::unique_lock<std::mutex> lock(m_mutex);
+  while (!m_error) {
+    if (!process()) {
+      break;
+    }
+
+    dispatch(lock);
+
+    if (!flush()) {
+      break;
+    }
+
+    // Offloaded handlers waiting on the windows may have room now
+    m_progress.notify_all();
+
+    if (m_goaway && m_streams.empty()) {
+      break;
+    }
+
+    const bool congested = m_congested;
+    lock.unlock();
+    const bool received = receive(idle, congested);
+    lock.lock();
+    if (!received) {
+      break;
+    }
+
+    // A quiet peer may still be waiting on a handler
+    if (idle && m_handlers == 0) {
+      goaway(k_no_error);
+      break;
+    }
+  }
+
+  // Offloaded handlers still reference the connection, whatever they
+  // send from here on fails
+  const bool clean = !m_error;
+  m_error = true;
+  m_streams.clear();
+  m_progress.notify_all();
+  m_progress.wait(lock, [this] { return m_handlers == 0; });
+  return clean;
+}
+
+bool Http2Connection::receive(bool& idle, bool congested) {
+  // Congested, room in the socket is as good as a frame from the peer
+  Socket::Poll poll { &m_client.socket(), true, congested, false, false };
+  const int ready = Socket::poll(&poll, 1, k_idle_timeout);
+  if (ready < 0) {
+    return false;
+  }
+
+  idle = ready == 0;
+  if (idle || !poll.readable) {
+    return true;
+  }
+
+  uint8_t buffer[16384];
+  const int n = m_client.socket().recieve(buffer, sizeof buffer);
+  if (n <= 0) {
+    return false;
+  }
+
+  m_buffer.append(reinterpret_cast<const char *>(buffer), n);
+  return true;
+}
+
+bool Http2Connection::process() {
+  if (m_preface) {
+    const size_t size = std::min(m_buffer.size(), k_preface.size());
+    if (m_buffer.compare(0, size, k_preface, 0, size) != 0) {
+      return goaway(k_protocol_error);
+    }
+    if (size < k_preface.size()) {
+      return true;
+    }
+    m_buffer.erase(0, k_preface.size());
+    m_preface = false;
+  }
+
+  size_t offset = 0;
+  while (!m_error && m_buffer.size() - offset >= 9) {
+    const auto *header = reinterpret_cast<const uint8_t *>(m_buffer.data() + offset);
+    const size_t length = (size_t(header[0]) << 16) | (size_t(header[1]) << 8) | header[2];
+    const uint8_t type = header[3];
+    const uint8_t flags = header[4];
+    const uint32_t id = read_u32(header + 5) & 0x7fffffff;
+
+    if (length > k_max_frame) {
+      return goaway(k_frame_size_error);
+    }
+
+    if (m_buffer.size() - offset < 9 + length) {
+      break;
+    }
+
+    if (!frame(type, flags, id, header + 9, length)) {
+      return false;
+    }
+
+    offset += 9 + length;
+  }
+
+  m_buffer.erase(0, offset);
+  return !m_error;
+}
+
+bool Http2Connection::frame(uint8_t type, uint8_t flags, uint32_t id, const uint8_t *data, size_t size) {
+  // Header blocks must be contiguous
+  if (m_continuation && (type != k_continuation || id != m_continuation)) {
+    return goaway(k_protocol_error);
+  }
+
+  switch (type) {
+  case k_data:
+  case k_headers:
+    {
+      if (id == 0) {
+        return goaway(k_protocol_error);
+      }
+
+      const size_t total = size;
+      if (flags & k_padded) {
+        if (size < 1 || data[0] >= size) {
+          return goaway(k_protocol_error);
+        }
+        size -= 1 + data[0];
+        data++;
+      }
+
+      if (type == k_headers) {
+        if (flags & k_priority_flag) {
+          if (size < 5) {
+            return goaway(k_protocol_error);
+          }
+          data += 5;
+          size -= 5;
+        }
+        m_block.assign(reinterpret_cast<const char *>(data), size);
+        m_continuation = id;
+        m_continuation_end = flags & k_end_stream;
+        if (flags & k_end_headers) {
+          return headers(id, m_continuation_end);
+        }
+        return true;
+      }
+
+      // Request bodies are not used by any handler, just keep the
+      // receive windows open. Padding counts against flow control too.
+      if (total && !window_update(0, total)) {
+        return false;
+      }
+
+      auto find = m_streams.find(id);
+      if (find == m_streams.end() || find->second.remote_closed) {
+        if (id > m_last_stream) {
+          return goaway(k_protocol_error);
+        }
+        return reset(id, k_stream_closed);
+      }
+
+      Stream &stream = find->second;
+      if (flags & k_end_stream) {
+        stream.remote_closed = true;
+        m_ready.push_back(id);
+      } else if (total && !window_update(id, total)) {
+        return false;
+      }
+    }
+    return true;
+
+  case k_continuation:
+    if (!m_continuation) {
+      return goaway(k_protocol_error);
+    }
+    if (m_block.size() + size > k_max_block) {
+      return goaway(k_protocol_error);
+    }
+    m_block.append(reinterpret_cast<const char *>(data), size);
+    if (flags & k_end_headers) {
+      return headers(id, m_continuation_end);
+    }
+    return true;
+
+  case k_priority:
+    if (id == 0) {
+      return goaway(k_protocol_error);
+    }
+    if (size != 5) {
+      return reset(id, k_frame_size_error);
+    }
+    return true;
+
+  case k_rst_stream:
+    if (id == 0 || id > m_last_stream) {
+      return goaway(k_protocol_error);
+    }
+    if (size != 4) {
+      return goaway(k_frame_size_error);
+    }
+    m_streams.erase(id);
+    m_ready.erase(std::remove(m_ready.begin(), m_ready.end(), id), m_ready.end());
+    return true;
+
+  case k_settings:
+    if (id != 0) {
+      return goaway(k_protocol_error);
+    }
+    if (flags & k_ack) {
+      return size == 0 || goaway(k_frame_size_error);
+    }
+    if (size % 6) {
+      return goaway(k_frame_size_error);
+    }
+    if (!settings(data, size)) {
+      return false;
+    }
+    return write_frame(k_settings, k_ack, 0, {});
+
+  case k_push_promise:
+    // Clients cannot push
+    return goaway(k_protocol_error);
+
+  case k_ping:
+    if (id != 0) {
+      return goaway(k_protocol_error);
+    }
+    if (size != 8) {
+      return goaway(k_frame_size_error);
+    }
+    if (flags & k_ack) {
+      return true;
+    }
+    return write_frame(k_ping, k_ack, 0, { reinterpret_cast<const char *>(data), size });
+
+  case k_goaway:
+    if (id != 0) {
+      return goaway(k_protocol_error);
+    }
+    // Finish what was started but take nothing new
+    m_goaway = true;
+    return true;
+
+  case k_window_update:
+    {
+      if (size != 4) {
+        return goaway(k_frame_size_error);
+      }
+      const uint32_t increment = read_u32(data) & 0x7fffffff;
+      if (id == 0) {
+        if (increment == 0) {
+          return goaway(k_protocol_error);
+        }
+        m_window += increment;
+        if (m_window > k_max_window) {
+          return goaway(k_flow_control_error);
+        }
+        return true;
+      }
+      auto find = m_streams.find(id);
+      if (find == m_streams.end()) {
+        return id <= m_last_stream || goaway(k_protocol_error);
+      }
+      if (increment == 0) {
+        return reset(id, k_protocol_error);
+      }
+      find->second.window += increment;
+      if (find->second.window > k_max_window) {
+        return reset(id, k_flow_control_error);
+      }
+    }
+    return true;
+  }
+
+  // Unknown frame types are ignored
+  return true;
+}
+
+bool Http2Connection::headers(uint32_t id, bool end_stream) {
+  m_continuation = 0;
+
+  // The block has to be decoded even for streams we refuse to keep the
+  // compression state in sync with the peer
+  Hpack::Fields fields;
+  if (!m_decoder.decode(reinterpret_cast<const uint8_t *>(m_block.data()), m_block.size(), fields)) {
+    return goaway(k_compression_error);
+  }
+
+  auto find = m_streams.find(id);
+  if (find != m_streams.end()) {
+    // Trailers, which must end the stream
+    if (!end_stream || find->second.remote_closed) {
+      return goaway(k_protocol_error);
+    }
+    find->second.remote_closed = true;
+    m_ready.push_back(id);
+    return true;
+  }
+
+  if (id % 2 == 0 || id <= m_last_stream) {
+    return goaway(k_protocol_error);
+  }
+  m_last_stream = id;
+
+  if (m_goaway || m_streams.size() >= k_max_streams) {
+    return reset(id, k_refused_stream);
+  }
+
+  Stream stream;
+  stream.window = m_initial_window;
+  stream.pending_end = false;
+  stream.remote_closed = end_stream;
+  stream.local_closed = false;
+  stream.responded = false;
+
+  for (auto &[name, value] : fields) {
+    if (name == ":method") {
+      stream.method = std::move(value);
+    } else if (name == ":path") {
+      stream.path = std::move(value);
+    } else if (name == ":authority") {
+      stream.header_fields["host"] = std::move(value);
+    } else if (name == ":scheme") {
+      continue;
+    } else if (name[0] == ':' ||
+               name == "connection" ||
+               name == "upgrade" ||
+               name == "keep-alive" ||
+               name == "proxy-connection" ||
+               name == "transfer-encoding")
+    {
+      // Malformed, connection specific fields have no meaning here
+      return reset(id, k_protocol_error);
+    } else if (name == "cookie" && stream.header_fields.count(name)) {
+      // Crumbs are split into separate fields for better compression
+      stream.header_fields[name] += "; " + value;
+    } else {
+      stream.header_fields[name] = std::move(value);
+    }
+  }
+
+  if (stream.method.empty() || stream.path.empty()) {
+    return reset(id, k_protocol_error);
+  }
+
+  m_streams.emplace(id, std::move(stream));
+  if (end_stream) {
+    m_ready.push_back(id);
+  }
+
+  return true;
+}
+
+bool Http2Connection::settings(const uint8_t *data, size_t size) {
+  for (size_t i = 0; i + 6 <= size; i += 6) {
+    const uint16_t identifier = (uint16_t(data[i]) << 8) | data[i + 1];
+    const uint32_t value = read_u32(data + i + 2);
+    switch (identifier) {
+    case 0x1: // SETTINGS_HEADER_TABLE_SIZE
+      m_encoder.resize(value);
+      break;
+    case 0x2: // SETTINGS_ENABLE_PUSH
+      if (value > 1) {
+        return goaway(k_protocol_error);
+      }
+      break;
+    case 0x4: // SETTINGS_INITIAL_WINDOW_SIZE
+      if (value > k_max_window) {
+        return goaway(k_flow_control_error);
+      }
+      // Applies retroactively to every open stream
+      for (auto &[_, stream] : m_streams) {
+        stream.window += int64_t(value) - int64_t(m_initial_window);
+      }
+      m_initial_window = value;
+      break;
+    case 0x5: // SETTINGS_MAX_FRAME_SIZE
+      if (value < 16384 || value > 16777215) {
+        return goaway(k_protocol_error);
+      }
+      // Never larger than our own buffers
+      m_max_frame = std::min(value, k_max_frame);
+      break;
+    }
+  }
+  return true;
+}
+
+void Http2Connection::dispatch(std::unique_lock<std::mutex>& lock) {
+  while (!m_ready.empty() && !m_error) {
+    const uint32_t id = m_ready.front();
+    m_ready.pop_front();
+
+    auto find = m_streams.find(id);
+    if (find == m_streams.end() || find->second.responded) {
+      continue;
+    }
+
+    m_handlers++;
+    std::function<void()> task = [this,
+                                  id,
+                                  method = std::move(find->second.method),
+                                  path = std::move(find->second.path),
+                                  header_fields = std::move(find->second.header_fields)]() mutable
+    {
+      handle(id, std::move(method), std::move(path), std::move(header_fields));
+      std::unique_lock<std::mutex> lock(m_mutex);
+      m_handlers--;
+      m_progress.notify_all();
+    };
+
+    // Without a thread to spare the other streams wait for this one
+    if (!m_offload || !m_offload(std::move(task))) {
+      lock.unlock();
+      task();
+      lock.lock();
+    }
+  }
+}
+
+void Http2Connection::handle(uint32_t id, std::string&& method, std::string&& path, Fields&& header_fields) {
+  Client client(*this, id);
+  m_handler(client, std::move(method), std::move(path), std::move(header_fields));
+
+  // Every request must be answered for the stream to close
+  bool answered = true;
+  {
+    std::unique_lock<std::mutex> lock(m_mutex);
+    const auto find = m_streams.find(id);
+    answered = find == m_streams.end() || find->second.responded;
+  }
+  if (!answered) {
+    client.write_empty(404);
+  }
+}
+
+bool Http2Connection::flush() {
+  // Data is only written while the socket has room, blocking in send()
+  // would hold m_mutex and with it every other stream. What's left goes
+  // once the socket is writable again. A frame per stream per round,
+  // starting after the last stream written, so one with a lot queued
+  // can't keep the others waiting.
+  m_congested = false;
+  for (bool wrote = true; wrote && !m_error && !m_congested; ) {
+    wrote = false;
+    auto it = m_streams.upper_bound(m_flushed);
+    for (size_t remaining = m_streams.size(); remaining && !m_congested; remaining--, ++it) {
+      if (it == m_streams.end()) {
+        it = m_streams.begin();
+      }
+      Stream &stream = it->second;
+      if (stream.pending.empty() || m_window <= 0 || stream.window <= 0) {
+        continue;
+      }
+      if (!writable()) {
+        m_congested = true;
+        break;
+      }
+      const size_t size = std::min<size_t>({
+        stream.pending.size(),
+        static_cast<size_t>(m_window),
+        static_cast<size_t>(stream.window),
+        m_max_frame
+      });
+      const bool last = size == stream.pending.size() && stream.pending_end;
+      if (!write_frame(k_data, last ? k_end_stream : 0, it->first, { stream.pending.data(), size })) {
+        return false;
+      }
+      stream.pending.erase(0, size);
+      m_window -= size;
+      stream.window -= size;
+      if (last) {
+        stream.local_closed = true;
+      }
+      m_flushed = it->first;
+      wrote = true;
+    }
+  }
+
+  for (auto it = m_streams.begin(); it != m_streams.end() && !m_error; ) {
+    Stream &stream = it->second;
+    const uint32_t id = it->first;
+    ++it;
+
+    // An END_STREAM with no data left to carry it
+    if (stream.pending.empty() && stream.pending_end && !stream.local_closed) {
+      if (!write_frame(k_data, k_end_stream, id, {})) {
+        return false;
+      }
+      stream.local_closed = true;
+    }
+
+    if (stream.local_closed && stream.remote_closed) {
+      close(id);
+    }
+  }
+  return !m_error;
+}
+
+bool Http2Connection::writable() const {
+  Socket::Poll poll { &m_client.socket(), false, true, false, false };
+  return Socket::poll(&poll, 1, 0) > 0 && poll.writable;
+}
+
+void Http2Connection::close(uint32_t id) {
+  m_streams.erase(id);
+}
+
+bool Http2Connection::send_headers(uint32_t id,
+                                   int status,
+                                   const std::vector<std::string>& fields,
+                                   std::string_view content_type,
+                                   std::optional<size_t> content_length,
+                                   bool end_stream)
+{
+  // Encoded and written under one lock, the peer decodes header blocks
+  // in the order they arrive
+  std::unique_lock<std::mutex> lock(m_mutex);
+  auto find = m_streams.find(id);
+  if (find == m_streams.end() || find->second.responded) {
+    return false;
+  }
+
+  std::string block;
+  char code[16];
+  const auto result = std::to_chars(code, code + sizeof code, status);
+  m_encoder.encode(":status", { code, static_cast<size_t>(result.ptr - code) }, block);
+  m_encoder.encode("server", "ElastCI", block);
+  m_encoder.encode("date", Response::snapshot()->date, block);
+  if (!content_type.empty()) {
+    m_encoder.encode("content-type", content_type, block);
+  }
+  if (content_length) {
+    m_encoder.encode("content-length", std::to_string(*content_length), block, Hpack::NO_INDEX);
+  }
+
+  for (const auto &field : fields) {
+    const auto colon = field.find(':');
+    if (colon == std::string::npos) {
+      continue;
+    }
+    std::string name = field.substr(0, colon);
+    std::string value = field.substr(colon + 1);
+    strtrim(name);
+    strtrim(value);
+    strlower(name);
+    if (name == "connection" || name == "transfer-encoding" || name == "keep-alive" || name == "upgrade") {
+      continue;
+    }
+    m_encoder.encode(name, value, block, name == "set-cookie" ? Hpack::NEVER_INDEX : Hpack::INDEX);
+  }
+
+  // Blocks larger than a frame continue in CONTINUATION frames
+  std::string_view remaining = block;
+  const std::string_view first = remaining.substr(0, m_max_frame);
+  remaining.remove_prefix(first.size());
+  const uint8_t flags = (end_stream ? k_end_stream : 0) | (remaining.empty() ? k_end_headers : 0);
+  if (!write_frame(k_headers, flags, id, first)) {
+    return false;
+  }
+  while (!remaining.empty()) {
+    const std::string_view next = remaining.substr(0, m_max_frame);
+    remaining.remove_prefix(next.size());
+    if (!write_frame(k_continuation, remaining.empty() ? k_end_headers : 0, id, next)) {
+      return false;
+    }
+  }
+
+  Stream &stream = find->second;
+  stream.responded = true;
+  if (end_stream) {
+    stream.local_closed = true;
+    if (stream.remote_closed) {
+      close(id);
+    }
+  }
+
+  return true;
+}
+
+bool Http2Connection::send_data(uint32_t id, std::string_view data, bool end_stream) {
+  std::unique_lock<std::mutex> lock(m_mutex);
+  auto find = m_streams.find(id);
+  if (find == m_streams.end() || find->second.pending_end || !find->second.responded) {
+    return false;
+  }
+
+  find->second.pending += data;
+  find->second.pending_end = end_stream;
+  if (!flush()) {
+    return false;
+  }
+
+  // Backpressure until the socket has room and the peer opens the
+  // windows. Offloaded handlers wait for the connection's thread to
+  // process the peer's frames, on that thread we have to do it here.
+  for (;;) {
+    find = m_streams.find(id);
+    if (find == m_streams.end()) {
+      // Closed normally or reset by the peer
+      return end_stream && !m_error;
+    }
+    if (find->second.pending.size() <= Client::k_stream_buffer) {
+      return true;
+    }
+    if (m_error) {
+      return false;
+    }
+    if (!serving() && m_congested) {
+      lock.unlock();
+      Socket::Poll poll { &m_client.socket(), false, true, false, false };
+      const bool room = Socket::poll(&poll, 1, Client::k_stream_timeout) > 0;
+      lock.lock();
+      if (!room || !flush()) {
+        return false;
+      }
+      m_progress.notify_all();
+      continue;
+    }
+    if (!serving()) {
+      m_progress.wait(lock);
+      continue;
+    }
+    const bool congested = m_congested;
+    lock.unlock();
+    bool idle = false;
+    const bool received = receive(idle, congested);
+    lock.lock();
+    if (!received || idle || !process() || !flush()) {
+      m_error = true;
+      return false;
+    }
+    m_progress.notify_all();
+  }
+}
+
+bool Http2Connection::write_frame(uint8_t type, uint8_t flags, uint32_t id, std::string_view payload) {
+  m_frame.clear();
+  m_frame += static_cast<char>((payload.size() >> 16) & 0xff);
+  m_frame += static_cast<char>((payload.size() >> 8) & 0xff);
+  m_frame += static_cast<char>(payload.size() & 0xff);
+  m_frame += static_cast<char>(type);
+  m_frame += static_cast<char>(flags);
+  write_u32(m_frame, id);
+  m_frame += payload;
+  if (!m_client.send(m_frame.data(), m_frame.size())) {
+    m_error = true;
+    return false;
+  }
+  return true;
+}
+
+bool Http2Connection::window_update(uint32_t id, uint32_t increment) {
+  std::string payload;
+  write_u32(payload, increment);
+  return write_frame(k_window_update, 0, id, payload);
+}
+
+bool Http2Connection::reset(uint32_t id, uint32_t error) {
+  std::string payload;
+  write_u32(payload, error);
+  m_streams.erase(id);
+  return write_frame(k_rst_stream, 0, id, payload);
+}
+
+bool Http2Connection::goaway(uint32_t error) {
+  std::string payload;
+  write_u32(payload, m_last_stream);
+  write_u32(payload, error);
+  write_frame(k_goaway, 0, 0, payload);
+  // Errors are fatal to the connection, a clean goaway is not
+  if (error != k_no_error) {
+    m_error = true;
+    return false;
+  }
+  m_goaway = true;
+  return true;
+}
@@ -0,0 +1,143 @@
+#ifndef HTTP2_H
+#define HTTP2_H
+
+#include <unordered_map> // std::unordered_map
+#include <condition_variable> // std::condition_variable
+#include <string_view> // std::string_view
+#include <functional> // std::function
+#include <thread> // std::thread::id, std::this_thread
+#include <mutex> // std::mutex, std::unique_lock
+#include <optional> // std::optional
+#include <string> // std::string
+#include <vector> // std::vector
+#include <deque> // std::deque
+#include <map> // std::map
+
+#include <cstdint> // uint8_t, uint32_t, int64_t
+
+#include "hpack.h"
+
+struct Client;
+
+// HTTP/2 over cleartext (RFC 7540), with prior knowledge or upgraded from
+// HTTP/1.1. Requests on every stream are multiplexed over the one
+// connection and dispatched to the same handler HTTP/1.1 requests go
+// through, each by a Client bound to its stream.
+//
+// The thread serving the connection reads frames and hands each request
+// to offload, so a slow stream doesn't hold up the others. When offload
+// has no thread to spare the request is handled on the connection's own
+// thread and the other streams wait for it (see Client::holds_connection()).
+struct Http2Connection
+{
+  typedef std::unordered_map<std::string, std::string> Fields;
+  typedef std::function<bool(Client& client,
+                             std::string&& method,
+                             std::string&& query,
+                             Fields&& header_fields)> Handler;
+
+  // Runs the task on another thread, false when none is free to take it
+  typedef std::function<bool(std::function<void()>&& task)> Offload;
+
+  static constexpr std::string_view k_preface = "PRI * HTTP/2.0\r\n\r\nSM\r\n\r\n";
+
+  Http2Connection(Client& client, Handler handler, Offload offload = {});
+
+  // Serves a prior knowledge connection, |contents| are the bytes already
+  // read from it beginning with the client preface
+  bool serve(std::string&& contents);
+
+  // Completes an "Upgrade: h2c" request and serves the connection, the
+  // upgraded request is answered on stream 1
+  bool upgrade(std::string_view settings,
+               std::string&& method,
+               std::string&& query,
+               Fields&& header_fields);
+
+  // Response side used by Clients bound to a stream. Header fields are in
+  // the "Name: value" form Client collects them in.
+  bool send_headers(uint32_t stream,
+                    int status,
+                    const std::vector<std::string>& fields,
+                    std::string_view content_type,
+                    std::optional<size_t> content_length,
+                    bool end_stream);
+
+  // Queues data behind the flow control windows. Blocks while more than
+  // Client::k_stream_buffer bytes are queued on the stream, on the
+  // connection's thread by processing frames from the peer itself.
+  // Returns false if the stream or connection went away.
+  bool send_data(uint32_t stream, std::string_view data, bool end_stream);
+
+  // Whether the calling thread is the one serving the connection
+  bool serving() const { return std::this_thread::get_id() == m_thread; }
+
+private:
+  struct Stream
+  {
+    std::string method;
+    std::string path;
+    Fields header_fields;
+
+    int64_t window; // Send window
+    std::string pending; // Data waiting on flow control
+    bool pending_end;
+
+    bool remote_closed;
+    bool local_closed;
+    bool responded;
+  };
+
+  bool serve();
+  bool receive(bool& idle, bool congested);
+  bool process();
+  bool frame(uint8_t type, uint8_t flags, uint32_t id, const uint8_t *data, size_t size);
+  bool headers(uint32_t id, bool end_stream);
+  bool settings(const uint8_t *data, size_t size);
+  bool flush();
+  bool writable() const;
+  void dispatch(std::unique_lock<std::mutex>& lock);
+  void handle(uint32_t id, std::string&& method, std::string&& path, Fields&& header_fields);
+  void close(uint32_t id);
+
+  bool write_frame(uint8_t type, uint8_t flags, uint32_t id, std::string_view payload);
+  bool window_update(uint32_t id, uint32_t increment);
+  bool reset(uint32_t id, uint32_t error);
+  bool goaway(uint32_t error);
+
+  Client& m_client;
+  Handler m_handler;
+  Offload m_offload;
+
+  // Guards everything below against the offloaded handlers, which send
+  // their responses from their own threads. Never held while reading.
+  std::mutex m_mutex;
+  std::condition_variable m_progress; // Frames flushed or handlers done
+  size_t m_handlers; // Offloaded and still running
+  std::thread::id m_thread;
+
+  Hpack::Decoder m_decoder;
+  Hpack::Encoder m_encoder;
+
+  std::map<uint32_t, Stream> m_streams;
+  std::deque<uint32_t> m_ready; // Streams with a complete request
+
+  std::string m_buffer; // Received bytes not yet processed
+  std::string m_frame; // Outgoing frame being built
+  std::string m_block; // Header block assembled across CONTINUATION frames
+  uint32_t m_continuation; // Stream expecting CONTINUATION, zero if none
+  bool m_continuation_end;
+
+  uint32_t m_last_stream;
+  int64_t m_window; // Connection send window
+  uint32_t m_initial_window; // Peer SETTINGS_INITIAL_WINDOW_SIZE
+  uint32_t m_max_frame; // Peer SETTINGS_MAX_FRAME_SIZE
+
+  uint32_t m_flushed; // Stream flush() last wrote data for
+  bool m_congested; // Data left queued because the socket was full
+  bool m_preface; // Client preface still expected
+  bool m_goaway;
+  bool m_error;
+};
+
+#endif
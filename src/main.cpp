@@ -1,46 +1,131 @@
 #include <csignal>
+#include <cerrno> // errno, EINTR
 
 #include <atomic>
-#include <mutex>
-#include <condition_variable>
 #include <iostream>
+#include <string>
+#include <cstdlib>
+
+#include <unistd.h> // pipe, read, write
+#include <fcntl.h> // fcntl, O_NONBLOCK
 
 #include "server.h"
 #include "database.h"
+#include "config.h"
+#include "benchmark.h"
+
+// Next to the working directory, also what --benchmark and --vacuum work on
+static constexpr const char k_database[] = "db.db";
 
 static std::atomic_bool running_flag(true);
-static std::condition_variable running_condition;
-static std::mutex running_mutex;
+static std::atomic_bool reload_flag(false);
+
+// The main thread sleeps reading wake_pipe. Signal handlers can only
+// wake it with write(), a byte left in the pipe is never a lost wakeup
+// however it races with the flags being checked.
+static int wake_pipe[2] = { -1, -1 };
+
+static void wake() {
+  const char byte = 0;
+  // Only fails when full, and then a wakeup is already pending
+  [[maybe_unused]] const ssize_t written = write(wake_pipe[1], &byte, 1);
+}
+
+// Async signal safe, called from SIGHUP and from HTTP threads
+static void request_reload() {
+  reload_flag.store(true);
+  wake();
+}
+
+// Hands the settings to the subsystems that keep their own copy, the
+// rest read Config::current() as they go
+static void apply(const Config& config, Database& db) {
+  db.set_batching(config.batch_size, config.batch_delay);
+  db.set_busy_backoff(config.busy_initial, config.busy_max_delay, config.busy_deadline);
+  db.set_log_retention(config.log_retention);
+  db.set_backup_rate(config.backup_pages, config.backup_interval);
+  db.set_slow_query(config.slow_query);
+  db.set_change_retention(config.change_retention);
+}
+
+static void reload(Database& db, Server& server) {
+  const auto previous = Config::current();
+  const auto config = Config::load(db);
+  if (!config) {
+    db.log_system("Failed to reload configuration, keeping the last one");
+    return;
+  }
+
+  Config::publish(*config);
+  apply(*config, db);
+  server.set_threads(config->http_threads);
+
+  if (config->http_port != previous->http_port) {
+    db.log_system("The HTTP port changes on restart");
+  }
+  db.log_system("Reloaded configuration");
+}
+
+int main(int argc, char **argv) {
+  // kaizen --benchmark [seconds], compares storage profiles on a copy
+  if (argc > 1 && std::string(argv[1]) == "--benchmark") {
+    const long seconds = argc > 2 ? std::strtol(argv[2], nullptr, 10) : 5;
+    return Benchmark::run(k_database, std::chrono::seconds(seconds > 0 ? seconds : 5));
+  }
+
+  // kaizen --vacuum, one-off conversion of files from before log
+  // partitioning, run while the server is stopped
+  if (argc > 1 && std::string(argv[1]) == "--vacuum") {
+    std::string error;
+    if (!Database::convert_auto_vacuum(k_database, error)) {
+      std::cerr << "Failed to vacuum database: " << error << std::endl;
+      return 1;
+    }
+    std::cout << "Database uses incremental auto_vacuum" << std::endl;
+    return 0;
+  }
+
+  if (pipe(wake_pipe) != 0 || fcntl(wake_pipe[1], F_SETFL, O_NONBLOCK) != 0) {
+    std::cerr << "Failed to create wake pipe" << std::endl;
+    return 1;
+  }
 
-int main() {
   signal(SIGINT, +[](int){
     running_flag.store(false);
-    running_condition.notify_one();
+    wake();
+  });
+
+  signal(SIGHUP, +[](int){
+    request_reload();
   });
 
   Database db;
-  if (!db.open("db.db")) {
-    if (!db.create("db.db")) {
+  if (!db.open(k_database)) {
+    if (!db.create(k_database)) {
       std::cerr << "Failed to create database" << std::endl;
       return 1;
     }
   }
 
-  const auto& contents = db.query("SELECT * FROM configuration", "ii");
-  if (!contents) {
+  const auto config = Config::load(db);
+  if (!config) {
     std::cerr << "Could not read configuration from database" << std::endl;
     return 1;
   }
 
-  const auto &config = *contents;
-  const auto port = std::get<int64_t>(config[0]);
-  const auto threads = std::get<int64_t>(config[1]);
+  Config::publish(*config);
+  apply(*config, db);
 
-  Server server(port, threads, db);
+  Server server(config->http_port, config->http_threads, db, request_reload);
 
   while (running_flag.load()) {
-    std::unique_lock<std::mutex> lock(running_mutex);
-    running_condition.wait(lock, []{ return !running_flag.load(); });
+    char drain[64];
+    if (read(wake_pipe[0], drain, sizeof drain) < 0 && errno != EINTR) {
+      break;
+    }
+    if (reload_flag.exchange(false) && running_flag.load()) {
+      reload(db, server);
+    }
   }
 
   return 0;
@@ -0,0 +1,55 @@
+#ifndef PUBLISHED_H
+#define PUBLISHED_H
+
+#include <memory> // std::shared_ptr
+#include <atomic> // std::atomic
+#include <mutex> // std::mutex, std::unique_lock
+
+#include <cstdint> // uint64_t
+
+// An immutable value read on every request and replaced now and then.
+// Each thread keeps the last snapshot it read and only goes to the shared
+// one, under the lock, after publish() moved the version on, so the
+// common read is a single atomic load. A replaced snapshot lives on until
+// every thread that held it has read again or exited.
+template<typename T>
+struct Published
+{
+  explicit Published(std::shared_ptr<const T> value)
+    : m_value   { std::move(value) }
+    , m_version { 1 }
+  {
+  }
+
+  std::shared_ptr<const T> get() const {
+    thread_local Cached t_cached;
+    const uint64_t version = m_version.load(std::memory_order_acquire);
+    if (t_cached.owner != this || t_cached.version != version) {
+      std::unique_lock<std::mutex> lock(m_mutex);
+      t_cached.owner = this;
+      t_cached.version = m_version.load(std::memory_order_relaxed);
+      t_cached.value = m_value;
+    }
+    return t_cached.value;
+  }
+
+  void publish(std::shared_ptr<const T> value) {
+    std::unique_lock<std::mutex> lock(m_mutex);
+    m_value = std::move(value);
+    m_version.fetch_add(1, std::memory_order_release);
+  }
+
+private:
+  struct Cached
+  {
+    const Published *owner = nullptr;
+    uint64_t version = 0;
+    std::shared_ptr<const T> value;
+  };
+
+  mutable std::mutex m_mutex;
+  std::shared_ptr<const T> m_value; // Guarded by m_mutex
+  std::atomic<uint64_t> m_version;
+};
+
+#endif
@@ -0,0 +1,148 @@
+#include <condition_variable> // std::condition_variable
+#include <thread> // std::thread
+#include <chrono> // std::chrono::system_clock
+#include <mutex> // std::mutex, std::unique_lock
+
+#include <ctime> // gmtime_r, strftime
+
+#include "response.h"
+#include "published.h"
+
+struct StatusLine
+{
+  int status;
+  std::string_view line;
+};
+
+static constexpr StatusLine k_status[] = {
+  { 101, "HTTP/1.1 101 Switching Protocols\r\n" },
+  { 200, "HTTP/1.1 200 OK\r\n" },
+  { 304, "HTTP/1.1 304 Not Modified\r\n" },
+  { 400, "HTTP/1.1 400 Bad Request\r\n" },
+  { 403, "HTTP/1.1 403 Forbidden\r\n" },
+  { 404, "HTTP/1.1 404 Not Found\r\n" },
+  { 405, "HTTP/1.1 405 Method Not Allowed\r\n" },
+  { 500, "HTTP/1.1 500 Internal Server Error\r\n" },
+  { 503, "HTTP/1.1 503 Service Unavailable\r\n" },
+};
+
+struct FixedResponse
+{
+  int status;
+  std::vector<std::string> fields;
+};
+
+static const FixedResponse k_fixed[Response::FIXED_COUNT] = {
+  { 200, { "Refresh: 0; url=/" } },
+  { 404, { } },
+  { 503, { "Retry-After: 1" } },
+  { 400, { } },
+  { 403, { } },
+};
+
+std::string_view Response::status_line(int status) {
+  for (const auto &entry : k_status) {
+    if (entry.status == status) {
+      return entry.line;
+    }
+  }
+  return {};
+}
+
+std::string_view Response::status_text(int status) {
+  auto line = status_line(status);
+  if (line.empty()) {
+    return line;
+  }
+  // Strip "HTTP/1.1 " and the trailing "\r\n"
+  line.remove_prefix(9);
+  line.remove_suffix(2);
+  return line;
+}
+
+int Response::fixed_status(Fixed which) {
+  return k_fixed[which].status;
+}
+
+const std::vector<std::string>& Response::fixed_fields(Fixed which) {
+  return k_fixed[which].fields;
+}
+
+static std::shared_ptr<const Response::Snapshot> build_snapshot() {
+  auto snapshot = std::make_shared<Response::Snapshot>();
+
+  const auto now = std::chrono::system_clock::to_time_t(std::chrono::system_clock::now());
+  struct tm time;
+  gmtime_r(&now, &time);
+  char date[64];
+  strftime(date, sizeof date, "%a, %d %b %Y %H:%M:%S GMT", &time);
+  snapshot->date = date;
+  snapshot->date_line = "Date: " + snapshot->date + "\r\n";
+
+  for (int i = 0; i < Response::FIXED_COUNT; i++) {
+    const auto &fixed = k_fixed[i];
+    auto &contents = snapshot->fixed[i];
+    contents += Response::status_line(fixed.status);
+    contents += Response::k_server;
+    contents += snapshot->date_line;
+    contents += "Content-Length: 0\r\n";
+    for (const auto &field : fixed.fields) {
+      contents += field;
+      contents += "\r\n";
+    }
+    contents += "\r\n";
+  }
+
+  return snapshot;
+}
+
+// Rebuilds the snapshot every second, started on first use
+struct Clock
+{
+  Clock()
+    : m_snapshot { build_snapshot() }
+    , m_running  { true }
+    , m_thread   { &Clock::clock_thread, this }
+  {
+  }
+
+  ~Clock() {
+    {
+      std::unique_lock<std::mutex> lock(m_mutex);
+      m_running = false;
+    }
+    m_condition.notify_one();
+    if (m_thread.joinable()) {
+      m_thread.join();
+    }
+  }
+
+  std::shared_ptr<const Response::Snapshot> snapshot() const {
+    return m_snapshot.get();
+  }
+
+private:
+  void clock_thread() {
+    std::unique_lock<std::mutex> lock(m_mutex);
+    while (m_running) {
+      // Wake on the next second boundary so the date is never a second stale
+      const auto now = std::chrono::system_clock::now();
+      const auto next = std::chrono::ceil<std::chrono::seconds>(now + std::chrono::milliseconds(1));
+      if (m_condition.wait_until(lock, next, [this] { return !m_running; })) {
+        break;
+      }
+      m_snapshot.publish(build_snapshot());
+    }
+  }
+
+  Published<Response::Snapshot> m_snapshot;
+  std::mutex m_mutex;
+  std::condition_variable m_condition;
+  bool m_running;
+  std::thread m_thread;
+};
+
+std::shared_ptr<const Response::Snapshot> Response::snapshot() {
+  static Clock clock;
+  return clock.snapshot();
+}
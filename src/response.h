@@ -0,0 +1,49 @@
+#ifndef RESPONSE_H
+#define RESPONSE_H
+
+#include <string_view> // std::string_view
+#include <memory> // std::shared_ptr
+#include <string> // std::string
+#include <vector> // std::vector
+
+// Pre-serialized pieces of HTTP/1.1 responses. Status lines and common
+// header lines are built once at compile time, the Date header and the
+// complete bytes of fixed responses are rebuilt once a second by a clock
+// thread so writing them is a single send.
+struct Response
+{
+  enum Fixed {
+    REDIRECT, // Refresh to /
+    NOT_FOUND,
+    UNAVAILABLE,
+    BAD_REQUEST,
+    FORBIDDEN, // No session
+    FIXED_COUNT
+  };
+
+  struct Snapshot
+  {
+    std::string date; // "Sun, 06 Nov 1994 08:49:37 GMT"
+    std::string date_line; // "Date: Sun, 06 Nov 1994 08:49:37 GMT\r\n"
+    std::string fixed[FIXED_COUNT];
+  };
+
+  static constexpr std::string_view k_server = "Server: ElastCI\r\n";
+  static constexpr std::string_view k_html = "Content-Type: text/html; charset=utf-8\r\n";
+  static constexpr std::string_view k_chunked = "Transfer-Encoding: chunked\r\n";
+
+  // "HTTP/1.1 404 Not Found\r\n", empty for unknown status codes
+  static std::string_view status_line(int status);
+
+  // "404 Not Found"
+  static std::string_view status_text(int status);
+
+  // Thread safe, the snapshot stays valid for as long as it's held
+  static std::shared_ptr<const Snapshot> snapshot();
+
+  // Description of fixed responses for framings other than HTTP/1.1
+  static int fixed_status(Fixed which);
+  static const std::vector<std::string>& fixed_fields(Fixed which);
+};
+
+#endif
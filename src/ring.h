@@ -0,0 +1,100 @@
+#ifndef RING_H
+#define RING_H
+
+#include <atomic> // std::atomic
+#include <cstddef> // size_t
+#include <cstdint> // intptr_t
+
+// Bounded lock free queue of N preallocated slots, safe for any number of
+// producers and consumers. Each slot carries a sequence number telling
+// whether it's ready to be written or read for the current lap, so a
+// push or pop is one compare-and-swap on the shared position and never
+// allocates. See Dmitry Vyukov's bounded MPMC queue.
+template<typename T, size_t N>
+struct Ring
+{
+  Ring();
+
+  // False when full
+  bool push(const T& value);
+
+  // False when empty, or when the next slot is claimed but not written yet
+  bool pop(T& value);
+
+  // Only a hint while other threads push and pop
+  bool empty() const;
+
+private:
+  static_assert(N >= 2 && (N & (N - 1)) == 0, "Ring size must be a power of two");
+
+  struct Slot
+  {
+    std::atomic<size_t> sequence;
+    T value;
+  };
+
+  // Producers and consumers each get their own cache line
+  alignas(64) Slot m_slots[N];
+  alignas(64) std::atomic<size_t> m_push;
+  alignas(64) std::atomic<size_t> m_pop;
+};
+
+template<typename T, size_t N>
+inline Ring<T, N>::Ring()
+  : m_push { 0 }
+  , m_pop  { 0 }
+{
+  for (size_t i = 0; i < N; i++) {
+    m_slots[i].sequence.store(i, std::memory_order_relaxed);
+  }
+}
+
+template<typename T, size_t N>
+inline bool Ring<T, N>::push(const T& value) {
+  size_t position = m_push.load(std::memory_order_relaxed);
+  for (;;) {
+    Slot& slot = m_slots[position & (N - 1)];
+    const size_t sequence = slot.sequence.load(std::memory_order_acquire);
+    const auto difference = static_cast<intptr_t>(sequence) - static_cast<intptr_t>(position);
+    if (difference == 0) {
+      if (m_push.compare_exchange_weak(position, position + 1, std::memory_order_relaxed)) {
+        slot.value = value;
+        slot.sequence.store(position + 1, std::memory_order_release);
+        return true;
+      }
+    } else if (difference < 0) {
+      // Still holds a value from the last lap
+      return false;
+    } else {
+      position = m_push.load(std::memory_order_relaxed);
+    }
+  }
+}
+
+template<typename T, size_t N>
+inline bool Ring<T, N>::pop(T& value) {
+  size_t position = m_pop.load(std::memory_order_relaxed);
+  for (;;) {
+    Slot& slot = m_slots[position & (N - 1)];
+    const size_t sequence = slot.sequence.load(std::memory_order_acquire);
+    const auto difference = static_cast<intptr_t>(sequence) - static_cast<intptr_t>(position + 1);
+    if (difference == 0) {
+      if (m_pop.compare_exchange_weak(position, position + 1, std::memory_order_relaxed)) {
+        value = slot.value;
+        slot.sequence.store(position + N, std::memory_order_release);
+        return true;
+      }
+    } else if (difference < 0) {
+      return false;
+    } else {
+      position = m_pop.load(std::memory_order_relaxed);
+    }
+  }
+}
+
+template<typename T, size_t N>
+inline bool Ring<T, N>::empty() const {
+  return m_push.load() == m_pop.load();
+}
+
+#endif
@@ -0,0 +1,423 @@
+#include <algorithm> // std::sort, std::partition_point, std::max
+#include <atomic> // std::atomic
+
+#include <cerrno> // errno
+#include <cstdlib> // std::strtoll
+#include <cstring> // std::memcpy, std::memset
+#include <cstdio> // std::snprintf
+
+#include <dirent.h> // opendir, readdir
+#include <fcntl.h> // open
+#include <sys/mman.h> // mmap, msync
+#include <sys/stat.h> // mkdir, fstat
+#include <unistd.h> // close, ftruncate, fdatasync, unlink
+
+#include <zlib.h> // crc32
+
+#include "segmentlog.h"
+
+// Before the contents of every record, which are padded so the next
+// header is aligned. Ids go up by one from the first record of a segment,
+// so zeroes or a torn write never pass for a record.
+struct Header
+{
+  uint32_t size;
+  uint32_t checksum; // Of the rest of the header and the contents
+  int64_t timestamp;
+  int64_t id;
+};
+
+static_assert(sizeof(Header) == 24, "Header is stored as is");
+
+// The sparse index, stored as is
+struct IndexEntry
+{
+  int64_t timestamp;
+  int64_t id;
+  uint64_t offset; // Of the record in the segment
+};
+
+struct SegmentLog::Segment
+{
+  ~Segment();
+
+  std::string path; // Without the extension
+  int fd = -1;
+  int index_fd = -1;
+  char *data = nullptr;
+  size_t capacity = 0; // Bytes mapped
+  int64_t first_id = 0;
+  int64_t next_id = 0; // Writer only
+  std::atomic<size_t> used{ 0 }; // Bytes of whole records, stored once they're written
+  std::atomic<int64_t> last_timestamp{ INT64_MIN };
+  size_t indexed = 0; // Offset of the last index entry, writer only
+  size_t synced = 0; // Writer only
+  std::vector<IndexEntry> index; // Guarded by SegmentLog::m_mutex
+};
+
+SegmentLog::Segment::~Segment() {
+  if (data) {
+    munmap(data, capacity);
+  }
+  if (fd >= 0) {
+    close(fd);
+  }
+  if (index_fd >= 0) {
+    close(index_fd);
+  }
+}
+
+static size_t padded(size_t size) {
+  return (sizeof(Header) + size + 7) & ~size_t(7);
+}
+
+static uint32_t checksum(const Header& header, std::string_view contents) {
+  uLong crc = crc32(0, reinterpret_cast<const Bytef *>(&header.timestamp), sizeof header.timestamp + sizeof header.id);
+  crc = crc32(crc, reinterpret_cast<const Bytef *>(&header.size), sizeof header.size);
+  crc = crc32(crc, reinterpret_cast<const Bytef *>(contents.data()), contents.size());
+  return static_cast<uint32_t>(crc);
+}
+
+SegmentLog::SegmentLog(std::string directory)
+  : m_directory      { std::move(directory) }
+  , m_next_id        { 1 }
+  , m_last_timestamp { INT64_MIN }
+  , m_created        { false }
+{
+}
+
+SegmentLog::~SegmentLog() {
+  sync();
+}
+
+std::unique_ptr<SegmentLog> SegmentLog::open(const std::string& directory, int64_t last_id, int64_t last_timestamp) {
+  if (mkdir(directory.c_str(), 0755) != 0 && errno != EEXIST) {
+    return nullptr;
+  }
+
+  DIR *dir = opendir(directory.c_str());
+  if (!dir) {
+    return nullptr;
+  }
+  std::vector<std::string> names;
+  while (const dirent *entry = readdir(dir)) {
+    const std::string_view name = entry->d_name;
+    if (name.size() > 4 && name.substr(name.size() - 4) == ".seg") {
+      names.emplace_back(name.substr(0, name.size() - 4));
+    }
+  }
+  closedir(dir);
+
+  // Zero padded, so this is by first id
+  std::sort(names.begin(), names.end());
+
+  std::unique_ptr<SegmentLog> log(new SegmentLog(directory));
+  for (const auto &name : names) {
+    auto segment = std::make_shared<Segment>();
+    segment->path = directory + "/" + name;
+    segment->first_id = std::strtoll(name.c_str(), nullptr, 10);
+    segment->fd = ::open((segment->path + ".seg").c_str(), O_RDWR);
+    segment->index_fd = ::open((segment->path + ".idx").c_str(), O_RDWR | O_CREAT | O_APPEND, 0644);
+    struct stat status;
+    if (segment->fd < 0 || segment->index_fd < 0 || fstat(segment->fd, &status) != 0) {
+      return nullptr;
+    }
+
+    segment->capacity = status.st_size;
+    if (segment->capacity) {
+      void *data = mmap(nullptr, segment->capacity, PROT_READ | PROT_WRITE, MAP_SHARED, segment->fd, 0);
+      if (data == MAP_FAILED) {
+        return nullptr;
+      }
+      segment->data = static_cast<char *>(data);
+    }
+
+    // A partial entry at the end was cut short by a crash
+    if (fstat(segment->index_fd, &status) != 0) {
+      return nullptr;
+    }
+    segment->index.resize(status.st_size / sizeof(IndexEntry));
+    const ssize_t bytes = segment->index.size() * sizeof(IndexEntry);
+    if (pread(segment->index_fd, segment->index.data(), bytes, 0) != bytes ||
+        (status.st_size % sizeof(IndexEntry) && ftruncate(segment->index_fd, bytes) != 0))
+    {
+      return nullptr;
+    }
+
+    // Indexed records are trusted, the rest have to check out
+    size_t offset = segment->index.empty() ? 0 : segment->index.back().offset;
+    int64_t id = segment->index.empty() ? segment->first_id : segment->index.back().id;
+    while (offset + sizeof(Header) <= segment->capacity) {
+      Header header;
+      std::memcpy(&header, segment->data + offset, sizeof header);
+      if (header.id != id || padded(header.size) > segment->capacity - offset ||
+          header.checksum != checksum(header, { segment->data + offset + sizeof header, header.size }))
+      {
+        break;
+      }
+      segment->last_timestamp.store(header.timestamp);
+      offset += padded(header.size);
+      id++;
+    }
+
+    segment->used.store(offset);
+    segment->next_id = id;
+    segment->synced = offset;
+    segment->indexed = segment->index.empty() ? 0 : segment->index.back().offset;
+    log->m_next_id = id;
+    log->m_last_timestamp = std::max(log->m_last_timestamp, segment->last_timestamp.load());
+    log->m_segments.push_back(std::move(segment));
+  }
+
+  // A gap in the ids starts a new segment, see append()
+  log->m_next_id = std::max(log->m_next_id, last_id + 1);
+  log->m_last_timestamp = std::max(log->m_last_timestamp, last_timestamp);
+  return log;
+}
+
+bool SegmentLog::empty() const {
+  std::unique_lock<std::mutex> lock(m_mutex);
+  return m_segments.empty();
+}
+
+std::shared_ptr<SegmentLog::Segment> SegmentLog::create_segment() {
+  char name[32];
+  std::snprintf(name, sizeof name, "/%016lld", static_cast<long long>(m_next_id));
+
+  auto segment = std::make_shared<Segment>();
+  segment->path = m_directory + name;
+  segment->first_id = m_next_id;
+  segment->next_id = m_next_id;
+  segment->fd = ::open((segment->path + ".seg").c_str(), O_RDWR | O_CREAT | O_TRUNC, 0644);
+  segment->index_fd = ::open((segment->path + ".idx").c_str(), O_RDWR | O_CREAT | O_TRUNC | O_APPEND, 0644);
+  if (segment->fd < 0 || segment->index_fd < 0 || ftruncate(segment->fd, k_segment_size) != 0) {
+    unlink((segment->path + ".seg").c_str());
+    unlink((segment->path + ".idx").c_str());
+    return nullptr;
+  }
+
+  void *data = mmap(nullptr, k_segment_size, PROT_READ | PROT_WRITE, MAP_SHARED, segment->fd, 0);
+  if (data == MAP_FAILED) {
+    unlink((segment->path + ".seg").c_str());
+    unlink((segment->path + ".idx").c_str());
+    return nullptr;
+  }
+  segment->data = static_cast<char *>(data);
+  segment->capacity = k_segment_size;
+  m_created = true;
+  return segment;
+}
+
+// Syncs what's left of a full segment and gives back the space it didn't
+// use, readers never look past used so the mapping can stay
+bool SegmentLog::seal(Segment& segment) {
+  const size_t used = segment.used.load();
+  if (!sync()) {
+    return false;
+  }
+  return ftruncate(segment.fd, used) == 0 && fsync(segment.fd) == 0;
+}
+
+bool SegmentLog::append(int64_t timestamp, std::string_view contents) {
+  const size_t size = padded(contents.size());
+  if (size > k_segment_size) {
+    return false;
+  }
+
+  // Ids within a segment go up by one, recovery counts on it
+  Segment *segment = m_segments.empty() ? nullptr : m_segments.back().get();
+  if (!segment || segment->used.load() + size > segment->capacity || segment->next_id != m_next_id) {
+    if (segment && !seal(*segment)) {
+      return false;
+    }
+    auto created = create_segment();
+    if (!created) {
+      return false;
+    }
+    segment = created.get();
+    std::unique_lock<std::mutex> lock(m_mutex);
+    m_segments.push_back(std::move(created));
+  }
+
+  timestamp = std::max(timestamp, m_last_timestamp);
+
+  const size_t offset = segment->used.load();
+  Header header{ static_cast<uint32_t>(contents.size()), 0, timestamp, m_next_id };
+  header.checksum = checksum(header, contents);
+  char *record = segment->data + offset;
+  std::memcpy(record, &header, sizeof header);
+  std::memcpy(record + sizeof header, contents.data(), contents.size());
+  // Whatever a torn write left behind shouldn't linger in the padding
+  std::memset(record + sizeof header + contents.size(), 0, size - sizeof header - contents.size());
+
+  if (offset == 0 || offset - segment->indexed >= k_index_interval) {
+    // Only a hint, a lost entry makes the index sparser and nothing worse
+    const IndexEntry entry{ timestamp, m_next_id, offset };
+    if (write(segment->index_fd, &entry, sizeof entry) == sizeof entry) {
+      std::unique_lock<std::mutex> lock(m_mutex);
+      segment->index.push_back(entry);
+      segment->indexed = offset;
+    }
+  }
+
+  segment->next_id = m_next_id + 1;
+  segment->last_timestamp.store(timestamp);
+  segment->used.store(offset + size, std::memory_order_release);
+  m_last_timestamp = timestamp;
+  m_next_id++;
+  return true;
+}
+
+bool SegmentLog::sync() {
+  bool synced = true;
+  if (!m_segments.empty()) {
+    Segment& segment = *m_segments.back();
+    const size_t used = segment.used.load();
+    if (used > segment.synced) {
+      static const size_t page = sysconf(_SC_PAGESIZE);
+      const size_t start = segment.synced / page * page;
+      synced = msync(segment.data + start, used - start, MS_SYNC) == 0 && fdatasync(segment.index_fd) == 0;
+      if (synced) {
+        segment.synced = used;
+      }
+    }
+  }
+
+  // A new file only survives a crash once its directory entry does
+  if (m_created) {
+    const int dir = ::open(m_directory.c_str(), O_RDONLY | O_DIRECTORY);
+    synced = dir >= 0 && fsync(dir) == 0 && synced;
+    if (dir >= 0) {
+      close(dir);
+    }
+    m_created = !synced;
+  }
+  return synced;
+}
+
+size_t SegmentLog::expire(int64_t cutoff) {
+  std::vector<std::shared_ptr<Segment>> expired;
+  {
+    std::unique_lock<std::mutex> lock(m_mutex);
+    while (m_segments.size() > 1 && m_segments.front()->last_timestamp.load() < cutoff) {
+      expired.push_back(std::move(m_segments.front()));
+      m_segments.erase(m_segments.begin());
+    }
+  }
+
+  // Scans still holding on keep the mapping until they're done
+  for (const auto &segment : expired) {
+    unlink((segment->path + ".seg").c_str());
+    unlink((segment->path + ".idx").c_str());
+  }
+  return expired.size();
+}
+
+bool SegmentLog::scan(int64_t from, int64_t to, int64_t after, FunctionRef<bool(const Record&)> each) const {
+  // Where to start in each segment that may have something
+  std::vector<std::pair<std::shared_ptr<Segment>, size_t>> starts;
+  {
+    std::unique_lock<std::mutex> lock(m_mutex);
+    for (size_t i = 0; i < m_segments.size(); i++) {
+      const auto& segment = m_segments[i];
+      if (segment->last_timestamp.load() < from) {
+        continue;
+      }
+      if (i + 1 < m_segments.size() && m_segments[i + 1]->first_id - 1 <= after) {
+        continue;
+      }
+      if (!segment->index.empty() && segment->index.front().timestamp >= to) {
+        break;
+      }
+
+      // Timestamps and ids only go up, everything before the last entry
+      // that's too old or already seen is as well
+      const auto entry = std::partition_point(segment->index.begin(), segment->index.end(), [&](const IndexEntry& entry) {
+        return entry.timestamp < from || entry.id <= after;
+      });
+      starts.emplace_back(segment, entry == segment->index.begin() ? 0 : (entry - 1)->offset);
+    }
+  }
+
+  for (auto &[segment, offset] : starts) {
+    const size_t used = segment->used.load(std::memory_order_acquire);
+    while (offset + sizeof(Header) <= used) {
+      Header header;
+      std::memcpy(&header, segment->data + offset, sizeof header);
+      if (header.timestamp >= to) {
+        return true;
+      }
+      if (header.timestamp >= from && header.id > after) {
+        const Record record{ header.id, header.timestamp, { segment->data + offset + sizeof header, header.size } };
+        if (!each(record)) {
+          return true;
+        }
+      }
+      offset += padded(header.size);
+    }
+  }
+  return true;
+}
+
+bool SegmentLog::scan_back(int64_t timestamp, int64_t id, FunctionRef<bool(const Record&)> each) const {
+  auto before = [&](int64_t record_timestamp, int64_t record_id) {
+    return record_timestamp < timestamp || (record_timestamp == timestamp && record_id < id);
+  };
+
+  // Newest segment first, each with the offsets the stretches that may
+  // have something start at and where the last one ends
+  struct Stretches
+  {
+    std::shared_ptr<Segment> segment;
+    std::vector<size_t> starts;
+    size_t end;
+  };
+  std::vector<Stretches> segments;
+  {
+    std::unique_lock<std::mutex> lock(m_mutex);
+    for (size_t i = m_segments.size(); i-- > 0;) {
+      const auto& segment = m_segments[i];
+      const auto& index = segment->index;
+      // Records at or past the first entry not before the cursor aren't either
+      const auto entry = std::partition_point(index.begin(), index.end(), [&](const IndexEntry& entry) {
+        return before(entry.timestamp, entry.id);
+      });
+      Stretches stretches{ segment, {}, entry == index.end() ? segment->used.load() : entry->offset };
+      if (index.empty() || index.front().offset != 0) {
+        stretches.starts.push_back(0);
+      }
+      for (auto start = index.begin(); start != entry; ++start) {
+        stretches.starts.push_back(start->offset);
+      }
+      if (!stretches.starts.empty()) {
+        segments.push_back(std::move(stretches));
+      }
+    }
+  }
+
+  std::vector<Record> records;
+  for (const auto &stretches : segments) {
+    const Segment& segment = *stretches.segment;
+    const size_t used = segment.used.load(std::memory_order_acquire);
+    size_t end = std::min(stretches.end, used);
+    for (size_t i = stretches.starts.size(); i-- > 0;) {
+      records.clear();
+      for (size_t offset = stretches.starts[i]; offset + sizeof(Header) <= end;) {
+        Header header;
+        std::memcpy(&header, segment.data + offset, sizeof header);
+        if (!before(header.timestamp, header.id)) {
+          break;
+        }
+        records.push_back({ header.id, header.timestamp, { segment.data + offset + sizeof header, header.size } });
+        offset += padded(header.size);
+      }
+      for (auto record = records.rbegin(); record != records.rend(); ++record) {
+        if (!each(*record)) {
+          return true;
+        }
+      }
+      end = stretches.starts[i];
+    }
+  }
+  return true;
+}
@@ -0,0 +1,93 @@
+#ifndef SEGMENTLOG_H
+#define SEGMENTLOG_H
+
+#include <string_view> // std::string_view
+#include <string> // std::string
+#include <memory> // std::unique_ptr, std::shared_ptr
+#include <vector> // std::vector
+#include <mutex> // std::mutex
+
+#include <cstddef> // size_t
+#include <cstdint> // int64_t
+
+#include "database.h"
+
+// Append only store for log records, for when rows in SQLite are the
+// wrong shape for data that is written constantly and read rarely.
+// Records go one after the other into memory mapped segment files of
+// k_segment_size, named after the id of their first record. Every
+// k_index_interval bytes the position of a record is noted in a sparse
+// index file next to the segment, which is all a time range scan needs
+// to find where to start. Durability comes from sync(), one msync and
+// fdatasync for however many records were appended since the last.
+struct SegmentLog
+{
+  struct Record
+  {
+    int64_t id;
+    int64_t timestamp;
+    std::string_view contents; // Into the mapping, only valid in the callback
+  };
+
+  // Opens the segments in directory, creating it if need be. The end of
+  // the last segment is found by checking records after its last index
+  // entry, a record torn by a crash ends it. Ids and timestamps carry on
+  // after last_id and last_timestamp where those are ahead, for records
+  // that were kept somewhere else before.
+  static std::unique_ptr<SegmentLog> open(const std::string& directory, int64_t last_id, int64_t last_timestamp);
+
+  // Syncs whatever is left
+  ~SegmentLog();
+
+  // One writer only. Timestamps never go backwards in the store, a record
+  // that lost the race for the queue takes the timestamp of the one
+  // before it. False when it doesn't fit a segment or a new segment
+  // can't be created.
+  bool append(int64_t timestamp, std::string_view contents);
+
+  // One writer only, makes every record appended so far durable
+  bool sync();
+
+  // One writer only, drops segments whose records are all older than
+  // cutoff, returning how many. The active segment is kept.
+  size_t expire(int64_t cutoff);
+
+  // Thread safe, records with from <= timestamp < to and an id above
+  // after, oldest first. Return false from each() to stop early.
+  bool scan(int64_t from, int64_t to, int64_t after, FunctionRef<bool(const Record&)> each) const;
+
+  // Thread safe, records before (timestamp, id), newest first. Each
+  // stretch between two index entries is read forward and handed out
+  // backwards.
+  bool scan_back(int64_t timestamp, int64_t id, FunctionRef<bool(const Record&)> each) const;
+
+  // No segment was ever created
+  bool empty() const;
+
+  // Next id to be appended
+  int64_t next_id() const { return m_next_id; }
+
+  static constexpr size_t k_segment_size = 64 * 1024 * 1024;
+  static constexpr size_t k_index_interval = 64 * 1024;
+
+private:
+  struct Segment;
+
+  SegmentLog(std::string directory);
+
+  std::shared_ptr<Segment> create_segment();
+  bool seal(Segment& segment);
+
+  std::string m_directory;
+  int64_t m_next_id;
+  int64_t m_last_timestamp;
+  bool m_created; // A segment file was created since the last sync
+
+  // Oldest first, the last one is appended to. Readers copy the list and
+  // look up the index under the mutex, the mappings stay valid for as
+  // long as they hold on to a segment.
+  mutable std::mutex m_mutex;
+  std::vector<std::shared_ptr<Segment>> m_segments;
+};
+
+#endif
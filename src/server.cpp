@@ -1,30 +1,163 @@
 #include <sstream> // std::istringstream, std::getline
+#include <algorithm> // std::min, std::max, std::find, std::find_if
 #include <regex> // std::regex, std::regex_search, std::smatch
 
 #include "server.h"
 #include "session.h"
 #include "database.h"
 #include "utility.h"
+#include "channel.h"
+#include "websocket.h"
+#include "http2.h"
+#include "buildlog.h"
+#include "config.h"
 
 #include <cstring> // std::memset
+#include <cstdlib> // std::strtoull, std::strtoll
+#include <cstdint> // INT64_MAX
+
+// Where /api/backup?start writes, next to the database
+static constexpr const char k_backup_path[] = "backup.db";
+
+// Bounds on /api/changes
+static constexpr size_t k_changes_page = 1000;
+static constexpr auto k_changes_max_wait = std::chrono::seconds(30);
+
+// How long the feed thread waits for changes before checking m_running
+static constexpr auto k_feed_wait = std::chrono::milliseconds(250);
+
+// cursor and limit of the paged listings, false when the cursor is not
+// one we handed out
+static bool page_parameters(const std::unordered_map<std::string, std::string>& params,
+                            Database::Cursor& cursor,
+                            size_t& limit)
+{
+  const auto config = Config::current();
+  limit = config->list_page;
+  const auto find_limit = params.find("limit");
+  if (find_limit != params.end()) {
+    char *end = nullptr;
+    const auto value = std::strtoll(find_limit->second.c_str(), &end, 10);
+    if (!*end && value > 0) {
+      limit = std::min<size_t>(value, config->max_list_page);
+    }
+  }
+
+  const auto find_cursor = params.find("cursor");
+  if (find_cursor == params.end()) {
+    cursor = {};
+    return true;
+  }
+  const auto decoded = Database::Cursor::decode(find_cursor->second);
+  if (decoded) {
+    cursor = *decoded;
+  }
+  return decoded.has_value();
+}
+
+static std::string next_json(const std::optional<Database::Cursor>& next) {
+  return next ? "\"" + next->encode() + "\"" : "null";
+}
+
+// A row of SELECT id, project_id, status, start_timestamp, end_timestamp
+// FROM builds, what /api/builds lists and the "builds" channel pushes
+static std::string build_json(const Database::Row& row) {
+  std::string json;
+  json += "{\"id\":" + std::to_string(row.integer(0));
+  json += ",\"project_id\":" + std::to_string(row.integer(1));
+  json += ",\"status\":" + std::to_string(row.integer(2));
+  json += ",\"start_timestamp\":" + std::to_string(row.integer(3));
+  json += ",\"end_timestamp\":";
+  json += row.null(4) ? "null" : std::to_string(row.integer(4));
+  json += "}";
+  return json;
+}
+
+static std::string change_json(const Database::Change& change) {
+  std::string json;
+  json += "{\"sequence\":" + std::to_string(change.sequence);
+  json += ",\"timestamp\":" + std::to_string(change.timestamp);
+  json += ",\"table\":\"" + json_escape(change.table) + "\"";
+  json += ",\"row\":" + std::to_string(change.row);
+  json += ",\"operation\":\"" + json_escape(change.operation) + "\"";
+  json += "}";
+  return json;
+}
+
+// Name of the cookie do_login() hands out
+static constexpr std::string_view k_session_cookie = "session";
+
+// The session token among the cookies of a request, empty without one
+static std::string session_token(const std::unordered_map<std::string, std::string>& header_fields) {
+  const auto cookies = header_fields.find("cookie");
+  if (cookies == header_fields.end()) {
+    return {};
+  }
+  std::istringstream stream(cookies->second);
+  std::string crumb;
+  while (std::getline(stream, crumb, ';')) {
+    const size_t start = crumb.find_first_not_of(' ');
+    if (start != std::string::npos &&
+        crumb.compare(start, k_session_cookie.size(), k_session_cookie) == 0 &&
+        crumb.size() > start + k_session_cookie.size() &&
+        crumb[start + k_session_cookie.size()] == '=')
+    {
+      return crumb.substr(start + k_session_cookie.size() + 1);
+    }
+  }
+  return {};
+}
 
 bool Server::client_thread() {
-  while (m_running.load()) {
+  for (;;) {
     Client client;
+    std::function<void()> task;
     {
       std::unique_lock<std::mutex> lock(m_mutex);
+      m_idle_threads++;
       m_condition.wait(lock, [this] {
-          return !m_running.load() || !m_clients.empty();
+          return !m_running.load() || !m_clients.empty() || !m_tasks.empty() || m_live_threads > m_thread_count;
       });
-      if (!m_running.load() && m_clients.empty()) {
+      m_idle_threads--;
+      // Streams first, their connections are waiting on them whatever
+      // else happens
+      if (!m_tasks.empty()) {
+        task = std::move(m_tasks.front());
+        m_tasks.pop();
+      } else if (m_live_threads > m_thread_count) {
+        // The pool shrank, whichever thread is idle first goes and is
+        // joined by the next set_threads()
+        m_live_threads--;
+        m_retired.push_back(std::this_thread::get_id());
+        return true;
+      } else if (m_clients.empty()) {
         return true;
+      } else {
+        client = std::move(m_clients.front());
+        m_clients.pop();
       }
-      client = std::move(m_clients.front());
-      m_clients.pop();
     }
-    handle(std::move(client));
+    if (task) {
+      task();
+    } else {
+      handle(std::move(client));
+    }
   }
-  return false;
+}
+
+bool Server::offload(std::function<void()>&& task) {
+  {
+    std::unique_lock<std::mutex> lock(m_mutex);
+    // Only to a thread that would otherwise sit idle, taking one a queued
+    // connection is waiting for could leave the pool busy with HTTP/2
+    // connections waiting on their own streams
+    if (m_idle_threads <= m_tasks.size() + m_clients.size()) {
+      return false;
+    }
+    m_tasks.push(std::move(task));
+  }
+  m_condition.notify_one();
+  return true;
 }
 
 bool Server::server_thread() {
@@ -39,9 +172,19 @@ bool Server::server_thread() {
   while (m_running.load()) {
     auto client = accept();
     if (client) {
+      // Accepted connections waiting on a thread beyond this are turned away
+      const size_t max_queued = Config::current()->max_queued_clients;
       {
         std::unique_lock<std::mutex> lock(m_mutex);
-        m_clients.emplace(std::move(*client));
+        if (m_clients.size() < max_queued) {
+          m_clients.emplace(std::move(*client));
+          client = std::nullopt;
+        }
+      }
+      if (client) {
+        // Shed load rather than queue without bound
+        client->write_fixed(Response::UNAVAILABLE);
+        continue;
       }
       m_condition.notify_one();
     }
@@ -50,17 +193,97 @@ bool Server::server_thread() {
   return true;
 }
 
-Server::Server(uint16_t port, size_t threads, Database& db)
-  : m_running  { true }
-  , m_thread   { &Server::server_thread, this }
-  , m_sessions { new SessionManager }
-  , m_port     { port }
-  , m_db       { db }
+void Server::feed_thread() {
+  // Subscribers get what happens from now on, they read /api/builds first
+  int64_t last = m_db.last_change();
+  while (m_running.load()) {
+    if (!m_db.wait_changes(last, k_feed_wait)) {
+      continue;
+    }
+
+    // The dashboard wants the build as it is now, once however often it
+    // changed. Deleted builds have nothing to show.
+    std::vector<int64_t> builds;
+    const bool read = m_db.changes(last, k_changes_page, [&](const Database::Change& change) {
+      last = change.sequence;
+      if (change.table == "builds" && std::find(builds.begin(), builds.end(), change.row) == builds.end()) {
+        builds.push_back(change.row);
+      }
+      return true;
+    });
+    if (!read) {
+      m_db.log_system("Failed to read changes for the builds feed");
+      std::this_thread::sleep_for(k_feed_wait);
+      continue;
+    }
+
+    for (const int64_t build : builds) {
+      const bool found = m_find_build && m_db.query_rows(
+        *m_find_build,
+        [&](const Database::Row& row) {
+          broadcast("builds", build_json(row));
+          return true;
+        },
+        build);
+      if (!found) {
+        m_db.log_system("Failed to read build " + std::to_string(build) + " for the builds feed");
+      }
+    }
+  }
+}
+
+Server::Server(uint16_t port, size_t threads, Database& db, std::function<void()> reload)
+  : m_running      { true }
+  , m_thread       { &Server::server_thread, this }
+  , m_sessions     { new SessionManager }
+  , m_port         { port }
+  , m_thread_count { 0 }
+  , m_live_threads { 0 }
+  , m_idle_threads { 0 }
+  , m_change_waiters { 0 }
+  , m_db           { db }
+  , m_reload       { std::move(reload) }
+  , m_list_builds  { db.prepare("SELECT id, project_id, status, start_timestamp, end_timestamp FROM builds ORDER BY id") }
+  , m_find_build   { db.prepare("SELECT id, project_id, status, start_timestamp, end_timestamp FROM builds WHERE id = ?") }
 {
   db.log_system("Starting server");
 
-  for (size_t i = 0; i < threads; i++) {
-    db.log_system("Starting server accept thread: " + std::to_string(i));
+  m_channels.emplace("builds", std::make_unique<Channel>("builds"));
+  m_feed = std::thread(&Server::feed_thread, this);
+
+  set_threads(threads);
+}
+
+void Server::set_threads(size_t threads) {
+  threads = std::max<size_t>(threads, 1);
+  size_t start = 0;
+  std::vector<std::thread::id> retired;
+  {
+    std::unique_lock<std::mutex> lock(m_mutex);
+    retired.swap(m_retired);
+    m_thread_count = threads;
+    if (m_live_threads < threads) {
+      start = threads - m_live_threads;
+      m_live_threads = threads;
+    }
+  }
+
+  // Idle threads beyond the count exit as they wake
+  m_condition.notify_all();
+
+  // Those that exited since the last call are done or about to return
+  for (const std::thread::id id : retired) {
+    const auto find = std::find_if(m_threads.begin(), m_threads.end(), [id](const std::thread& thread) {
+        return thread.get_id() == id;
+    });
+    if (find != m_threads.end()) {
+      find->join();
+      m_threads.erase(find);
+    }
+  }
+
+  m_db.log_system("Server accept threads: " + std::to_string(threads));
+  for (size_t i = 0; i < start; i++) {
     m_threads.emplace_back(&Server::client_thread, this);
   }
 }
@@ -93,6 +316,10 @@ Server::~Server()
     }
   }
 
+  if (m_feed.joinable()) {
+    m_feed.join();
+  }
+
   if (m_socket) {
     m_socket.shutdown();
   }
@@ -127,6 +354,8 @@ static std::unordered_map<std::string, std::string> parse_http_header(const std:
   std::istringstream response(contents);
   std::string header;
   std::string::size_type index = 0;
+  // Skip the request line
+  std::getline(response, header);
   while (std::getline(response, header) && header != "\r") {
     index = header.find(':', 0);
     if (index != std::string::npos) {
@@ -135,6 +364,8 @@ static std::unordered_map<std::string, std::string> parse_http_header(const std:
       // Trim trailing and leading whitespace and newlines
       strtrim(k);
       strtrim(v);
+      // Field names are case insensitive, HTTP/2 has them lowercase
+      strlower(k);
       fields.insert({k, v});
     }
   }
@@ -142,8 +373,26 @@ static std::unordered_map<std::string, std::string> parse_http_header(const std:
 }
 
 bool Server::handle(Client&& client) {
-  const auto &contents = client.read();
+  // HTTP/2 streams are dispatched the same way as HTTP/1.1 requests
+  const auto dispatch = [this](Client& client,
+                               std::string&& method,
+                               std::string&& query,
+                               std::unordered_map<std::string, std::string>&& header_fields)
+  {
+    return request(client, std::move(method), std::move(query), std::move(header_fields));
+  };
+  const auto offload = [this](std::function<void()>&& task) {
+    return this->offload(std::move(task));
+  };
+
+  auto contents = client.read();
   if (contents) {
+    // HTTP/2 with prior knowledge
+    if (contents->compare(0, Http2Connection::k_preface.size(), Http2Connection::k_preface) == 0) {
+      Http2Connection connection(client, dispatch, offload);
+      return connection.serve(std::move(*contents));
+    }
+
     // Read the first line
     std::string line;
     std::istringstream stream(*contents);
@@ -157,38 +406,62 @@ bool Server::handle(Client&& client) {
     std::string protocol;
 
     if (!(stream >> method >> query >> protocol)) {
-      client.write_line("HTTP/1.1 300 Error");
+      client.write_fixed(Response::BAD_REQUEST);
       return false;
     }
 
-    // Fetch the URL
-    stream.clear();
-    stream.str(query);
-    std::string url;
-    if (!std::getline(stream, url, '?')) {
-      client.write_line("HTTP/1.1 300 Error");
-      return false;
+    auto&& header_fields = parse_http_header(*contents);
+
+    // Upgrade to HTTP/2, only for requests without a body
+    const auto upgrade = header_fields.find("upgrade");
+    const auto settings = header_fields.find("http2-settings");
+    if (upgrade != header_fields.end() && upgrade->second == "h2c" &&
+        settings != header_fields.end() && method == "GET")
+    {
+      const std::string payload = settings->second;
+      Http2Connection connection(client, dispatch, offload);
+      return connection.upgrade(payload, std::move(method), std::move(query), std::move(header_fields));
     }
 
-    // Read the parameters
-    std::unordered_map<std::string, std::string> parameters;
-    std::string pair;
-    std::string key;
-    std::string value;
+    return request(client, std::move(method), std::move(query), std::move(header_fields));
+  }
+
+  return false;
+}
+
+bool Server::request(Client& client,
+                     std::string&& method,
+                     std::string&& query,
+                     std::unordered_map<std::string, std::string>&& header_fields)
+{
+  // Fetch the URL
+  std::istringstream stream(query);
+  std::string url;
+  if (!std::getline(stream, url, '?')) {
+    client.write_fixed(Response::BAD_REQUEST);
+    return false;
+  }
 
-    while (std::getline(stream, pair, '&')) {
-      std::istringstream split(pair);
-      if (std::getline(std::getline(split, key, '='), value)) {
-        parameters[key] = value;
+  // Read the parameters
+  std::unordered_map<std::string, std::string> parameters;
+  std::string pair;
+  std::string key;
+  std::string value;
+
+  while (std::getline(stream, pair, '&')) {
+    std::istringstream split(pair);
+    if (std::getline(std::getline(split, key, '='), value)) {
+      auto decoded = url_decode(value);
+      if (decoded) {
+        parameters[key] = std::move(*decoded);
       }
     }
+  }
 
-    m_db.log_http(method + " " + url);
+  m_db.log_http(method + " " + url);
 
-    if (method == "GET") {
-      auto&& header_fields = parse_http_header(*contents);
-      return get(client, std::move(url), std::move(header_fields), std::move(parameters));
-    }
+  if (method == "GET") {
+    return get(client, std::move(url), std::move(header_fields), std::move(parameters));
   }
 
   return false;
@@ -203,14 +476,40 @@ bool Server::get(Client& client,
     return do_login(client, std::move(params));
   } else if (url == "/logout") {
     return do_logout(client, std::move(header_fields));
+  } else if (url.find("/ws/") == 0) {
+    return do_subscribe(client, url.substr(4), std::move(header_fields));
+  } else if (url == "/api/builds") {
+    return do_builds(client);
+  } else if (url == "/api/builds/page") {
+    return do_build_page(client, std::move(params));
+  } else if (url == "/api/build_logs") {
+    return do_build_logs(client, std::move(params));
+  } else if (url == "/api/logs") {
+    return authorized(client, header_fields) && do_logs(client, std::move(params));
+  } else if (url == "/api/logs/scan") {
+    return authorized(client, header_fields) && do_scan_logs(client, std::move(params));
+  } else if (url == "/api/stats") {
+    return do_stats(client);
+  } else if (url == "/api/log") {
+    return do_build_log(client, std::move(params));
+  } else if (url == "/api/search") {
+    return do_search(client, std::move(params));
+  } else if (url == "/api/backup") {
+    return authorized(client, header_fields) && do_backup(client, std::move(params));
+  } else if (url == "/api/reload") {
+    return authorized(client, header_fields) && do_reload(client);
+  } else if (url == "/api/changes") {
+    return do_changes(client, std::move(params));
+  } else if (url == "/api/profile") {
+    return authorized(client, header_fields) && do_profile(client, std::move(params));
   } else if (url.find("/api") == 0) {
     client.write_html("Content: " + url);
     return true;
   } else {
     if (url != "/") {
-      return client.write_file(url);
+      return client.write_file(url, header_fields);
     }
-    return client.write_file("/resource/login/html");
+    return client.write_file("/login.html", header_fields);
   }
   return false;
 }
@@ -227,18 +526,547 @@ bool Server::do_login(Client& client,
     valid = false;
   }
 
+  if (valid) {
+    const Session session = m_sessions->generate_session();
+    m_sessions->login(session.token());
+    client.write_cookie(std::string(k_session_cookie) + "=" + session.token() +
+                        "; Path=/; Max-Age=28800; HttpOnly; SameSite=Strict");
+  }
+
   // Refresh to /
-  client.write_field("Refresh: 0; url=/");
-  client.write_html("");
+  client.write_fixed(Response::REDIRECT);
 
   return valid;
 }
 
+bool Server::authorized(Client& client, const std::unordered_map<std::string, std::string>& header_fields) {
+  const auto token = session_token(header_fields);
+  if (token.empty() || !m_sessions->check(token)) {
+    client.write_fixed(Response::FORBIDDEN);
+    return false;
+  }
+  return true;
+}
+
+bool Server::do_builds(Client& client) {
+  if (!client.begin_stream("application/json")) {
+    return false;
+  }
+
+  // Rows go straight into the stream as they arrive
+  bool first = true;
+  bool written = true;
+  std::string json;
+  const bool queried = m_list_builds && m_db.query_rows(
+    *m_list_builds,
+    [&](const Database::Row& row) {
+      json = first ? "[" : ",";
+      json += build_json(row);
+      first = false;
+      written = client.write_stream(json);
+      return written;
+    });
+
+  if (!written) {
+    return false;
+  }
+
+  // Headers are out already, a failed query can only end the list early
+  if (!queried) {
+    m_db.log_system("Failed to list builds");
+  }
+
+  return client.write_stream(first ? "[]" : "]") && client.end_stream();
+}
+
+// GET /api/builds/page[?project=<id>][&cursor=<next>][&limit=<builds>],
+// newest first
+bool Server::do_build_page(Client& client, std::unordered_map<std::string, std::string>&& params) {
+  Database::Cursor cursor;
+  size_t limit = 0;
+  if (!page_parameters(params, cursor, limit)) {
+    client.write_fixed(Response::BAD_REQUEST);
+    return false;
+  }
+
+  std::string json = "{\"builds\":[";
+  bool first = true;
+  auto each = [&](const Database::Row& row) {
+    json += first ? "{" : ",{";
+    json += "\"id\":" + std::to_string(row.integer(1));
+    json += ",\"project_id\":" + std::to_string(row.integer(2));
+    json += ",\"status\":" + std::to_string(row.integer(3));
+    json += ",\"start_timestamp\":" + std::to_string(row.integer(0));
+    json += ",\"end_timestamp\":";
+    json += row.null(4) ? "null" : std::to_string(row.integer(4));
+    json += "}";
+    first = false;
+    return true;
+  };
+
+  // Served by builds_project or builds_start
+  std::optional<Database::Cursor> next;
+  const auto project = params.find("project");
+  const bool queried = project == params.end()
+    ? m_db.query_page(
+        "SELECT start_timestamp, id, project_id, status, end_timestamp FROM builds WHERE 1",
+        "start_timestamp", cursor, limit, next, each)
+    : m_db.query_page(
+        "SELECT start_timestamp, id, project_id, status, end_timestamp FROM builds WHERE project_id = ?",
+        "start_timestamp", cursor, limit, next, each, std::strtoll(project->second.c_str(), nullptr, 10));
+
+  if (!queried) {
+    m_db.log_system("Failed to list builds");
+    client.write_fixed(Response::UNAVAILABLE);
+    return false;
+  }
+
+  json += "],\"next\":" + next_json(next) + "}";
+  client.write_json(json);
+  return true;
+}
+
+// GET /api/build_logs?build=<id>[&cursor=<next>][&limit=<logs>], newest
+// first
+bool Server::do_build_logs(Client& client, std::unordered_map<std::string, std::string>&& params) {
+  Database::Cursor cursor;
+  size_t limit = 0;
+  const auto build = params.find("build");
+  if (build == params.end() || !page_parameters(params, cursor, limit)) {
+    client.write_fixed(Response::BAD_REQUEST);
+    return false;
+  }
+
+  // Build logs have no timestamp of their own, ids go up as they're made
+  std::string json = "{\"logs\":[";
+  bool first = true;
+  std::optional<Database::Cursor> next;
+  const bool queried = m_db.query_page(
+    "SELECT id, project_id, configuration_id FROM build_logs WHERE build_id = ?",
+    nullptr, cursor, limit, next,
+    [&](const Database::Row& row) {
+      json += first ? "{" : ",{";
+      json += "\"id\":" + std::to_string(row.integer(0));
+      json += ",\"project_id\":" + std::to_string(row.integer(1));
+      json += ",\"configuration_id\":" + std::to_string(row.integer(2));
+      json += "}";
+      first = false;
+      return true;
+    },
+    std::strtoll(build->second.c_str(), nullptr, 10));
+
+  if (!queried) {
+    m_db.log_system("Failed to list build logs");
+    client.write_fixed(Response::UNAVAILABLE);
+    return false;
+  }
+
+  json += "],\"next\":" + next_json(next) + "}";
+  client.write_json(json);
+  return true;
+}
+
+// GET /api/logs?table=<http|system>[&cursor=<next>][&limit=<records>],
+// newest first across the day tables and log segments
+bool Server::do_logs(Client& client, std::unordered_map<std::string, std::string>&& params) {
+  Database::Cursor cursor;
+  size_t limit = 0;
+  const auto table = params.find("table");
+  if (table == params.end() || (table->second != "http" && table->second != "system") ||
+      !page_parameters(params, cursor, limit))
+  {
+    client.write_fixed(Response::BAD_REQUEST);
+    return false;
+  }
+
+  std::string json = "{\"logs\":[";
+  bool first = true;
+  std::optional<Database::Cursor> next;
+  const bool queried = m_db.page_logs(
+    table->second == "http" ? Database::HTTP_LOGS : Database::SYSTEM_LOGS,
+    cursor, limit, next,
+    [&](const Database::LogEntry& entry) {
+      json += first ? "{" : ",{";
+      json += "\"id\":" + std::to_string(entry.id);
+      json += ",\"timestamp\":" + std::to_string(entry.timestamp);
+      json += ",\"contents\":\"" + json_escape(entry.contents) + "\"";
+      json += "}";
+      first = false;
+      return true;
+    });
+
+  if (!queried) {
+    m_db.log_system("Failed to list " + table->second + " logs");
+    client.write_fixed(Response::UNAVAILABLE);
+    return false;
+  }
+
+  json += "],\"next\":" + next_json(next) + "}";
+  client.write_json(json);
+  return true;
+}
+
+// GET /api/logs/scan?table=<http|system>[&from=<time>][&to=<time>]
+// [&cursor=<next>][&limit=<records>], oldest first from whichever storage
+// holds the logs
+bool Server::do_scan_logs(Client& client, std::unordered_map<std::string, std::string>&& params) {
+  Database::Cursor cursor;
+  size_t limit = 0;
+  const auto table = params.find("table");
+  if (table == params.end() || (table->second != "http" && table->second != "system") ||
+      !page_parameters(params, cursor, limit))
+  {
+    client.write_fixed(Response::BAD_REQUEST);
+    return false;
+  }
+
+  auto time = [&](const char *name, int64_t otherwise) {
+    const auto find = params.find(name);
+    return find == params.end() ? otherwise : std::strtoll(find->second.c_str(), nullptr, 10);
+  };
+  if (!params.count("cursor")) {
+    cursor = { time("from", 0), 0 };
+  }
+
+  // One past the limit tells whether there's a next page, an empty page
+  // has none rather than the cursor it started at
+  std::string json = "{\"logs\":[";
+  size_t count = 0;
+  Database::Cursor last = cursor;
+  std::optional<Database::Cursor> next;
+  const bool scanned = limit == 0 || m_db.scan_logs(
+    table->second == "http" ? Database::HTTP_LOGS : Database::SYSTEM_LOGS,
+    cursor, time("to", INT64_MAX),
+    [&](const Database::LogEntry& entry) {
+      if (count == limit) {
+        next = last;
+        return false;
+      }
+      json += count ? ",{" : "{";
+      json += "\"id\":" + std::to_string(entry.id);
+      json += ",\"timestamp\":" + std::to_string(entry.timestamp);
+      json += ",\"contents\":\"" + json_escape(entry.contents) + "\"";
+      json += "}";
+      last = { entry.timestamp, entry.id };
+      count++;
+      return true;
+    });
+
+  if (!scanned) {
+    m_db.log_system("Failed to scan " + table->second + " logs");
+    client.write_fixed(Response::UNAVAILABLE);
+    return false;
+  }
+
+  json += "],\"next\":" + next_json(next) + "}";
+  client.write_json(json);
+  return true;
+}
+
+bool Server::do_stats(Client& client) {
+  const auto stats = m_db.stats();
+  std::string json;
+  json += "{\"dropped_logs\":" + std::to_string(stats.dropped_logs);
+  json += ",\"busy_retries\":" + std::to_string(stats.busy_retries);
+  json += ",\"busy_timeouts\":" + std::to_string(stats.busy_timeouts);
+  json += ",\"expired_partitions\":" + std::to_string(stats.expired_partitions);
+  json += ",\"expired_segments\":" + std::to_string(stats.expired_segments);
+  json += ",\"log_storage\":\"" + std::string(Database::k_log_storages[m_db.log_storage()]) + "\"";
+  json += ",\"storage_profile\":\"" + std::string(m_db.tuning().name) + "\"";
+  json += "}";
+  client.write_json(json);
+  return true;
+}
+
+// GET /api/log?id=<build log>[&offset=<byte>|&tail=<bytes>]
+bool Server::do_build_log(Client& client, std::unordered_map<std::string, std::string>&& params) {
+  auto number = [&](const char *name) -> std::optional<uint64_t> {
+    const auto find = params.find(name);
+    if (find == params.end() || find->second.empty()) {
+      return std::nullopt;
+    }
+    char *end = nullptr;
+    const auto value = std::strtoull(find->second.c_str(), &end, 10);
+    if (*end) {
+      return std::nullopt;
+    }
+    return value;
+  };
+
+  const auto id = number("id");
+  const auto size = id ? BuildLog::size(m_db, *id) : std::nullopt;
+  if (!size) {
+    client.write_fixed(Response::NOT_FOUND);
+    return false;
+  }
+
+  uint64_t offset = number("offset").value_or(0);
+  if (const auto tail = number("tail")) {
+    offset = *tail < *size ? *size - *tail : 0;
+  }
+
+  if (!client.begin_stream("text/plain; charset=utf-8")) {
+    return false;
+  }
+
+  bool written = true;
+  const bool read = BuildLog::read(m_db, *id, offset, [&](std::string_view contents) {
+    written = client.write_stream(contents);
+    return written;
+  });
+
+  if (written && !read) {
+    m_db.log_system("Failed to read build log " + std::to_string(*id));
+  }
+
+  return written && client.end_stream();
+}
+
+// GET /api/search?q=<text>[&before=<cursor>][&limit=<matches>]
+bool Server::do_search(Client& client, std::unordered_map<std::string, std::string>&& params) {
+  const auto text = params.find("q");
+  if (text == params.end() || text->second.size() < 3 || text->second.size() >= BuildLog::k_search_overlap) {
+    client.write_fixed(Response::BAD_REQUEST);
+    return false;
+  }
+
+  auto number = [&](const char *name, int64_t otherwise) -> int64_t {
+    const auto find = params.find(name);
+    if (find == params.end()) {
+      return otherwise;
+    }
+    char *end = nullptr;
+    const auto value = std::strtoll(find->second.c_str(), &end, 10);
+    return *end || value <= 0 ? otherwise : value;
+  };
+
+  // Why is logged once on open
+  if (!m_db.search_enabled()) {
+    client.write_fixed(Response::UNAVAILABLE);
+    return false;
+  }
+
+  const auto config = Config::current();
+  const int64_t before = number("before", INT64_MAX);
+  const auto limit = std::min<size_t>(number("limit", config->search_page), config->max_search_page);
+
+  // Offsets are in bytes of the log, see /api/log
+  size_t count = 0;
+  int64_t next = 0;
+  std::string json = "{\"matches\":[";
+  const bool searched = BuildLog::search(m_db, text->second, before, limit, [&](const BuildLog::Match& match) {
+    json += count++ ? ",{" : "{";
+    json += "\"snippet\":\"" + json_escape(match.snippet) + "\"";
+    json += ",\"snippet_match\":" + std::to_string(match.snippet_match);
+    json += ",\"logs\":[";
+    for (size_t i = 0; i < match.occurrences.size(); i++) {
+      const auto& occurrence = match.occurrences[i];
+      json += i ? ",{" : "{";
+      json += "\"build_log_id\":" + std::to_string(occurrence.build_log_id);
+      json += ",\"build_id\":" + std::to_string(occurrence.build_id);
+      json += ",\"project_id\":" + std::to_string(occurrence.project_id);
+      json += ",\"offset\":" + std::to_string(occurrence.offset);
+      json += "}";
+    }
+    json += "]}";
+    next = match.cursor;
+    return true;
+  });
+
+  if (!searched) {
+    m_db.log_system("Failed to search build logs");
+    client.write_fixed(Response::UNAVAILABLE);
+    return false;
+  }
+
+  // A short page is the last one
+  json += "],\"next\":";
+  json += count == limit ? std::to_string(next) : "null";
+  json += "}";
+  client.write_json(json);
+  return true;
+}
+
+// GET /api/backup[?start=1], progress of the last backup
+bool Server::do_backup(Client& client, std::unordered_map<std::string, std::string>&& params) {
+  static constexpr const char *k_states[] = { "idle", "running", "done", "failed" };
+
+  const bool started = params.count("start") && m_db.backup(k_backup_path);
+  const auto status = m_db.backup_status();
+  std::string json;
+  json += "{\"started\":";
+  json += started ? "true" : "false";
+  json += ",\"state\":\"";
+  json += k_states[status.state];
+  json += "\",\"remaining\":" + std::to_string(status.remaining);
+  json += ",\"total\":" + std::to_string(status.total);
+  json += "}";
+  client.write_json(json);
+  return true;
+}
+
+// GET /api/reload, rereads the configuration and settings tables
+bool Server::do_reload(Client& client) {
+  if (m_reload) {
+    m_reload();
+  }
+  client.write_json(m_reload ? "{\"reloading\":true}" : "{\"reloading\":false}");
+  return true;
+}
+
+// GET /api/changes[?after=<sequence>][&limit=<changes>][&wait=<ms>]
+//
+// Changes after the given sequence, oldest first. With wait and nothing
+// new yet the request is held until something commits or wait runs out.
+// Every held request takes an HTTP thread, so at most half of them wait
+// and the rest answer straight away. When after is below oldest the
+// changes in between were expired and the consumer has to read everything
+// again.
+bool Server::do_changes(Client& client, std::unordered_map<std::string, std::string>&& params) {
+  auto number = [&](const char *name, int64_t otherwise) -> int64_t {
+    const auto find = params.find(name);
+    if (find == params.end()) {
+      return otherwise;
+    }
+    char *end = nullptr;
+    const auto value = std::strtoll(find->second.c_str(), &end, 10);
+    return *end || value < 0 ? otherwise : value;
+  };
+
+  const int64_t after = number("after", 0);
+  const auto limit = std::clamp<size_t>(number("limit", k_changes_page), 1, k_changes_page);
+  const auto wait = std::min<std::chrono::milliseconds>(std::chrono::milliseconds(number("wait", 0)),
+                                                        k_changes_max_wait);
+
+  // Never on a connection's own thread, that would hold up its other
+  // streams too
+  if (wait.count() && m_db.last_change() <= after && !client.holds_connection()) {
+    if (m_change_waiters.fetch_add(1) < Config::current()->http_threads / 2) {
+      m_db.wait_changes(after, wait);
+    }
+    m_change_waiters--;
+  }
+
+  size_t count = 0;
+  int64_t last = after;
+  std::string json = "{\"changes\":[";
+  const bool read = m_db.changes(after, limit, [&](const Database::Change& change) {
+    json += count++ ? "," : "";
+    json += change_json(change);
+    last = change.sequence;
+    return true;
+  });
+
+  if (!read) {
+    m_db.log_system("Failed to read changes");
+    client.write_fixed(Response::UNAVAILABLE);
+    return false;
+  }
+
+  const auto oldest = m_db.oldest_change();
+  json += "],\"last\":" + std::to_string(last);
+  json += ",\"oldest\":" + (oldest ? std::to_string(*oldest) : std::string("null"));
+  json += "}";
+  client.write_json(json);
+  return true;
+}
+
+// GET /api/profile[?reset=1], statements by total time spent and the
+// recent slow ones. Times are in microseconds, percentiles are bucket
+// upper bounds.
+bool Server::do_profile(Client& client, std::unordered_map<std::string, std::string>&& params) {
+  auto profiles = m_db.profile();
+  std::sort(profiles.begin(), profiles.end(), [](const Database::Profile& lhs, const Database::Profile& rhs) {
+    return lhs.total > rhs.total;
+  });
+
+  std::string json = "{\"statements\":[";
+  for (size_t i = 0; i < profiles.size(); i++) {
+    const auto& profile = profiles[i];
+    json += i ? ",{" : "{";
+    json += "\"sql\":\"" + json_escape(profile.expression) + "\"";
+    json += ",\"count\":" + std::to_string(profile.count);
+    json += ",\"rows\":" + std::to_string(profile.rows);
+    json += ",\"total\":" + std::to_string(profile.total);
+    json += ",\"max\":" + std::to_string(profile.max);
+    json += ",\"p50\":" + std::to_string(profile.percentile(0.50));
+    json += ",\"p95\":" + std::to_string(profile.percentile(0.95));
+    json += ",\"p99\":" + std::to_string(profile.percentile(0.99));
+    json += ",\"fullscan_steps\":" + std::to_string(profile.fullscan_steps);
+    json += ",\"sorts\":" + std::to_string(profile.sorts);
+    json += ",\"autoindexes\":" + std::to_string(profile.autoindexes);
+    json += ",\"vm_steps\":" + std::to_string(profile.vm_steps);
+    json += ",\"histogram\":[";
+    for (size_t bucket = 0; bucket < Database::k_histogram_buckets; bucket++) {
+      json += bucket ? "," : "";
+      json += std::to_string(profile.histogram[bucket]);
+    }
+    json += "],\"plan\":\"" + json_escape(profile.plan) + "\"}";
+  }
+
+  json += "],\"slow\":[";
+  const auto slow = m_db.slow_queries();
+  for (size_t i = 0; i < slow.size(); i++) {
+    json += i ? ",{" : "{";
+    json += "\"timestamp\":" + std::to_string(slow[i].timestamp);
+    json += ",\"duration\":" + std::to_string(slow[i].duration);
+    json += ",\"sql\":\"" + json_escape(slow[i].expression) + "\"";
+    json += ",\"plan\":\"" + json_escape(slow[i].plan) + "\"}";
+  }
+  json += "]}";
+
+  // Whatever ran between reading and resetting is lost, fine for sampling
+  if (params.count("reset")) {
+    m_db.reset_profile();
+  }
+
+  client.write_json(json);
+  return true;
+}
+
 bool Server::do_logout(Client& client,
                        std::unordered_map<std::string, std::string>&& header_fields)
 {
-  // Generate HTML to refresh to /
-  client.write_field("Refresh: 0; url=/");
-  client.write_html("");
+  const auto token = session_token(header_fields);
+  if (!token.empty()) {
+    m_sessions->logout(token);
+    client.write_cookie(std::string(k_session_cookie) + "=; Path=/; Max-Age=0");
+  }
+
+  // Refresh to /
+  client.write_fixed(Response::REDIRECT);
   return true;
 }
+
+bool Server::do_subscribe(Client& client,
+                          const std::string& channel,
+                          std::unordered_map<std::string, std::string>&& header_fields)
+{
+  // WebSockets take over a socket, HTTP/2 streams share theirs
+  if (client.http2()) {
+    client.write_fixed(Response::BAD_REQUEST);
+    return false;
+  }
+
+  auto find = m_channels.find(channel);
+  if (find == m_channels.end()) {
+    client.write_fixed(Response::NOT_FOUND);
+    return false;
+  }
+
+  if (!WebSocket::handshake(client, header_fields)) {
+    return false;
+  }
+
+  // The channel owns the connection from here on
+  find->second->subscribe(std::move(client));
+  return true;
+}
+
+size_t Server::broadcast(const std::string& channel, std::string_view message) {
+  auto find = m_channels.find(channel);
+  if (find == m_channels.end()) {
+    return 0;
+  }
+  return find->second->broadcast(message);
+}
@@ -2,7 +2,7 @@
 #define SERVER_H
 
 #include <thread> // std::thread
-#include <atomic> // std::atomic_bool
+#include <atomic> // std::atomic_bool, std::atomic
 #include <mutex> // std::mutex, std::unique_lock
 #include <condition_variable> // std::condition_variable
 
@@ -11,26 +11,61 @@
 #include <optional> // std::optional
 #include <memory> // std::unique_ptr
 #include <unordered_map> // std::unordered_map
+#include <functional> // std::function
 
 #include "client.h"
 #include "socket.h"
+#include "database.h"
 
 struct SessionManager;
-struct Database;
+struct Channel;
 
 struct Server
 {
-  Server(uint16_t port, size_t threads, Database& db);
+  // reload is called from a client thread when /api/reload is requested,
+  // it should only signal whoever applies the configuration
+  Server(uint16_t port, size_t threads, Database& db, std::function<void()> reload = {});
   ~Server();
 
+  // Grows or shrinks the client thread pool, threads let go finish the
+  // client they're serving first. Not thread safe with itself.
+  void set_threads(size_t threads);
+
+  // Thread safe, pushes a message to every WebSocket subscriber of channel
+  size_t broadcast(const std::string& channel, std::string_view message);
+
 private:
   bool do_login(Client& client, std::unordered_map<std::string, std::string>&& params);
   bool do_logout(Client& client, std::unordered_map<std::string, std::string>&& params);
+  // Whether the request carries a session cookie from do_login(), answers
+  // 403 when not
+  bool authorized(Client& client, const std::unordered_map<std::string, std::string>& header_fields);
+  bool do_builds(Client& client);
+  bool do_build_page(Client& client, std::unordered_map<std::string, std::string>&& params);
+  bool do_build_logs(Client& client, std::unordered_map<std::string, std::string>&& params);
+  bool do_logs(Client& client, std::unordered_map<std::string, std::string>&& params);
+  bool do_scan_logs(Client& client, std::unordered_map<std::string, std::string>&& params);
+  bool do_stats(Client& client);
+  bool do_build_log(Client& client, std::unordered_map<std::string, std::string>&& params);
+  bool do_search(Client& client, std::unordered_map<std::string, std::string>&& params);
+  bool do_backup(Client& client, std::unordered_map<std::string, std::string>&& params);
+  bool do_reload(Client& client);
+  bool do_changes(Client& client, std::unordered_map<std::string, std::string>&& params);
+  bool do_profile(Client& client, std::unordered_map<std::string, std::string>&& params);
+  bool do_subscribe(Client& client,
+                    const std::string& channel,
+                    std::unordered_map<std::string, std::string>&& header_fields);
 
   bool server_thread();
   bool client_thread();
+  void feed_thread();
 
   bool handle(Client&& client);
+  bool offload(std::function<void()>&& task);
+  bool request(Client& client,
+               std::string&& method,
+               std::string&& query,
+               std::unordered_map<std::string, std::string>&& header_fields);
   bool get(Client& client,
            std::string&& url,
            std::unordered_map<std::string, std::string>&& header_fields,
@@ -45,13 +80,31 @@ private:
   Socket m_socket;
   uint16_t m_port;
 
-  // thread pool for clients and queued clients
+  // thread pool for clients and queued clients, and HTTP/2 streams handed
+  // over by the threads serving their connections
   std::mutex m_mutex;
   std::queue<Client> m_clients;
+  std::queue<std::function<void()>> m_tasks;
   std::condition_variable m_condition;
-  std::vector<std::thread> m_threads;
+  std::vector<std::thread> m_threads; // Live and not yet joined, only touched by set_threads() and on destruction
+  std::vector<std::thread::id> m_retired; // Exited as the pool shrank, guarded by m_mutex
+  size_t m_thread_count; // Guarded by m_mutex
+  size_t m_live_threads; // Guarded by m_mutex
+  size_t m_idle_threads; // Guarded by m_mutex
+  std::atomic<size_t> m_change_waiters; // Requests held by /api/changes
+
+  // WebSocket broadcast channels, fixed at construction
+  std::unordered_map<std::string, std::unique_ptr<Channel>> m_channels;
 
   Database& m_db;
+  std::function<void()> m_reload;
+
+  // Hot queries, registered once with m_db
+  std::optional<Database::Statement> m_list_builds;
+  std::optional<Database::Statement> m_find_build;
+
+  // Pushes changes to builds to the builds channel
+  std::thread m_feed;
 };
 
 #endif
@@ -1,4 +1,6 @@
 #include <cstring> // std::memset, std::memcpy
+#include <cerrno> // errno, EAGAIN, EWOULDBLOCK
+#include <vector> // std::vector
 
 #include "socket.h"
 
@@ -11,6 +13,8 @@
 #include <sys/socket.h> // socket
 #include <netdb.h>
 #include <unistd.h> // read,write,close
+#include <poll.h> // poll
+#include <sys/time.h> // timeval
 #define SocketType int
 #define get_fd(ptr) ((ptr)->m_fd.i)
 #define INVALID_SOCKET -1
@@ -134,7 +138,38 @@ int Socket::send(const uint8_t *data, size_t size) {
 #if defined(_WIN32)
   return send(get_fd(this), reinterpret_cast<const void *>(data), size);
 #else
-  return write(get_fd(this), reinterpret_cast<const void *>(data), size);
+  // Peers going away should be an error, not a SIGPIPE
+  return ::send(get_fd(this), reinterpret_cast<const void *>(data), size, MSG_NOSIGNAL);
+#endif
+}
+
+bool Socket::set_send_timeout(int timeout) {
+#if defined(_WIN32)
+  DWORD value = timeout;
+  return setsockopt(get_fd(this), SOL_SOCKET, SO_SNDTIMEO, reinterpret_cast<const char *>(&value), sizeof value) == 0;
+#else
+  struct timeval value;
+  value.tv_sec = timeout / 1000;
+  value.tv_usec = (timeout % 1000) * 1000;
+  return setsockopt(get_fd(this), SOL_SOCKET, SO_SNDTIMEO, &value, sizeof value) == 0;
+#endif
+}
+
+int Socket::try_send(const uint8_t *data, size_t size) {
+#if defined(_WIN32)
+  u_long mode = 1;
+  ioctlsocket(get_fd(this), FIONBIO, &mode);
+  const int result = ::send(get_fd(this), reinterpret_cast<const char *>(data), size, 0);
+  const bool blocked = result < 0 && WSAGetLastError() == WSAEWOULDBLOCK;
+  mode = 0;
+  ioctlsocket(get_fd(this), FIONBIO, &mode);
+  return blocked ? 0 : result;
+#else
+  const int result = ::send(get_fd(this), reinterpret_cast<const void *>(data), size, MSG_NOSIGNAL | MSG_DONTWAIT);
+  if (result < 0 && (errno == EAGAIN || errno == EWOULDBLOCK)) {
+    return 0;
+  }
+  return result;
 #endif
 }
 
@@ -146,6 +181,36 @@ int Socket::recieve(uint8_t *data, size_t size) {
 #endif
 }
 
+int Socket::poll(Poll *polls, size_t count, int timeout) {
+#if defined(_WIN32)
+  std::vector<WSAPOLLFD> fds(count);
+#else
+  std::vector<struct pollfd> fds(count);
+#endif
+  for (size_t i = 0; i < count; i++) {
+    fds[i].fd = get_fd(polls[i].socket);
+    fds[i].events = (polls[i].want_read ? POLLIN : 0) | (polls[i].want_write ? POLLOUT : 0);
+    fds[i].revents = 0;
+  }
+
+#if defined(_WIN32)
+  const int result = WSAPoll(fds.data(), count, timeout);
+#else
+  const int result = ::poll(fds.data(), count, timeout);
+#endif
+  if (result < 0) {
+    return -1;
+  }
+
+  // Errors and hangups are reported as readable so the next read sees them
+  for (size_t i = 0; i < count; i++) {
+    polls[i].readable = fds[i].revents & (POLLIN | POLLERR | POLLHUP);
+    polls[i].writable = fds[i].revents & POLLOUT;
+  }
+
+  return result;
+}
+
 Socket::operator bool() const {
   return get_fd(this) != INVALID_SOCKET;
 }
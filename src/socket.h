@@ -45,6 +45,24 @@ struct Socket
   int send(const uint8_t *data, size_t size);
   int recieve(uint8_t *data, size_t size);
 
+  // Blocking sends fail after this many milliseconds without progress
+  bool set_send_timeout(int timeout);
+
+  // Non-blocking send, returns 0 when the socket buffer is full
+  int try_send(const uint8_t *data, size_t size);
+
+  // Wait until any of the sockets becomes ready or timeout (milliseconds)
+  // expires. Returns the number of ready sockets or -1 on failure.
+  struct Poll
+  {
+    const Socket *socket;
+    bool want_read;
+    bool want_write;
+    bool readable;
+    bool writable;
+  };
+  static int poll(Poll *polls, size_t count, int timeout);
+
   operator bool() const;
 
 private:
@@ -1,5 +1,6 @@
-#include <algorithm> // std::find_if, std::begin, std::end, std::rbegin, std::rend
-#include <cctype> // std::isspace
+#include <algorithm> // std::find_if, std::transform, std::begin, std::end, std::rbegin, std::rend
+#include <cctype> // std::isspace, std::tolower, std::isxdigit
+#include <cstdio> // snprintf
 
 #include "utility.h"
 
@@ -29,3 +30,183 @@ void strtrim(std::string &s) {
   strltrim(s);
   strrtrim(s);
 }
+
+void strlower(std::string &s) {
+  std::transform(
+    std::begin(s),
+    std::end(s),
+    std::begin(s),
+    [](unsigned char c) { return std::tolower(c); }
+  );
+}
+
+static inline uint32_t rol32(uint32_t value, int bits) {
+  return (value << bits) | (value >> (32 - bits));
+}
+
+std::array<uint8_t, 20> sha1(std::string_view contents) {
+  uint32_t h[5] = { 0x67452301, 0xEFCDAB89, 0x98BADCFE, 0x10325476, 0xC3D2E1F0 };
+
+  // Pad to a multiple of 64 bytes with the 0x80 terminator and the bit length
+  std::string message(contents);
+  const uint64_t bits = static_cast<uint64_t>(contents.size()) * 8;
+  message += static_cast<char>(0x80);
+  while (message.size() % 64 != 56) {
+    message += '\0';
+  }
+  for (int i = 7; i >= 0; i--) {
+    message += static_cast<char>((bits >> (i * 8)) & 0xff);
+  }
+
+  for (size_t chunk = 0; chunk < message.size(); chunk += 64) {
+    const auto *data = reinterpret_cast<const uint8_t *>(message.data() + chunk);
+    uint32_t w[80];
+    for (int i = 0; i < 16; i++) {
+      w[i] = (uint32_t(data[i*4+0]) << 24)
+           | (uint32_t(data[i*4+1]) << 16)
+           | (uint32_t(data[i*4+2]) << 8)
+           | (uint32_t(data[i*4+3]));
+    }
+    for (int i = 16; i < 80; i++) {
+      w[i] = rol32(w[i-3] ^ w[i-8] ^ w[i-14] ^ w[i-16], 1);
+    }
+
+    uint32_t a = h[0], b = h[1], c = h[2], d = h[3], e = h[4];
+    for (int i = 0; i < 80; i++) {
+      uint32_t f = 0;
+      uint32_t k = 0;
+      if (i < 20) {
+        f = (b & c) | (~b & d);
+        k = 0x5A827999;
+      } else if (i < 40) {
+        f = b ^ c ^ d;
+        k = 0x6ED9EBA1;
+      } else if (i < 60) {
+        f = (b & c) | (b & d) | (c & d);
+        k = 0x8F1BBCDC;
+      } else {
+        f = b ^ c ^ d;
+        k = 0xCA62C1D6;
+      }
+      const uint32_t temp = rol32(a, 5) + f + e + k + w[i];
+      e = d;
+      d = c;
+      c = rol32(b, 30);
+      b = a;
+      a = temp;
+    }
+
+    h[0] += a;
+    h[1] += b;
+    h[2] += c;
+    h[3] += d;
+    h[4] += e;
+  }
+
+  std::array<uint8_t, 20> digest;
+  for (int i = 0; i < 5; i++) {
+    digest[i*4+0] = (h[i] >> 24) & 0xff;
+    digest[i*4+1] = (h[i] >> 16) & 0xff;
+    digest[i*4+2] = (h[i] >> 8) & 0xff;
+    digest[i*4+3] = h[i] & 0xff;
+  }
+  return digest;
+}
+
+std::string base64_encode(const uint8_t *data, size_t size) {
+  static const char k_table[] = "ABCDEFGHIJKLMNOPQRSTUVWXYZ"
+                                "abcdefghijklmnopqrstuvwxyz"
+                                "0123456789+/";
+  std::string result;
+  result.reserve(((size + 2) / 3) * 4);
+  for (size_t i = 0; i < size; i += 3) {
+    const uint32_t octets = (uint32_t(data[i]) << 16)
+                          | (i + 1 < size ? uint32_t(data[i+1]) << 8 : 0)
+                          | (i + 2 < size ? uint32_t(data[i+2]) : 0);
+    result += k_table[(octets >> 18) & 0x3f];
+    result += k_table[(octets >> 12) & 0x3f];
+    result += i + 1 < size ? k_table[(octets >> 6) & 0x3f] : '=';
+    result += i + 2 < size ? k_table[octets & 0x3f] : '=';
+  }
+  return result;
+}
+
+std::optional<std::string> base64_decode(std::string_view contents) {
+  std::string result;
+  result.reserve(contents.size() * 3 / 4);
+  uint32_t buffer = 0;
+  int bits = 0;
+  for (const char ch : contents) {
+    uint32_t value = 0;
+    if (ch >= 'A' && ch <= 'Z') {
+      value = ch - 'A';
+    } else if (ch >= 'a' && ch <= 'z') {
+      value = ch - 'a' + 26;
+    } else if (ch >= '0' && ch <= '9') {
+      value = ch - '0' + 52;
+    } else if (ch == '+' || ch == '-') {
+      value = 62;
+    } else if (ch == '/' || ch == '_') {
+      value = 63;
+    } else if (ch == '=') {
+      break;
+    } else {
+      return std::nullopt;
+    }
+    buffer = (buffer << 6) | value;
+    bits += 6;
+    if (bits >= 8) {
+      bits -= 8;
+      result += static_cast<char>((buffer >> bits) & 0xff);
+    }
+  }
+  return result;
+}
+
+std::optional<std::string> url_decode(std::string_view contents) {
+  auto digit = [](char ch) {
+    return ch <= '9' ? ch - '0' : (ch | 0x20) - 'a' + 10;
+  };
+  std::string result;
+  result.reserve(contents.size());
+  for (size_t i = 0; i < contents.size(); i++) {
+    const char ch = contents[i];
+    if (ch == '+') {
+      result += ' ';
+    } else if (ch != '%') {
+      result += ch;
+    } else if (i + 2 < contents.size() &&
+               std::isxdigit(static_cast<unsigned char>(contents[i+1])) &&
+               std::isxdigit(static_cast<unsigned char>(contents[i+2])))
+    {
+      result += static_cast<char>(digit(contents[i+1]) << 4 | digit(contents[i+2]));
+      i += 2;
+    } else {
+      return std::nullopt;
+    }
+  }
+  return result;
+}
+
+std::string json_escape(std::string_view contents) {
+  std::string result;
+  result.reserve(contents.size());
+  for (const char ch : contents) {
+    switch (ch) {
+    case '"':  result += "\\\""; break;
+    case '\\': result += "\\\\"; break;
+    case '\n': result += "\\n"; break;
+    case '\r': result += "\\r"; break;
+    case '\t': result += "\\t"; break;
+    default:
+      if (static_cast<unsigned char>(ch) < 0x20) {
+        char buffer[8];
+        snprintf(buffer, sizeof buffer, "\\u%04x", ch);
+        result += buffer;
+      } else {
+        result += ch;
+      }
+    }
+  }
+  return result;
+}
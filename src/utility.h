@@ -1,10 +1,30 @@
 #ifndef UTILITY_H
 #define UTILITY_H
 
+#include <string_view>
+#include <optional>
 #include <string>
+#include <array>
+
+#include <cstdint>
 
 void strltrim(std::string &s);
 void strrtrim(std::string &s);
 void strtrim(std::string &s);
+void strlower(std::string &s);
+
+// SHA-1 digest, only used where protocols demand it (WebSocket handshake)
+std::array<uint8_t, 20> sha1(std::string_view contents);
+
+std::string base64_encode(const uint8_t *data, size_t size);
+
+// Accepts both the standard and URL safe alphabets, padding is optional
+std::optional<std::string> base64_decode(std::string_view contents);
+
+// Percent escapes and '+' for space, as in query strings
+std::optional<std::string> url_decode(std::string_view contents);
+
+// For use inside a JSON string literal, quotes not included
+std::string json_escape(std::string_view contents);
 
 #endif
@@ -0,0 +1,139 @@
+#include "websocket.h"
+#include "client.h"
+#include "utility.h"
+
+#include <algorithm> // std::equal
+#include <cctype> // std::tolower
+
+// Magic value from RFC 6455 appended to the client key
+static constexpr const char k_guid[] = "258EAFA5-E914-47DA-95CA-C5AB0DC85B11";
+
+static bool strieq(std::string_view lhs, std::string_view rhs) {
+  return lhs.size() == rhs.size() &&
+    std::equal(lhs.begin(), lhs.end(), rhs.begin(), [](char a, char b) {
+      return std::tolower(a) == std::tolower(b);
+    });
+}
+
+bool WebSocket::handshake(Client& client,
+                          const std::unordered_map<std::string, std::string>& header_fields)
+{
+  const auto upgrade = header_fields.find("upgrade");
+  const auto version = header_fields.find("sec-websocket-version");
+  const auto key = header_fields.find("sec-websocket-key");
+
+  if (upgrade == header_fields.end() || !strieq(upgrade->second, "websocket") ||
+      key == header_fields.end() || version == header_fields.end() || version->second != "13")
+  {
+    client.write_field("Sec-WebSocket-Version: 13");
+    client.write_empty(400);
+    return false;
+  }
+
+  const auto digest = sha1(key->second + k_guid);
+  client.write_line("HTTP/1.1 101 Switching Protocols");
+  client.write_line("Server: ElastCI");
+  client.write_line("Upgrade: websocket");
+  client.write_line("Connection: Upgrade");
+  client.write_line("Sec-WebSocket-Accept: " + base64_encode(digest.data(), digest.size()));
+  client.write_line("");
+
+  return true;
+}
+
+std::optional<size_t> WebSocket::parse(uint8_t *data, size_t size, Frame& frame) {
+  if (size < 2) {
+    return 0;
+  }
+
+  const bool fin = data[0] & 0x80;
+  const uint8_t reserved = data[0] & 0x70;
+  const uint8_t opcode = data[0] & 0x0f;
+  const bool masked = data[1] & 0x80;
+  uint64_t length = data[1] & 0x7f;
+
+  // No extensions are negotiated and clients must always mask
+  if (reserved || !masked) {
+    return std::nullopt;
+  }
+
+  switch (opcode) {
+  case CONTINUATION:
+  case TEXT:
+  case BINARY:
+    break;
+  case CLOSE:
+  case PING:
+  case PONG:
+    // Control frames cannot be fragmented or carry extended lengths
+    if (!fin || length > 125) {
+      return std::nullopt;
+    }
+    break;
+  default:
+    return std::nullopt;
+  }
+
+  size_t offset = 2;
+  if (length == 126) {
+    if (size < offset + 2) {
+      return 0;
+    }
+    length = (uint64_t(data[2]) << 8) | data[3];
+    offset += 2;
+  } else if (length == 127) {
+    if (size < offset + 8) {
+      return 0;
+    }
+    length = 0;
+    for (int i = 0; i < 8; i++) {
+      length = (length << 8) | data[2 + i];
+    }
+    offset += 8;
+  }
+
+  if (length > k_max_payload) {
+    return std::nullopt;
+  }
+
+  if (size < offset + 4 + length) {
+    return 0;
+  }
+
+  const uint8_t *mask = data + offset;
+  offset += 4;
+
+  uint8_t *payload = data + offset;
+  for (size_t i = 0; i < length; i++) {
+    payload[i] ^= mask[i & 3];
+  }
+
+  frame.opcode = static_cast<Opcode>(opcode);
+  frame.fin = fin;
+  frame.payload = { reinterpret_cast<const char *>(payload), static_cast<size_t>(length) };
+
+  return offset + length;
+}
+
+std::string WebSocket::serialize(Opcode opcode, std::string_view payload) {
+  std::string result;
+  result.reserve(payload.size() + 10);
+  result += static_cast<char>(0x80 | opcode);
+
+  const uint64_t length = payload.size();
+  if (length < 126) {
+    result += static_cast<char>(length);
+  } else if (length <= 0xffff) {
+    result += static_cast<char>(126);
+    result += static_cast<char>((length >> 8) & 0xff);
+    result += static_cast<char>(length & 0xff);
+  } else {
+    result += static_cast<char>(127);
+    for (int i = 7; i >= 0; i--) {
+      result += static_cast<char>((length >> (i * 8)) & 0xff);
+    }
+  }
+
+  result += payload;
+  return result;
+}
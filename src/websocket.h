@@ -0,0 +1,49 @@
+#ifndef WEBSOCKET_H
+#define WEBSOCKET_H
+
+#include <unordered_map> // std::unordered_map
+#include <string_view> // std::string_view
+#include <optional> // std::optional
+#include <string> // std::string
+
+#include <cstdint> // uint8_t
+
+struct Client;
+
+// RFC 6455 framing. Frames are parsed directly out of the connection buffer
+// and client payloads are unmasked in place, nothing is copied.
+struct WebSocket
+{
+  enum Opcode : uint8_t {
+    CONTINUATION = 0x0,
+    TEXT = 0x1,
+    BINARY = 0x2,
+    CLOSE = 0x8,
+    PING = 0x9,
+    PONG = 0xA
+  };
+
+  struct Frame
+  {
+    Opcode opcode;
+    bool fin;
+    std::string_view payload;
+  };
+
+  // Largest payload we accept from a client, anything bigger is an error
+  static constexpr size_t k_max_payload = 64 * 1024;
+
+  // Checks the request for an upgrade and writes the 101 response
+  static bool handshake(Client& client,
+                        const std::unordered_map<std::string, std::string>& header_fields);
+
+  // Parses a frame from the front of |data|. Returns the number of bytes
+  // consumed, zero when more data is needed or std::nullopt when the
+  // frame violates the protocol.
+  static std::optional<size_t> parse(uint8_t *data, size_t size, Frame& frame);
+
+  // Serializes an unmasked server frame
+  static std::string serialize(Opcode opcode, std::string_view payload);
+};
+
+#endif
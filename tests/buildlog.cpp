@@ -0,0 +1,156 @@
+#include <random> // std::mt19937
+
+#include "test.h"
+#include "buildlog.h"
+
+static constexpr const char k_path[] = "kaizen-test-buildlog.db";
+
+// A build to hang logs off
+static bool create_build(Database& db) {
+  return db.create(k_path) &&
+         db.insert("INSERT INTO projects(id, name, enabled) VALUES(1, 'kaizen', 1)") &&
+         db.insert("INSERT INTO configurations(id, name, project_id) VALUES(1, 'release', 1)") &&
+         db.insert("INSERT INTO builds(id, project_id, status, start_timestamp) VALUES(1, 1, 0, 0)");
+}
+
+// Compiler output of a kind, different for every seed
+static std::string output(unsigned seed, size_t size) {
+  static const char *const k_words[] = { "compiling", "linking", "warning:", "src/main.cpp", "unused", "-O2", "ok" };
+  std::mt19937 random(seed);
+  std::string contents;
+  while (contents.size() < size) {
+    contents += "[" + std::to_string(random() % 1000) + "]";
+    for (unsigned words = random() % 8 + 1; words--;) {
+      contents += ' ';
+      contents += k_words[random() % (sizeof k_words / sizeof *k_words)];
+    }
+    contents += '\n';
+  }
+  return contents;
+}
+
+static std::optional<std::string> read(Database& db, int64_t id, uint64_t offset) {
+  std::string contents;
+  const bool read = BuildLog::read(db, id, offset, [&](std::string_view part) {
+    contents.append(part);
+    return true;
+  });
+  return read ? std::optional<std::string>(contents) : std::nullopt;
+}
+
+// Appends of every size come back the same from any offset, cut into
+// chunks within the bounds
+TEST(buildlog_round_trip) {
+  Test::remove_database(k_path);
+  {
+    Database db(0);
+    CHECK(create_build(db));
+
+    for (const auto codec : { Codec::NONE, Codec::DEFLATE }) {
+      // Different for each codec, or the second would find the chunks stored
+      const std::string contents = output(codec + 1, 1024 * 1024);
+      int64_t id = 0;
+      {
+        auto log = BuildLog::create(db, 1, 1, 1, codec);
+        CHECK(log);
+        if (!log) {
+          continue;
+        }
+        id = log->id();
+        size_t offset = 0;
+        for (size_t size = 1; offset < contents.size(); size = size * 3 % 70001) {
+          const size_t take = std::min(size, contents.size() - offset);
+          CHECK(log->append(std::string_view(contents).substr(offset, take)));
+          offset += take;
+        }
+      }
+
+      CHECK(BuildLog::size(db, id) == uint64_t(contents.size()));
+      for (const uint64_t offset : { uint64_t(0), uint64_t(1), uint64_t(BuildLog::k_min_chunk),
+                                     uint64_t(BuildLog::k_chunk_size + 5), uint64_t(contents.size() - 1),
+                                     uint64_t(contents.size()) }) {
+        CHECK(read(db, id, offset) == contents.substr(offset));
+      }
+
+      const auto chunks = db.query<int64_t, int64_t, int64_t>(
+        "SELECT COUNT(*), MIN(c.size), MAX(c.size) FROM build_log_refs AS r JOIN chunk_store AS c ON c.id = r.chunk_id "
+        "WHERE r.build_log_id = ? AND r.start + c.size < ?",
+        id, int64_t(contents.size()));
+      CHECK(chunks && std::get<0>(*chunks) > 1);
+      CHECK(chunks && std::get<1>(*chunks) >= int64_t(BuildLog::k_min_chunk));
+      CHECK(chunks && std::get<2>(*chunks) <= int64_t(BuildLog::k_chunk_size));
+
+      const auto other = db.query<int64_t>(
+        "SELECT COUNT(*) FROM build_log_refs AS r JOIN chunk_store AS c ON c.id = r.chunk_id "
+        "WHERE r.build_log_id = ? AND c.codec != ?",
+        id, int64_t(codec));
+      CHECK(other && std::get<0>(*other) == 0);
+    }
+
+    // Incompressible chunks are stored as they are
+    std::string noise;
+    std::mt19937 random(3);
+    while (noise.size() < BuildLog::k_chunk_size) {
+      noise += static_cast<char>(random());
+    }
+    int64_t id = 0;
+    {
+      auto log = BuildLog::create(db, 1, 1, 1);
+      CHECK(log && log->append(noise) && log->flush());
+      id = log ? log->id() : 0;
+    }
+    CHECK(read(db, id, 0) == noise);
+    const auto codecs = db.query<int64_t>(
+      "SELECT COUNT(*) FROM build_log_refs AS r JOIN chunk_store AS c ON c.id = r.chunk_id "
+      "WHERE r.build_log_id = ? AND c.codec != 0",
+      id);
+    CHECK(codecs && std::get<0>(*codecs) == 0);
+  }
+  Test::remove_database(k_path);
+}
+
+static std::optional<int64_t> write(Database& db, std::string_view contents) {
+  auto log = BuildLog::create(db, 1, 1, 1);
+  if (!log || !log->append(contents) || !log->flush()) {
+    return std::nullopt;
+  }
+  return log->id();
+}
+
+static int64_t stored_chunks(Database& db) {
+  const auto chunks = db.query<int64_t>("SELECT COUNT(*) FROM chunk_store");
+  return chunks ? std::get<0>(*chunks) : -1;
+}
+
+// The same output is stored once however many logs print it, and output
+// shifted by a line in front still shares everything past the first
+// chunks since boundaries come from the content
+TEST(buildlog_deduplicates_chunks) {
+  Test::remove_database(k_path);
+  {
+    Database db(0);
+    CHECK(create_build(db));
+
+    const std::string contents = output(10, 512 * 1024);
+    const auto first = write(db, contents);
+    const int64_t chunks = stored_chunks(db);
+    CHECK(first && chunks > 4);
+
+    const auto again = write(db, contents);
+    CHECK(again && stored_chunks(db) == chunks);
+    CHECK(again && read(db, *again, 0) == contents);
+
+    const std::string shifted = "[0] configuring\n" + contents;
+    const auto later = write(db, shifted);
+    CHECK(later && stored_chunks(db) - chunks <= 2);
+    if (first && later) {
+      CHECK(read(db, *later, 0) == shifted);
+      const auto shared = db.query<int64_t>(
+        "SELECT COUNT(DISTINCT chunk_id) FROM build_log_refs WHERE build_log_id = ? AND chunk_id IN "
+        "(SELECT chunk_id FROM build_log_refs WHERE build_log_id = ?)",
+        *later, *first);
+      CHECK(shared && std::get<0>(*shared) >= chunks - 2);
+    }
+  }
+  Test::remove_database(k_path);
+}
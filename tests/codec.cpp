@@ -0,0 +1,55 @@
+#include "test.h"
+#include "codec.h"
+
+static std::string round_trip(Codec::Kind kind, std::string_view input) {
+  std::string compressed;
+  std::string output = "kept";
+  if (!Codec::compress(kind, input, compressed) ||
+      !Codec::decompress(kind, compressed, input.size(), output))
+  {
+    return "failed";
+  }
+  // Both append rather than replace
+  return output.compare(0, 4, "kept") == 0 ? output.substr(4) : "overwritten";
+}
+
+TEST(codec_round_trip) {
+  std::string repeated;
+  for (int i = 0; i < 10000; i++) {
+    repeated += "[" + std::to_string(i % 97) + "] compiling\n";
+  }
+  std::string binary;
+  for (int i = 0; i < 4096; i++) {
+    binary += static_cast<char>(i * 2654435761u >> 24);
+  }
+
+  for (const auto kind : { Codec::NONE, Codec::DEFLATE }) {
+    CHECK(round_trip(kind, "") == "");
+    CHECK(round_trip(kind, "x") == "x");
+    CHECK(round_trip(kind, repeated) == repeated);
+    CHECK(round_trip(kind, binary) == binary);
+  }
+
+  std::string compressed;
+  CHECK(Codec::compress(Codec::DEFLATE, repeated, compressed));
+  CHECK(compressed.size() < repeated.size() / 10);
+}
+
+TEST(codec_rejects_bad_blocks) {
+  const std::string input(1000, 'a');
+  std::string compressed;
+  CHECK(Codec::compress(Codec::DEFLATE, input, compressed));
+
+  std::string output;
+  CHECK(!Codec::decompress(Codec::DEFLATE, compressed, input.size() - 1, output));
+  CHECK(!Codec::decompress(Codec::DEFLATE, compressed, input.size() + 1, output));
+  CHECK(!Codec::decompress(Codec::DEFLATE, compressed.substr(0, compressed.size() / 2), input.size(), output));
+  CHECK(!Codec::decompress(Codec::DEFLATE, "not deflate", input.size(), output));
+  CHECK(!Codec::decompress(Codec::NONE, input, input.size() - 1, output));
+  CHECK(!Codec::decompress(Codec::COUNT, input, input.size(), output));
+  // Nothing left behind by a failure
+  CHECK(output.empty());
+
+  CHECK(std::string(Codec::name(Codec::DEFLATE)) == "deflate");
+  CHECK(std::string(Codec::name(Codec::COUNT)) == "unknown");
+}
@@ -0,0 +1,95 @@
+#include <thread> // std::thread
+#include <atomic> // std::atomic
+#include <vector> // std::vector
+
+#include "test.h"
+#include "config.h"
+#include "database.h"
+#include "published.h"
+
+static constexpr const char k_path[] = "kaizen-test-config.db";
+
+TEST(config_load) {
+  Test::remove_database(k_path);
+  {
+    Database db(0);
+    CHECK(db.create(k_path));
+
+    const auto defaults = Config::load(db);
+    CHECK(defaults && defaults->http_port == 80 && defaults->list_page == Config().list_page);
+
+    CHECK(db.query("UPDATE configuration SET http_threads = 3"));
+    CHECK(db.insert("INSERT INTO settings(name, value) VALUES('slow_query_ms', 5)"));
+    CHECK(db.insert("INSERT INTO settings(name, value) VALUES('max_list_page', 40)"));
+    CHECK(db.insert("INSERT INTO settings(name, value) VALUES('batch_size', 0)"));
+    CHECK(db.insert("INSERT INTO settings(name, value) VALUES('no_such_setting', 1)"));
+
+    const auto config = Config::load(db);
+    CHECK(config);
+    if (config) {
+      CHECK(config->http_threads == 3);
+      CHECK(config->slow_query == std::chrono::milliseconds(5));
+      CHECK(config->max_list_page == 40);
+      // Cut down to the maximum
+      CHECK(config->list_page == 40);
+      // Below the minimum
+      CHECK(config->batch_size == Config().batch_size);
+    }
+  }
+  Test::remove_database(k_path);
+}
+
+// A snapshot taken before a reload keeps its values, the next read sees
+// the new ones
+TEST(config_publish) {
+  Config reloaded;
+  reloaded.list_page = 7;
+  Config::publish(reloaded);
+  const auto before = Config::current();
+  CHECK(before->list_page == 7);
+
+  reloaded.list_page = 9;
+  Config::publish(reloaded);
+  CHECK(before->list_page == 7);
+  CHECK(Config::current()->list_page == 9);
+
+  Config::publish(Config());
+  CHECK(Config::current()->list_page == Config().list_page);
+}
+
+// Readers on other threads only ever move forward and end on the last
+// value published, two instances of the same type don't mix up the
+// snapshot each thread keeps
+TEST(published_across_threads) {
+  Published<int> counter { std::make_shared<const int>(0) };
+  Published<int> other { std::make_shared<const int>(-1) };
+  constexpr int values = 20000;
+
+  std::atomic<bool> done{ false };
+  std::atomic<int> backwards{ 0 };
+  std::atomic<int> mixed{ 0 };
+  std::vector<std::thread> readers;
+  for (int reader = 0; reader < 4; reader++) {
+    readers.emplace_back([&] {
+      int last = 0;
+      while (!done.load()) {
+        const int value = *counter.get();
+        backwards += value < last;
+        last = value;
+        mixed += *other.get() != -1;
+      }
+      backwards += *counter.get() != values;
+    });
+  }
+  for (int value = 1; value <= values; value++) {
+    counter.publish(std::make_shared<const int>(value));
+  }
+  done.store(true);
+  for (auto& reader : readers) {
+    reader.join();
+  }
+
+  CHECK(backwards == 0);
+  CHECK(mixed == 0);
+  CHECK(*counter.get() == values && *other.get() == -1);
+}
@@ -0,0 +1,187 @@
+#include <thread> // std::thread
+#include <atomic> // std::atomic
+#include <vector> // std::vector
+
+#include "test.h"
+#include "database.h"
+
+static constexpr const char k_path[] = "kaizen-test.db";
+
+static void remove_database() {
+  Test::remove_database(k_path);
+}
+
+static int64_t user_version(Database& db) {
+  const auto version = db.query<int64_t>("PRAGMA user_version");
+  return version ? std::get<0>(*version) : -1;
+}
+
+TEST(cursor_round_trip) {
+  const Database::Cursor cursors[] = {
+    {},
+    { 0, 0 },
+    { 1700000000000, 42 },
+    { -1, INT64_MIN },
+    { INT64_MIN, INT64_MAX },
+  };
+  for (const auto& cursor : cursors) {
+    const std::string token = cursor.encode();
+    CHECK(token.find_first_of("+/=") == std::string::npos);
+    const auto decoded = Database::Cursor::decode(token);
+    CHECK(decoded && decoded->timestamp == cursor.timestamp && decoded->id == cursor.id);
+  }
+}
+
+TEST(cursor_rejects_bad_tokens) {
+  const std::string token = Database::Cursor{ 1700000000000, 42 }.encode();
+  CHECK(!Database::Cursor::decode(""));
+  CHECK(!Database::Cursor::decode(token.substr(0, token.size() - 2)));  // Short
+  CHECK(!Database::Cursor::decode(token + "AAAA"));                    // Long
+  CHECK(!Database::Cursor::decode(token.substr(0, 10) + "!" + token.substr(11)));
+  CHECK(!Database::Cursor::decode(token.substr(0, 10) + " " + token.substr(11)));
+}
+
+// create() writes the schema from before versioning and migrates it like
+// an existing file, opening it again finds nothing left to do
+TEST(migration_from_version_zero) {
+  remove_database();
+  {
+    Database db(0);
+    CHECK(db.create(k_path));
+    CHECK(user_version(db) == Database::schema_version());
+    const auto tables = db.query<int64_t>(
+      "SELECT COUNT(*) FROM sqlite_master WHERE name IN "
+      "('chunk_store', 'build_log_refs', 'chunk_search', 'changes', 'settings')");
+    CHECK(tables && std::get<0>(*tables) == (db.search_enabled() ? 5 : 4));
+  }
+  {
+    Database db(0);
+    CHECK(db.open(k_path));
+    CHECK(user_version(db) == Database::schema_version());
+  }
+  remove_database();
+}
+
+// Transactions from many threads share write batches, one that gives up
+// or fails takes nothing else in its batch down with it
+TEST(group_commit) {
+  remove_database();
+  {
+    Database db(0);
+    CHECK(db.create(k_path));
+    db.set_batching(64, std::chrono::milliseconds(2));
+
+    constexpr int threads = 8;
+    constexpr int transactions = 50;
+    std::atomic<int> committed{ 0 };
+    std::atomic<int> mismatched{ 0 };
+    std::vector<std::thread> writers;
+    for (int thread = 0; thread < threads; thread++) {
+      writers.emplace_back([&, thread] {
+        for (int i = 0; i < transactions; i++) {
+          const std::string name = std::to_string(thread) + "-" + std::to_string(i);
+          // Every 5th gives up after writing, every 7th breaks a constraint
+          const bool abandon = i % 5 == 4;
+          const bool conflict = i % 7 == 6;
+          const bool success = db.transaction([&](Database::Writer& writer) {
+            if (!writer.insert("INSERT INTO projects(name, enabled) VALUES(?, 1)", name)) {
+              return false;
+            }
+            if (conflict && !writer.insert("INSERT INTO projects(name, enabled) VALUES(?, 1)", name)) {
+              return false;
+            }
+            return !abandon;
+          });
+          if (success != (!abandon && !conflict)) {
+            mismatched++;
+          }
+          committed += success;
+        }
+      });
+    }
+    for (auto& writer : writers) {
+      writer.join();
+    }
+
+    int expected = 0;
+    for (int i = 0; i < transactions; i++) {
+      expected += i % 5 != 4 && i % 7 != 6;
+    }
+    CHECK(mismatched == 0);
+    CHECK(committed == expected * threads);
+    const auto projects = db.query<int64_t>("SELECT COUNT(*) FROM projects");
+    CHECK(projects && std::get<0>(*projects) == committed);
+    const auto abandoned = db.query<int64_t>("SELECT COUNT(*) FROM projects WHERE name LIKE '%-4' OR name LIKE '%-6'");
+    CHECK(abandoned && std::get<0>(*abandoned) == 0);
+  }
+  remove_database();
+}
+
+// Many callers at once, each woken with its own result
+TEST(round_trip_under_load) {
+  for (const size_t readers : { size_t(0), size_t(2) }) {
+    remove_database();
+    Database db(readers);
+    CHECK(db.create(k_path));
+
+    constexpr int threads = 16;
+    constexpr int queries = 2000;
+    std::atomic<int> wrong{ 0 };
+    std::vector<std::thread> callers;
+    for (int thread = 0; thread < threads; thread++) {
+      callers.emplace_back([&, thread] {
+        for (int i = 0; i < queries; i++) {
+          const int64_t value = int64_t(thread) * queries + i;
+          const auto result = db.query<int64_t>("SELECT ? + 1", value);
+          if (!result || std::get<0>(*result) != value + 1) {
+            wrong++;
+          }
+        }
+      });
+    }
+    for (auto& caller : callers) {
+      caller.join();
+    }
+    CHECK(wrong == 0);
+  }
+  remove_database();
+}
+
+// With the database thread held up more callers arrive than its queue
+// holds, those that find it full wait for room rather than fail
+TEST(round_trip_full_queue) {
+  remove_database();
+  {
+    Database db(0);
+    CHECK(db.create(k_path));
+
+    std::atomic<bool> release{ false };
+    std::thread holder([&] {
+      db.transaction([&](Database::Writer&) {
+        while (!release.load()) {
+          std::this_thread::sleep_for(std::chrono::milliseconds(1));
+        }
+        return true;
+      });
+    });
+
+    constexpr size_t callers = Database::k_max_queued + 64;
+    std::atomic<size_t> answered{ 0 };
+    std::vector<std::thread> threads;
+    for (size_t caller = 0; caller < callers; caller++) {
+      threads.emplace_back([&, caller] {
+        const auto result = db.query<int64_t>("SELECT ?", int64_t(caller));
+        answered += result && std::get<0>(*result) == int64_t(caller);
+      });
+    }
+    std::this_thread::sleep_for(std::chrono::milliseconds(100));
+    CHECK(answered == 0);
+    release.store(true);
+    for (auto& thread : threads) {
+      thread.join();
+    }
+    holder.join();
+    CHECK(answered == callers);
+  }
+  remove_database();
+}
@@ -0,0 +1,123 @@
+#include "test.h"
+#include "hpack.h"
+
+// Decodes each header block in turn on one decoder, so later blocks see
+// the dynamic table the earlier ones built, and compares the fields
+static bool decodes(Hpack::Decoder& decoder, std::string_view block, const Hpack::Fields& expected) {
+  const auto bytes = Test::hex(block);
+  Hpack::Fields fields;
+  return decoder.decode(bytes.data(), bytes.size(), fields) && fields == expected;
+}
+
+static bool rejects(std::string_view block) {
+  Hpack::Decoder decoder;
+  const auto bytes = Test::hex(block);
+  Hpack::Fields fields;
+  return !decoder.decode(bytes.data(), bytes.size(), fields);
+}
+
+static const Hpack::Fields k_request_1 = {
+  { ":method", "GET" }, { ":scheme", "http" }, { ":path", "/" }, { ":authority", "www.example.com" }
+};
+static const Hpack::Fields k_request_2 = {
+  { ":method", "GET" }, { ":scheme", "http" }, { ":path", "/" }, { ":authority", "www.example.com" },
+  { "cache-control", "no-cache" }
+};
+static const Hpack::Fields k_request_3 = {
+  { ":method", "GET" }, { ":scheme", "https" }, { ":path", "/index.html" }, { ":authority", "www.example.com" },
+  { "custom-key", "custom-value" }
+};
+
+static const Hpack::Fields k_response_1 = {
+  { ":status", "302" }, { "cache-control", "private" }, { "date", "Mon, 21 Oct 2013 20:13:21 GMT" },
+  { "location", "https://www.example.com" }
+};
+static const Hpack::Fields k_response_2 = {
+  { ":status", "307" }, { "cache-control", "private" }, { "date", "Mon, 21 Oct 2013 20:13:21 GMT" },
+  { "location", "https://www.example.com" }
+};
+static const Hpack::Fields k_response_3 = {
+  { ":status", "200" }, { "cache-control", "private" }, { "date", "Mon, 21 Oct 2013 20:13:22 GMT" },
+  { "location", "https://www.example.com" }, { "content-encoding", "gzip" },
+  { "set-cookie", "foo=ASDJKHQKBZXOQWEOPIUAXQWEOIU; max-age=3600; version=1" }
+};
+
+// RFC 7541 C.2
+TEST(hpack_literal_fields) {
+  Hpack::Decoder decoder;
+  CHECK(decodes(decoder, "400a637573746f6d2d6b65790d637573746f6d2d686561646572", { { "custom-key", "custom-header" } }));
+  CHECK(decodes(decoder, "040c2f73616d706c652f70617468", { { ":path", "/sample/path" } }));
+  CHECK(decodes(decoder, "100870617373776f726406736563726574", { { "password", "secret" } }));
+  CHECK(decodes(decoder, "82", { { ":method", "GET" } }));
+}
+
+// RFC 7541 C.3
+TEST(hpack_requests) {
+  Hpack::Decoder decoder;
+  CHECK(decodes(decoder, "828684410f7777772e6578616d706c652e636f6d", k_request_1));
+  CHECK(decodes(decoder, "828684be58086e6f2d6361636865", k_request_2));
+  CHECK(decodes(decoder, "828785bf400a637573746f6d2d6b65790c637573746f6d2d76616c7565", k_request_3));
+}
+
+// RFC 7541 C.4
+TEST(hpack_huffman_requests) {
+  Hpack::Decoder decoder;
+  CHECK(decodes(decoder, "828684418cf1e3c2e5f23a6ba0ab90f4ff", k_request_1));
+  CHECK(decodes(decoder, "828684be5886a8eb10649cbf", k_request_2));
+  CHECK(decodes(decoder, "828785bf408825a849e95ba97d7f8925a849e95bb8e8b4bf", k_request_3));
+}
+
+// RFC 7541 C.5, the table is 256 bytes so entries are evicted
+TEST(hpack_responses) {
+  Hpack::Decoder decoder(256);
+  CHECK(decodes(decoder,
+    "4803333032580770726976617465611d4d6f6e2c203231204f637420323031332032303a31333a323120474d54"
+    "6e1768747470733a2f2f7777772e6578616d706c652e636f6d",
+    k_response_1));
+  CHECK(decodes(decoder, "4803333037c1c0bf", k_response_2));
+  CHECK(decodes(decoder,
+    "88c1611d4d6f6e2c203231204f637420323031332032303a31333a323220474d54c05a04677a69707738666f6f3d"
+    "4153444a4b48514b425a584f5157454f50495541585157454f49553b206d61782d6167653d333630303b207665"
+    "7273696f6e3d31",
+    k_response_3));
+}
+
+// RFC 7541 C.6
+TEST(hpack_huffman_responses) {
+  Hpack::Decoder decoder(256);
+  CHECK(decodes(decoder,
+    "488264025885aec3771a4b6196d07abe941054d444a8200595040b8166e082a62d1bff6e919d29ad171863c78f"
+    "0b97c8e9ae82ae43d3",
+    k_response_1));
+  CHECK(decodes(decoder, "4883640effc1c0bf", k_response_2));
+  CHECK(decodes(decoder,
+    "88c16196d07abe941054d444a8200595040b8166e084a62d1bffc05a839bd9ab77ad94e7821dd7f2e6c7b335df"
+    "dfcd5b3960d5af27087f3672c1ab270fb5291f9587316065c003ed4ee5b1063d5007",
+    k_response_3));
+}
+
+TEST(hpack_rejects_bad_blocks) {
+  CHECK(rejects("80"));                 // Index zero
+  CHECK(rejects("be"));                 // Past the end of an empty dynamic table
+  CHECK(rejects("3fe21f"));             // Table size update above the advertised 4096
+  CHECK(rejects("400a637573746f6d"));   // Name shorter than its length
+  CHECK(rejects("ff"));                 // Integer cut short
+  CHECK(rejects("0081ff"));             // Huffman string of padding longer than 7 bits
+}
+
+TEST(hpack_round_trip) {
+  Hpack::Encoder encoder;
+  std::string block;
+  encoder.encode(":status", "200", block);
+  encoder.encode("content-type", "application/json", block);
+  encoder.encode("set-cookie", "session=secret", block, Hpack::NEVER_INDEX);
+  encoder.encode("content-type", "application/json", block);
+
+  Hpack::Decoder decoder;
+  Hpack::Fields fields;
+  CHECK(decoder.decode(reinterpret_cast<const uint8_t *>(block.data()), block.size(), fields));
+  CHECK(fields == Hpack::Fields({
+    { ":status", "200" }, { "content-type", "application/json" },
+    { "set-cookie", "session=secret" }, { "content-type", "application/json" }
+  }));
+}
@@ -0,0 +1,78 @@
+#include <iostream> // std::cerr, std::cout
+
+#include <cstdio> // std::remove
+
+#include <ftw.h> // nftw, FTW_DEPTH, FTW_PHYS
+
+#include "test.h"
+
+struct Registered
+{
+  const char *name;
+  Test::Function function;
+};
+
+// Filled in by static initializers, so constructed on first use
+static std::vector<Registered>& registry() {
+  static std::vector<Registered> tests;
+  return tests;
+}
+
+static const char *current_test = "";
+static size_t failures = 0;
+
+Test::Test(const char *name, Function function) {
+  registry().push_back({ name, function });
+}
+
+void Test::fail(const char *file, int line, const char *expression) {
+  std::cerr << file << ":" << line << ": " << current_test << ": CHECK(" << expression << ") failed" << std::endl;
+  failures++;
+}
+
+int Test::run_all() {
+  size_t failed = 0;
+  for (const auto& test : registry()) {
+    current_test = test.name;
+    const size_t before = failures;
+    test.function();
+    if (failures != before) {
+      failed++;
+    }
+  }
+  std::cout << registry().size() - failed << "/" << registry().size() << " tests passed" << std::endl;
+  return failed ? 1 : 0;
+}
+
+std::vector<uint8_t> Test::hex(std::string_view digits) {
+  auto nibble = [](char ch) {
+    return ch <= '9' ? ch - '0' : (ch | 0x20) - 'a' + 10;
+  };
+  std::vector<uint8_t> bytes;
+  int high = -1;
+  for (const char ch : digits) {
+    if (ch == ' ') {
+      continue;
+    }
+    if (high < 0) {
+      high = nibble(ch);
+    } else {
+      bytes.push_back(static_cast<uint8_t>(high << 4 | nibble(ch)));
+      high = -1;
+    }
+  }
+  return bytes;
+}
+
+void Test::remove_database(const std::string& path) {
+  for (const char *suffix : { "", "-wal", "-shm", "-journal" }) {
+    std::remove((path + suffix).c_str());
+  }
+  nftw((path + ".logs").c_str(), [](const char *name, const struct stat *, int, FTW *) {
+    return std::remove(name) == 0 ? 0 : -1;
+  }, 8, FTW_DEPTH | FTW_PHYS);
+}
+
+int main() {
+  return Test::run_all();
+}
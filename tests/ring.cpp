@@ -0,0 +1,78 @@
+#include <thread> // std::thread
+#include <atomic> // std::atomic
+#include <vector> // std::vector
+
+#include "test.h"
+#include "ring.h"
+
+TEST(ring_full_and_empty) {
+  Ring<int, 4> ring;
+  int value = 0;
+  CHECK(ring.empty());
+  CHECK(!ring.pop(value));
+
+  // Several laps, so slots are reused with their sequence moved on
+  for (int lap = 0; lap < 3; lap++) {
+    for (int i = 0; i < 4; i++) {
+      CHECK(ring.push(lap * 4 + i));
+    }
+    CHECK(!ring.push(-1));
+    for (int i = 0; i < 4; i++) {
+      CHECK(ring.pop(value) && value == lap * 4 + i);
+    }
+    CHECK(!ring.pop(value));
+    CHECK(ring.empty());
+  }
+}
+
+// Every value pushed is popped exactly once, and one producer's values
+// come out in the order it pushed them
+TEST(ring_many_producers_and_consumers) {
+  constexpr int producers = 4;
+  constexpr int consumers = 4;
+  constexpr int values = 100000;
+  Ring<int, 64> ring;
+
+  std::vector<std::atomic<int>> seen(producers * values);
+  std::atomic<int> popped{ 0 };
+  std::atomic<int> reordered{ 0 };
+  std::vector<std::thread> threads;
+  for (int producer = 0; producer < producers; producer++) {
+    threads.emplace_back([&, producer] {
+      for (int i = 0; i < values; i++) {
+        while (!ring.push(producer * values + i)) {
+          std::this_thread::yield();
+        }
+      }
+    });
+  }
+  for (int consumer = 0; consumer < consumers; consumer++) {
+    threads.emplace_back([&] {
+      std::vector<int> last(producers, -1);
+      while (popped.load() < producers * values) {
+        int value = 0;
+        if (!ring.pop(value)) {
+          std::this_thread::yield();
+          continue;
+        }
+        if (value % values <= last[value / values]) {
+          reordered++;
+        }
+        last[value / values] = value % values;
+        seen[value]++;
+        popped++;
+      }
+    });
+  }
+  for (auto& thread : threads) {
+    thread.join();
+  }
+
+  CHECK(reordered == 0);
+  CHECK(ring.empty());
+  int once = 0;
+  for (const auto& count : seen) {
+    once += count == 1;
+  }
+  CHECK(once == producers * values);
+}
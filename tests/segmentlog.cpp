@@ -0,0 +1,111 @@
+#include <fstream> // std::fstream
+#include <string> // std::string
+#include <vector> // std::vector
+
+#include <sys/stat.h> // mkdir
+
+#include "test.h"
+#include "segmentlog.h"
+
+static constexpr const char k_path[] = "kaizen-test-segments.db";
+
+// Where Database would keep them, so remove_database() cleans up
+static std::string directory() {
+  return std::string(k_path) + ".logs/system_logs";
+}
+
+static std::unique_ptr<SegmentLog> open_log() {
+  mkdir((std::string(k_path) + ".logs").c_str(), 0755);
+  return SegmentLog::open(directory(), 0, 0);
+}
+
+static std::vector<SegmentLog::Record> records(const SegmentLog& log, std::vector<std::string>& contents) {
+  std::vector<SegmentLog::Record> found;
+  contents.clear();
+  log.scan(0, INT64_MAX, 0, [&](const SegmentLog::Record& record) {
+    found.push_back({ record.id, record.timestamp, {} });
+    contents.emplace_back(record.contents);
+    return true;
+  });
+  return found;
+}
+
+// Flips a byte of the first occurrence of text in the first segment
+static bool corrupt(std::string_view text) {
+  std::fstream file(directory() + "/0000000000000001.seg", std::ios::in | std::ios::out | std::ios::binary);
+  std::string head(1024 * 1024, '\0');
+  file.read(head.data(), head.size());
+  const size_t found = head.find(text);
+  if (found == std::string::npos) {
+    return false;
+  }
+  file.clear();
+  file.seekp(found);
+  file.put(head[found] ^ 0x20);
+  return file.good();
+}
+
+// A record torn by a crash ends the segment, with everything before it
+// kept and the next append taking its id
+TEST(segment_recovery) {
+  Test::remove_database(k_path);
+
+  // Past k_index_interval, so recovery starts from an index entry
+  const size_t count = 2 * SegmentLog::k_index_interval / 100;
+  {
+    auto log = open_log();
+    CHECK(log);
+    if (!log) {
+      return;
+    }
+    for (size_t i = 0; i < count; i++) {
+      CHECK(log->append(1000 + i, "record " + std::to_string(i) + std::string(80, '.')));
+    }
+    CHECK(log->append(2000, "torn record"));
+    CHECK(log->append(2001, "after the torn record"));
+    CHECK(log->sync());
+  }
+  CHECK(corrupt("torn record"));
+
+  // And half an index entry
+  {
+    std::ofstream index(directory() + "/0000000000000001.idx", std::ios::app | std::ios::binary);
+    index.write("\x01\x02\x03", 3);
+  }
+
+  std::vector<std::string> contents;
+  {
+    auto log = open_log();
+    CHECK(log);
+    if (!log) {
+      return;
+    }
+    auto found = records(*log, contents);
+    CHECK(found.size() == count);
+    CHECK(log->next_id() == int64_t(count + 1));
+    CHECK(!found.empty() && found.back().id == int64_t(count) && contents.back().find("record " + std::to_string(count - 1)) == 0);
+
+    CHECK(log->append(3000, "appended after recovery"));
+    CHECK(log->sync());
+  }
+  {
+    auto log = open_log();
+    CHECK(log);
+    if (!log) {
+      return;
+    }
+    auto found = records(*log, contents);
+    CHECK(found.size() == count + 1);
+    CHECK(!found.empty() && found.back().id == int64_t(count + 1) && contents.back() == "appended after recovery");
+
+    // Newest first from the end
+    std::vector<int64_t> ids;
+    log->scan_back(INT64_MAX, INT64_MAX, [&](const SegmentLog::Record& record) {
+      ids.push_back(record.id);
+      return ids.size() < 3;
+    });
+    CHECK(ids == std::vector<int64_t>({ int64_t(count + 1), int64_t(count), int64_t(count - 1) }));
+  }
+
+  Test::remove_database(k_path);
+}
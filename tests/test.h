@@ -0,0 +1,44 @@
+#ifndef TEST_H
+#define TEST_H
+
+#include <string_view> // std::string_view
+#include <string> // std::string
+#include <vector> // std::vector
+
+#include <cstdint> // uint8_t
+
+// Just enough of a harness for make test. TEST() registers a function
+// that main() runs, CHECK() records a failure and carries on so one run
+// reports everything that broke.
+struct Test
+{
+  typedef void (*Function)();
+
+  Test(const char *name, Function function);
+
+  static void fail(const char *file, int line, const char *expression);
+
+  // Runs every registered test, returns the exit code for main()
+  static int run_all();
+
+  // "82 86 84" or "828684" to bytes, for test vectors
+  static std::vector<uint8_t> hex(std::string_view digits);
+
+  // A database file left by an earlier run, with its journal files and
+  // segment directory
+  static void remove_database(const std::string& path);
+};
+
+#define TEST(name) \
+  static void test_##name(); \
+  static const Test test_##name##_registration(#name, test_##name); \
+  static void test_##name()
+
+#define CHECK(expression) \
+  do { \
+    if (!(expression)) { \
+      Test::fail(__FILE__, __LINE__, #expression); \
+    } \
+  } while (0)
+
+#endif
@@ -0,0 +1,84 @@
+#include "test.h"
+#include "websocket.h"
+
+// A masked client frame with an all zero mask, so the payload goes over
+// the wire as is
+static std::vector<uint8_t> frame(uint8_t first, std::string_view payload) {
+  std::vector<uint8_t> bytes = { first };
+  if (payload.size() < 126) {
+    bytes.push_back(static_cast<uint8_t>(0x80 | payload.size()));
+  } else {
+    bytes.push_back(0x80 | 126);
+    bytes.push_back(static_cast<uint8_t>(payload.size() >> 8));
+    bytes.push_back(static_cast<uint8_t>(payload.size()));
+  }
+  bytes.insert(bytes.end(), 4, 0);
+  bytes.insert(bytes.end(), payload.begin(), payload.end());
+  return bytes;
+}
+
+static std::optional<size_t> parse(std::vector<uint8_t> bytes, size_t size, WebSocket::Frame& frame) {
+  return WebSocket::parse(bytes.data(), size, frame);
+}
+
+static std::optional<size_t> parse(std::vector<uint8_t> bytes) {
+  WebSocket::Frame frame;
+  return WebSocket::parse(bytes.data(), bytes.size(), frame);
+}
+
+// RFC 6455 5.7
+TEST(websocket_masked_text) {
+  auto bytes = Test::hex("81 85 37fa213d 7f9f4d5158");
+  WebSocket::Frame frame;
+  CHECK(WebSocket::parse(bytes.data(), bytes.size(), frame) == size_t(11));
+  CHECK(frame.opcode == WebSocket::TEXT);
+  CHECK(frame.fin);
+  CHECK(frame.payload == "Hello");
+}
+
+TEST(websocket_needs_more_data) {
+  const auto hello = Test::hex("81 85 37fa213d 7f9f4d5158");
+  WebSocket::Frame frame;
+  for (size_t size = 0; size < hello.size(); size++) {
+    CHECK(parse(hello, size, frame) == size_t(0));
+  }
+
+  // Cut inside the extended length and inside the payload
+  const auto extended = ::frame(0x82, std::string(300, 'x'));
+  CHECK(parse(extended, 3, frame) == size_t(0));
+  CHECK(parse(extended, extended.size() - 1, frame) == size_t(0));
+  CHECK(parse(extended, extended.size(), frame) == extended.size());
+  CHECK(frame.payload.size() == 300);
+}
+
+TEST(websocket_fragments_and_control_frames) {
+  WebSocket::Frame frame;
+  CHECK(parse(::frame(0x01, "Hel"), 9, frame) == size_t(9));
+  CHECK(!frame.fin && frame.opcode == WebSocket::TEXT);
+  CHECK(parse(::frame(0x80, "lo"), 8, frame) == size_t(8));
+  CHECK(frame.fin && frame.opcode == WebSocket::CONTINUATION);
+
+  CHECK(parse(::frame(0x89, std::string(125, 'p'))) == size_t(131));
+  CHECK(parse(::frame(0x88, "")) == size_t(6));
+}
+
+TEST(websocket_rejects_bad_frames) {
+  CHECK(!parse(Test::hex("81 05 48656c6c6f")));               // Unmasked
+  CHECK(!parse(::frame(0xc1, "x")));                          // Reserved bit
+  CHECK(!parse(::frame(0x83, "x")));                          // Unknown opcode
+  CHECK(!parse(::frame(0x09, "x")));                          // Fragmented ping
+  CHECK(!parse(::frame(0x89, std::string(126, 'p'))));        // Control frame past 125 bytes
+  CHECK(!parse(Test::hex("82 ff 0000000000010001 00000000"))); // Past k_max_payload
+}
+
+TEST(websocket_serialize) {
+  CHECK(WebSocket::serialize(WebSocket::TEXT, "Hello") == "\x81\x05Hello");
+
+  const std::string large = WebSocket::serialize(WebSocket::BINARY, std::string(256, 'x'));
+  CHECK(large.size() == 4 + 256);
+  CHECK(large.compare(0, 4, std::string("\x82\x7e\x01\x00", 4)) == 0);
+
+  const std::string huge = WebSocket::serialize(WebSocket::BINARY, std::string(65536, 'x'));
+  CHECK(huge.size() == 10 + 65536);
+  CHECK(huge.compare(0, 10, std::string("\x82\x7f\x00\x00\x00\x00\x00\x01\x00\x00", 10)) == 0);
+}
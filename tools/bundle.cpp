@@ -0,0 +1,191 @@
+// Packs static assets into a C++ source file, see src/bundle.h
+//
+// bundle <output.cpp> <root> <gzip root> <files...>
+//
+// Every file under <root> becomes an asset at the path relative to it. The
+// gzip variant of each is expected at the same relative path under
+// <gzip root> with a .gz extension.
+
+#include <algorithm> // std::sort
+#include <fstream> // std::ifstream, std::ofstream
+#include <iostream> // std::cerr
+#include <sstream> // std::ostringstream
+#include <string> // std::string
+#include <vector> // std::vector
+
+#include <cstdint> // uint64_t
+#include <cstdio> // snprintf
+
+struct Asset
+{
+  std::string path;
+  std::string content_type;
+  std::string etag;
+  std::string contents;
+  std::string gzip;
+};
+
+static const struct { const char *extension; const char *content_type; } k_content_types[] = {
+  { ".html", "text/html; charset=utf-8" },
+  { ".css",  "text/css; charset=utf-8" },
+  { ".js",   "application/javascript; charset=utf-8" },
+  { ".json", "application/json" },
+  { ".txt",  "text/plain; charset=utf-8" },
+  { ".svg",  "image/svg+xml" },
+  { ".png",  "image/png" },
+  { ".ico",  "image/x-icon" },
+};
+
+static bool read(const std::string& name, std::string& contents) {
+  std::ifstream file(name, std::ios::binary);
+  if (!file) {
+    return false;
+  }
+  std::ostringstream stream;
+  stream << file.rdbuf();
+  contents = stream.str();
+  return true;
+}
+
+static std::string content_type(const std::string& path) {
+  for (const auto &entry : k_content_types) {
+    const std::string extension = entry.extension;
+    if (path.size() >= extension.size() &&
+        path.compare(path.size() - extension.size(), extension.size(), extension) == 0)
+    {
+      return entry.content_type;
+    }
+  }
+  return "application/octet-stream";
+}
+
+// FNV-1a, only has to change when the contents do
+static std::string etag(const std::string& contents) {
+  uint64_t hash = 14695981039346656037ull;
+  for (const unsigned char ch : contents) {
+    hash ^= ch;
+    hash *= 1099511628211ull;
+  }
+  char buffer[32];
+  snprintf(buffer, sizeof buffer, "\"%016llx\"", static_cast<unsigned long long>(hash));
+  return buffer;
+}
+
+// Emits a string literal, octal escapes can't swallow following digits
+// the way hex escapes do
+static std::string literal(const std::string& contents) {
+  std::string result = "\"";
+  size_t column = 0;
+  for (const unsigned char ch : contents) {
+    if (column >= 100) {
+      result += "\"\n    \"";
+      column = 0;
+    }
+    char buffer[8];
+    if (ch == '"' || ch == '\\' || ch == '?') {
+      buffer[0] = '\\';
+      buffer[1] = ch;
+      buffer[2] = '\0';
+    } else if (ch >= 0x20 && ch < 0x7f) {
+      buffer[0] = ch;
+      buffer[1] = '\0';
+    } else {
+      snprintf(buffer, sizeof buffer, "\\%03o", ch);
+    }
+    result += buffer;
+    column += std::char_traits<char>::length(buffer);
+  }
+  result += "\"";
+  return result;
+}
+
+static std::string view(const std::string& contents) {
+  return "{ " + literal(contents) + ", " + std::to_string(contents.size()) + " }";
+}
+
+static std::string header(const Asset& asset, bool gzip) {
+  std::string result;
+  result += "Content-Type: " + asset.content_type + "\r\n";
+  result += "Content-Length: " + std::to_string(gzip ? asset.gzip.size() : asset.contents.size()) + "\r\n";
+  if (gzip) {
+    result += "Content-Encoding: gzip\r\n";
+  }
+  result += "ETag: " + asset.etag + "\r\n";
+  // Always revalidate, the ETag makes that cheap
+  result += "Cache-Control: no-cache\r\n";
+  if (!asset.gzip.empty()) {
+    result += "Vary: Accept-Encoding\r\n";
+  }
+  return result;
+}
+
+int main(int argc, char **argv) {
+  if (argc < 4) {
+    std::cerr << "usage: " << argv[0] << " <output.cpp> <root> <gzip root> <files...>" << std::endl;
+    return 1;
+  }
+
+  const std::string root = argv[2];
+  const std::string gzip_root = argv[3];
+
+  std::vector<Asset> assets;
+  for (int i = 4; i < argc; i++) {
+    const std::string name = argv[i];
+    if (name.compare(0, root.size(), root) != 0) {
+      std::cerr << name << " is not under " << root << std::endl;
+      return 1;
+    }
+
+    Asset asset;
+    asset.path = name.substr(root.size());
+    if (asset.path.empty() || asset.path[0] != '/') {
+      asset.path = "/" + asset.path;
+    }
+    if (!read(name, asset.contents)) {
+      std::cerr << "Failed to read " << name << std::endl;
+      return 1;
+    }
+    asset.content_type = content_type(asset.path);
+    asset.etag = etag(asset.contents);
+
+    // Only keep the gzip variant when it's actually smaller
+    if (read(gzip_root + asset.path + ".gz", asset.gzip) && asset.gzip.size() >= asset.contents.size()) {
+      asset.gzip.clear();
+    }
+
+    assets.push_back(std::move(asset));
+  }
+
+  // Looked up with a binary search
+  std::sort(assets.begin(), assets.end(), [](const Asset& lhs, const Asset& rhs) {
+    return lhs.path < rhs.path;
+  });
+
+  std::ofstream output(argv[1], std::ios::binary);
+  if (!output) {
+    std::cerr << "Failed to create " << argv[1] << std::endl;
+    return 1;
+  }
+
+  output << "// Generated by tools/bundle, do not edit\n\n";
+  output << "#include \"../src/bundle.h\"\n\n";
+  output << "const Bundle::Asset Bundle::k_assets[] = {\n";
+  for (const auto &asset : assets) {
+    output << "  {\n";
+    output << "    " << view(asset.path) << ",\n";
+    output << "    " << view(asset.content_type) << ",\n";
+    output << "    " << view(asset.etag) << ",\n";
+    output << "    " << view(asset.contents) << ",\n";
+    output << "    " << view(asset.gzip) << ",\n";
+    output << "    " << view(header(asset, false)) << ",\n";
+    output << "    " << view(asset.gzip.empty() ? std::string() : header(asset, true)) << "\n";
+    output << "  },\n";
+  }
+  if (assets.empty()) {
+    output << "  { }\n";
+  }
+  output << "};\n\n";
+  output << "const size_t Bundle::k_count = " << assets.size() << ";\n";
+
+  return output ? 0 : 1;
+}